@@ -64,6 +64,7 @@ PreviewWindow::PreviewWindow()
     : mPreviewWindow(NULL),
       mPreviewFrameWidth(0),
       mPreviewFrameHeight(0),
+      mPreviewFrameRate(0),
       mPreviewEnabled(false),
       mOverlayFirstFrame(true),
       mShouldAdjustDimensions(true),
@@ -112,6 +113,7 @@ status_t PreviewWindow::setPreviewWindow(struct preview_stream_ops* window,
         }
     }
     mPreviewWindow = window;
+    mPreviewFrameRate = (preview_fps > 0) ? preview_fps : 0;
 
     return res;
 }
@@ -207,9 +209,12 @@ bool PreviewWindow::onNextFrameAvailableHW(const void* frame,
 
 	libhwclayerpara_t overlay_para;
 
+	// no deinterlace flags for camera frames
+	memset(&overlay_para, 0, sizeof(overlay_para));
 	overlay_para.bProgressiveSrc = 1;
 	overlay_para.bTopFieldFirst = 1;
-	overlay_para.pVideoInfo.frame_rate = 25000;
+	// the display engine expects frame rate * 1000, 0 lets hwcomposer use the output rate
+	overlay_para.pVideoInfo.frame_rate = mPreviewFrameRate * 1000;
 
 	overlay_para.top_y 		= (unsigned int)pv4l2_buf->addrPhyY;
 	overlay_para.top_c 		= (unsigned int)pv4l2_buf->addrPhyY + mPreviewFrameWidth * mPreviewFrameHeight;
@@ -159,6 +159,9 @@ protected:
     int                             mPreviewFrameWidth;
     int                             mPreviewFrameHeight;
 
+    /* Preview frame rate in fps, 0 when unknown. */
+    int                             mPreviewFrameRate;
+
     /* Preview status. */
     bool                            mPreviewEnabled;
 
@@ -0,0 +1,18 @@
+#ifndef __DISPLAY_EXT_H__
+#define __DISPLAY_EXT_H__
+
+//parameters the sun4i display HAL accepts on top of the DISPLAY_* ones in
+//hardware/display.h, kept clear of their range so both can grow
+
+//getdisplayparameter() param returning the display state generation, bumped whenever
+//a mode switch, an output hotplug or a picture setting changes what the getters return
+#define DISPLAY_STATE_GENERATION    0x1000
+
+//setdisplayparameter() types for the hardware cursor, the value goes in format:
+//FRAMESIZE splits the cursor memory into square frames of that edge, FRAME shows one,
+//ANIMATE cycles through (count << 16 | period in ms) frames, 0 stops
+#define DISPLAY_CURSOR_FRAMESIZE    0x1001
+#define DISPLAY_CURSOR_FRAME        0x1002
+#define DISPLAY_CURSOR_ANIMATE      0x1003
+
+#endif
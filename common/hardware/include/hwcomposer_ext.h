@@ -0,0 +1,21 @@
+#ifndef __HWCOMPOSER_EXT_H__
+#define __HWCOMPOSER_EXT_H__
+
+#include <stdint.h>
+
+//setparameter commands the sun4i hwcomposer accepts on top of the HWC_LAYER_* ones in
+//hardware/hwcomposer.h, kept clear of their range so both can grow
+
+//value points to a hwc_frame_time_t whose frame_id is filled in by the caller,
+//the hwcomposer remembers the last 16 frame ids
+#define HWC_LAYER_GETFRAMETIME      0x100
+
+typedef struct
+{
+    uint32_t                frame_id;
+    int64_t                 display_time;//CLOCK_MONOTONIC ns of the vsync that first showed frame_id
+    int64_t                 vsync_time;//last vsync seen
+    int64_t                 vsync_period;
+}hwc_frame_time_t;
+
+#endif
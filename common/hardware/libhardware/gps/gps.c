@@ -60,71 +60,53 @@ typedef struct {
     const char*  end;
 } Token;
 
-#define  MAX_NMEA_TOKENS  16
-
+/* walks the comma separated fields of a sentence, empty ones included,
+ * so that only the fields a sentence type needs are ever looked at */
 typedef struct {
-    int     count;
-    Token   tokens[ MAX_NMEA_TOKENS ];
-} NmeaTokenizer;
+    const char*  p;
+    const char*  end;
+} NmeaCursor;
 
-static int
-nmea_tokenizer_init( NmeaTokenizer*  t, const char*  p, const char*  end )
+static void
+nmea_cursor_init( NmeaCursor*  c, const char*  p, const char*  end )
 {
-    int    count = 0;
-    char*  q;
-
-    // the initial '$' is optional
-    if (p < end && p[0] == '$')
-        p += 1;
+    c->p   = p;
+    c->end = end;
+}
 
-    // remove trailing newline
-    if (end > p && end[-1] == '\n') {
-        end -= 1;
-        if (end > p && end[-1] == '\r')
-            end -= 1;
-    }
+static Token
+nmea_cursor_next( NmeaCursor*  c )
+{
+    Token        tok;
+    const char*  q;
 
-    // get rid of checksum at the end of the sentecne
-    if (end >= p+3 && end[-3] == '*') {
-        end -= 3;
+    if (c->p > c->end) {
+        // past the last field
+        tok.p = tok.end = c->end;
+        return tok;
     }
 
-    while (p < end) {
-        const char*  q = p;
-
-        q = memchr(p, ',', end-p);
-        if (q == NULL)
-            q = end;
-
-        if (q > p) {
-            if (count < MAX_NMEA_TOKENS) {
-                t->tokens[count].p   = p;
-                t->tokens[count].end = q;
-                count += 1;
-            }
-        }
-        if (q < end)
-            q += 1;
-
-        p = q;
-    }
+    q = memchr(c->p, ',', c->end - c->p);
+    if (q == NULL)
+        q = c->end;
 
-    t->count = count;
-    return count;
+    tok.p   = c->p;
+    tok.end = q;
+    c->p    = q + 1;
+    return tok;
 }
 
-static Token
-nmea_tokenizer_get( NmeaTokenizer*  t, int  index )
+static void
+nmea_cursor_skip( NmeaCursor*  c, int  count )
 {
-    Token  tok;
-    static const char*  dummy = "";
-
-    if (index < 0 || index >= t->count) {
-        tok.p = tok.end = dummy;
-    } else
-        tok = t->tokens[index];
+    while (count-- > 0)
+        nmea_cursor_next(c);
+}
 
-    return tok;
+static int
+nmea_token_char( Token  tok )
+{
+    return (tok.p < tok.end) ? tok.p[0] : 0;
 }
 
 
@@ -153,19 +135,40 @@ Fail:
     return -1;
 }
 
+/* digits after the decimal point beyond this one are ignored */
+#define  MAX_FRACTION_SCALE  1000000000LL
+
+/* parses "[-]ddd[.ddd]" without copying the field. stops at the first
+ * character that doesn't belong to the number, like strtod() did */
 static double
 str2float( const char*  p, const char*  end )
 {
-    int   result = 0;
-    int   len    = end - p;
-    char  temp[16];
+    long long  whole = 0, frac = 0, scale = 1;
+    int        neg   = 0;
 
-    if (len >= (int)sizeof(temp))
-        return 0.;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p  += 1;
+    }
+    for ( ; p < end; p++) {
+        int  c = *p - '0';
+        if ((unsigned)c >= 10)
+            break;
+        whole = whole*10 + c;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end; p++) {
+            int  c = *p - '0';
+            if ((unsigned)c >= 10)
+                break;
+            if (scale < MAX_FRACTION_SCALE) {
+                frac   = frac*10 + c;
+                scale *= 10;
+            }
+        }
+    }
 
-    memcpy( temp, p, len );
-    temp[len] = 0;
-    return strtod( temp, NULL );
+    return (neg ? -1. : 1.) * (whole + (double)frac / scale);
 }
 
 /*****************************************************************/
@@ -311,14 +314,37 @@ nmea_reader_update_date( NmeaReader*  r, Token  date, Token  time )
 }
 
 
-static double
-convert_from_hhmm( Token  tok )
+/* converts a "dddmm.mmmm" field to degrees. the minutes are kept as an
+ * integer count of their last decimal, so nothing is rounded until the
+ * final division */
+static int
+convert_from_hhmm( Token  tok, double*  dcoord )
 {
-    double  val     = str2float(tok.p, tok.end);
-    int     degrees = (int)(floor(val) / 100);
-    double  minutes = val - degrees*100.;
-    double  dcoord  = degrees + minutes / 60.0;
-    return dcoord;
+    const char*  p = tok.p;
+    long long    whole = 0, frac = 0, scale = 1;
+    long long    minutes;
+
+    for ( ; p < tok.end && *p != '.'; p++) {
+        int  c = *p - '0';
+        if ((unsigned)c >= 10)
+            return -1;
+        whole = whole*10 + c;
+    }
+    if (p < tok.end) {
+        for (p++; p < tok.end; p++) {
+            int  c = *p - '0';
+            if ((unsigned)c >= 10)
+                return -1;
+            if (scale < MAX_FRACTION_SCALE) {
+                frac   = frac*10 + c;
+                scale *= 10;
+            }
+        }
+    }
+
+    minutes = (whole % 100) * scale + frac;
+    *dcoord = (double)(whole / 100) + (double)minutes / (60. * scale);
+    return 0;
 }
 
 
@@ -337,7 +363,10 @@ nmea_reader_update_latlong( NmeaReader*  r,
         D("latitude is too short: '%.*s'", tok.end-tok.p, tok.p);
         return -1;
     }
-    lat = convert_from_hhmm(tok);
+    if (convert_from_hhmm(tok, &lat) < 0) {
+        D("latitude is not a number: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
     if (latitudeHemi == 'S')
         lat = -lat;
 
@@ -346,7 +375,10 @@ nmea_reader_update_latlong( NmeaReader*  r,
         D("longitude is too short: '%.*s'", tok.end-tok.p, tok.p);
         return -1;
     }
-    lon = convert_from_hhmm(tok);
+    if (convert_from_hhmm(tok, &lon) < 0) {
+        D("longitude is not a number: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
     if (longitudeHemi == 'W')
         lon = -lon;
 
@@ -406,34 +438,69 @@ nmea_reader_update_speed( NmeaReader*  r,
 }
 
 
+static int
+hex2int( int  c )
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+
+/* we received a complete sentence in [p, end), now parse it to generate
+ * a new GPS fix...
+ */
 static void
-nmea_reader_parse( NmeaReader*  r )
+nmea_reader_parse( NmeaReader*  r, const char*  p, const char*  end )
 {
-   /* we received a complete sentence, now parse it to generate
-    * a new GPS fix...
-    */
-    NmeaTokenizer  tzer[1];
+    NmeaCursor     cur[1];
     Token          tok;
+    const char*    star;
 
-    D("Received: '%.*s'", r->pos, r->in);
-    if (r->pos < 9) {
+    D("Received: '%.*s'", end-p, p);
+    if (end - p < 9) {
         D("Too short. discarded.");
         return;
     }
 
-    nmea_tokenizer_init(tzer, r->in, r->in + r->pos);
-#if GPS_DEBUG
-    {
-        int  n;
-        D("Found %d tokens", tzer->count);
-        for (n = 0; n < tzer->count; n++) {
-            Token  tok = nmea_tokenizer_get(tzer,n);
-            D("%2d: '%.*s'", n, tok.end-tok.p, tok.p);
+    // remove trailing newline
+    if (end > p && end[-1] == '\n') {
+        end -= 1;
+        if (end > p && end[-1] == '\r')
+            end -= 1;
+    }
+
+    // the initial '$' is optional
+    if (p < end && p[0] == '$')
+        p += 1;
+
+    // check and get rid of checksum at the end of the sentence
+    star = memchr(p, '*', end-p);
+    if (star != NULL) {
+        const char*  q;
+        int          sum = 0;
+
+        if (star + 3 != end ||
+            hex2int(star[1]) < 0 || hex2int(star[2]) < 0) {
+            D("bad checksum field '%.*s', discarded.", end-star, star);
+            return;
+        }
+        for (q = p; q < star; q++)
+            sum ^= (unsigned char)*q;
+        if (sum != hex2int(star[1])*16 + hex2int(star[2])) {
+            D("checksum mismatch, discarded.");
+            return;
         }
+        end = star;
     }
-#endif
 
-    tok = nmea_tokenizer_get(tzer, 0);
+    nmea_cursor_init(cur, p, end);
+
+    tok = nmea_cursor_next(cur);
     if (tok.p + 5 > tok.end) {
         D("sentence id '%.*s' too short, ignored.", tok.end-tok.p, tok.p);
         return;
@@ -443,43 +510,50 @@ nmea_reader_parse( NmeaReader*  r )
     tok.p += 2;
     if ( !memcmp(tok.p, "GGA", 3) ) {
         // GPS fix
-        Token  tok_time          = nmea_tokenizer_get(tzer,1);
-        Token  tok_latitude      = nmea_tokenizer_get(tzer,2);
-        Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,3);
-        Token  tok_longitude     = nmea_tokenizer_get(tzer,4);
-        Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,5);
-        Token  tok_altitude      = nmea_tokenizer_get(tzer,9);
-        Token  tok_altitudeUnits = nmea_tokenizer_get(tzer,10);
+        Token  tok_time          = nmea_cursor_next(cur);
+        Token  tok_latitude      = nmea_cursor_next(cur);
+        Token  tok_latitudeHemi  = nmea_cursor_next(cur);
+        Token  tok_longitude     = nmea_cursor_next(cur);
+        Token  tok_longitudeHemi = nmea_cursor_next(cur);
+        Token  tok_altitude, tok_altitudeUnits;
+
+        nmea_cursor_skip(cur, 3);
+        tok_altitude      = nmea_cursor_next(cur);
+        tok_altitudeUnits = nmea_cursor_next(cur);
 
         nmea_reader_update_time(r, tok_time);
         nmea_reader_update_latlong(r, tok_latitude,
-                                      tok_latitudeHemi.p[0],
+                                      nmea_token_char(tok_latitudeHemi),
                                       tok_longitude,
-                                      tok_longitudeHemi.p[0]);
+                                      nmea_token_char(tok_longitudeHemi));
         nmea_reader_update_altitude(r, tok_altitude, tok_altitudeUnits);
 
-    } else if ( !memcmp(tok.p, "GSA", 3) ) {
+    } else if ( !memcmp(tok.p, "GSA", 3) || !memcmp(tok.p, "GSV", 3) ) {
         // do something ?
     } else if ( !memcmp(tok.p, "RMC", 3) ) {
-        Token  tok_time          = nmea_tokenizer_get(tzer,1);
-        Token  tok_fixStatus     = nmea_tokenizer_get(tzer,2);
-        Token  tok_latitude      = nmea_tokenizer_get(tzer,3);
-        Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,4);
-        Token  tok_longitude     = nmea_tokenizer_get(tzer,5);
-        Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,6);
-        Token  tok_speed         = nmea_tokenizer_get(tzer,7);
-        Token  tok_bearing       = nmea_tokenizer_get(tzer,8);
-        Token  tok_date          = nmea_tokenizer_get(tzer,9);
-
-        D("in RMC, fixStatus=%c", tok_fixStatus.p[0]);
-        if (tok_fixStatus.p[0] == 'A')
+        Token  tok_time          = nmea_cursor_next(cur);
+        Token  tok_fixStatus     = nmea_cursor_next(cur);
+        Token  tok_latitude, tok_latitudeHemi;
+        Token  tok_longitude, tok_longitudeHemi;
+        Token  tok_speed, tok_bearing, tok_date;
+
+        D("in RMC, fixStatus=%c", nmea_token_char(tok_fixStatus));
+        if (nmea_token_char(tok_fixStatus) == 'A')
         {
+            tok_latitude      = nmea_cursor_next(cur);
+            tok_latitudeHemi  = nmea_cursor_next(cur);
+            tok_longitude     = nmea_cursor_next(cur);
+            tok_longitudeHemi = nmea_cursor_next(cur);
+            tok_speed         = nmea_cursor_next(cur);
+            tok_bearing       = nmea_cursor_next(cur);
+            tok_date          = nmea_cursor_next(cur);
+
             nmea_reader_update_date( r, tok_date, tok_time );
 
             nmea_reader_update_latlong( r, tok_latitude,
-                                           tok_latitudeHemi.p[0],
+                                           nmea_token_char(tok_latitudeHemi),
                                            tok_longitude,
-                                           tok_longitudeHemi.p[0] );
+                                           nmea_token_char(tok_longitudeHemi) );
 
             nmea_reader_update_bearing( r, tok_bearing );
             nmea_reader_update_speed  ( r, tok_speed );
@@ -526,26 +600,39 @@ nmea_reader_parse( NmeaReader*  r )
 }
 
 
+/* feeds a block of received bytes to the reader. complete sentences are
+ * parsed straight from the block; only a sentence that straddles two
+ * blocks is copied into r->in. a sentence longer than NMEA_MAX_SIZE is
+ * dropped up to its newline.
+ */
 static void
-nmea_reader_addc( NmeaReader*  r, int  c )
+nmea_reader_add( NmeaReader*  r, const char*  p, int  len )
 {
-    if (r->overflow) {
-        r->overflow = (c != '\n');
-        return;
-    }
+    const char*  end = p + len;
 
-    if (r->pos >= (int) sizeof(r->in)-1 ) {
-        r->overflow = 1;
-        r->pos      = 0;
-        return;
-    }
-
-    r->in[r->pos] = (char)c;
-    r->pos       += 1;
-
-    if (c == '\n') {
-        nmea_reader_parse( r );
-        r->pos = 0;
+    while (p < end) {
+        const char*  q    = memchr(p, '\n', end-p);
+        const char*  next = (q != NULL) ? q+1 : end;
+        int          n    = next - p;
+
+        if (r->overflow) {
+            r->overflow = (q == NULL);
+        } else if (r->pos + n > NMEA_MAX_SIZE) {
+            D("sentence too long, discarded.");
+            r->overflow = (q == NULL);
+            r->pos      = 0;
+        } else if (q == NULL) {
+            // keep the start of the sentence for the next block
+            memcpy(r->in + r->pos, p, n);
+            r->pos += n;
+        } else if (r->pos == 0) {
+            nmea_reader_parse( r, p, next );
+        } else {
+            memcpy(r->in + r->pos, p, n);
+            nmea_reader_parse( r, r->in, r->in + r->pos + n );
+            r->pos = 0;
+        }
+        p = next;
     }
 }
 
@@ -728,10 +815,10 @@ gps_state_thread( void*  arg )
                 }
                 else if (fd == gps_fd)
                 {
-                    char  buff[32];
+                    char  buff[512];
                     D("gps fd event");
                     for (;;) {
-                        int  nn, ret;
+                        int  ret;
 
                         ret = read( fd, buff, sizeof(buff) );
                         if (ret < 0) {
@@ -741,9 +828,10 @@ gps_state_thread( void*  arg )
                                 LOGE("error while reading from gps daemon socket: %s:", strerror(errno));
                             break;
                         }
+                        if (ret == 0)
+                            break;
                         D("received %d bytes: %.*s", ret, ret, buff);
-                        for (nn = 0; nn < ret; nn++)
-                            nmea_reader_addc( reader, buff[nn] );
+                        nmea_reader_add( reader, buff, ret );
                     }
                     D("gps fd event end");
                 }
@@ -22,7 +22,8 @@ include $(CLEAR_VARS)
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_SHARED_LIBRARIES := liblog libEGL
 LOCAL_SRC_FILES := hwcomposer.cpp
-LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE) \
+	device/softwinner/crane-common/hardware/libhardware/gralloc
 LOCAL_MODULE := hwcomposer.$(TARGET_BOARD_PLATFORM)
 LOCAL_CFLAGS:= -DLOG_TAG=\"hwcomposer\"
 LOCAL_MODULE_TAGS := optional
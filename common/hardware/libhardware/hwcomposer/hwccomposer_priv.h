@@ -5,11 +5,14 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
 
 #include <hardware/hwcomposer.h>
+#include <hwcomposer_ext.h>
 
 #include <EGL/egl.h>
 
@@ -21,6 +24,93 @@ enum
     HWC_STATUS_ALLOW_TO_OPEN    = 8,
 };
 
+#define HWC_DE_LAYER_NUM            4   //layers of one display engine back-end
+#define HWC_MAX_RGB_LAYERS          (HWC_DE_LAYER_NUM - 1)//all but the ui layer
+#define HWC_MAX_PLANNED_LAYERS      32
+
+enum
+{
+    HWC_PLAN_GPU                = -1,
+    HWC_PLAN_VIDEO              = -2,
+    HWC_PLAN_KEEP               = -3,//unchanged, still in the framebuffer from the last swap
+    //values >= 0 are indexes into rgb_layerhdl
+};
+
+typedef struct
+{
+    uint32_t                paddr;
+    uint32_t                width;//buffer stride, in pixel
+    uint32_t                height;
+    __disp_pixel_fmt_t      format;
+    __disp_pixel_seq_t      seq;
+    bool                    br_swap;
+}hwc_scanout_info_t;
+
+#define HWC_FRAME_TIME_NUM          16  //frame ids remembered for HWC_LAYER_GETFRAMETIME
+
+//how the video layer is driven for the current stream, see hwc_video_policy.
+//worked out again only when the stream, the hwc mode or the video window change.
+typedef struct
+{
+    bool                    valid;
+    bool                    progressive;
+    bool                    top_field_first;
+    bool                    maf_ok;
+    uint32_t                frame_rate;//as reported by the stream, *1000
+    uint32_t                hwc_mode;
+    uint32_t                out_type[2];//per screen output type and tv/hdmi mode
+    uint32_t                tv_mode[2];
+    uint32_t                scn_height[2];//video layer scn_win height per screen
+    bool                    deinterlace[2];//per screen, off when an interlaced output takes the fields as they are
+    uint32_t                out_frame_rate;
+}hwc_video_policy_t;
+
+#define HWC_TRACE_NUM               64  //frames kept for dump
+#define HWC_HIST_SWAP_NUM           6   //<2ms, <4ms, <8ms, <16ms, <33ms, longer
+#define HWC_HIST_OVERLAY_NUM        5   //0, 1, 2, 3, 4 or more layers on overlays
+#define HWC_HIST_IOCTL_NUM          5   //0, <=4, <=8, <=16, more display ioctls
+
+enum
+{
+    HWC_TRACE_SWAP_SKIPPED      = 1,
+    HWC_TRACE_SWAP_FAILED       = 2,
+    HWC_TRACE_GEOMETRY          = 4,
+};
+
+typedef struct
+{
+    int64_t                 start;//CLOCK_MONOTONIC ns hwc_set was entered
+    uint32_t                swap_us;
+    uint32_t                set_us;//whole hwc_set, swap included
+    uint16_t                ioctls;//display ioctls issued by hwc_set
+    uint8_t                 gpu_layers;
+    uint8_t                 kept_layers;
+    uint8_t                 rgb_layers;
+    uint8_t                 video_layers;
+    uint8_t                 flags;//HWC_TRACE_*
+}hwc_frame_trace_t;
+
+typedef struct
+{
+    uint32_t                frames;
+    uint32_t                swap_skipped;
+    uint32_t                swap_hist[HWC_HIST_SWAP_NUM];
+    uint32_t                overlay_hist[HWC_HIST_OVERLAY_NUM];
+    uint32_t                ioctl_hist[HWC_HIST_IOCTL_NUM];
+    hwc_frame_trace_t       trace[HWC_TRACE_NUM];
+    uint32_t                trace_pos;
+}hwc_stats_t;
+
+typedef struct
+{
+    buffer_handle_t         handle;
+    hwc_rect_t              sourceCrop;
+    hwc_rect_t              displayFrame;
+    uint32_t                transform;
+    int32_t                 blending;
+    bool                    in_fb;//composed by the gpu into the framebuffer
+}hwc_layer_state_t;
+
 typedef struct hwc_context_t 
 {
     hwc_composer_device_t 	device;
@@ -44,12 +134,32 @@ typedef struct hwc_context_t
 	hwc_rect_t              rect_out;
 	__disp_tv_mode_t        org_hdmi_mode;
 	__disp_rect_t           org_scn_win;
+	uint32_t                video_scn_height[2];//scn_win height last given to the video layer
 	uint32_t                app_width;
 	uint32_t                app_height;
 	uint32_t                screen_valid_width;
 	uint32_t                screen_valid_height;
 	bool					cur_3denable;
 	libhwclayerpara_t       cur_frame_para;
+	uint32_t                ui_pipe;
+	uint32_t                rgb_layerhdl[HWC_MAX_RGB_LAYERS];
+	uint32_t                rgb_open_mask;//rgb layers opened in the last frame
+	int                     layer_plan[HWC_MAX_PLANNED_LAYERS];
+	hwc_layer_state_t       prev_layer[HWC_MAX_PLANNED_LAYERS];
+	uint32_t                prev_layer_num;
+	bool                    skip_swap;//framebuffer unchanged, only overlays to update
+	pthread_mutex_t         lock;
+	pthread_cond_t          vsync_cond;
+	pthread_t               vsync_thread;
+	bool                    vsync_thread_run;
+	int64_t                 vsync_time;
+	int64_t                 vsync_period;
+	int                     last_frame_id;
+	int                     vsync_outliers;
+	hwc_frame_time_t        frame_time[HWC_FRAME_TIME_NUM];
+	hwc_video_policy_t      video_policy;
+	hwc_frame_trace_t       cur_trace;//frame between hwc_prepare and hwc_set
+	hwc_stats_t             stats;//guarded by lock
 }sun4i_hwc_context_t;
 
 #endif
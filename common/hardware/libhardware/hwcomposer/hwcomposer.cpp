@@ -20,6 +20,7 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <stdarg.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
@@ -29,6 +30,7 @@
 #include <fb.h>
 #include <EGL/egl.h>
 
+#include <gralloc_priv.h>
 #include "hwccomposer_priv.h"
 
 /*****************************************************************************/
@@ -54,6 +56,28 @@ hwc_module_t HAL_MODULE_INFO_SYM =
     }
 };
 
+static bool hwc_is_video_format(uint32_t format)
+{
+    return (format == HWC_FORMAT_MBYUV420)
+        || (format == HWC_FORMAT_MBYUV422)
+        || (format == HWC_FORMAT_YUV420PLANAR)
+        || (format == HWC_FORMAT_DEFAULT);
+}
+
+//display ioctl issued while composing a frame or driving the video layer from
+//setparameter, counted for the frame trace. the caller holds ctx->lock
+static int hwc_ioctl(sun4i_hwc_context_t *ctx, int fd, int cmd, void *arg)
+{
+    ctx->cur_trace.ioctls++;
+
+    return ioctl(fd, cmd, arg);
+}
+
+static int hwc_ioctl(sun4i_hwc_context_t *ctx, int fd, int cmd, unsigned long arg)
+{
+    return hwc_ioctl(ctx, fd, cmd, (void *)arg);
+}
+
 static void hwc_computer_rect(sun4i_hwc_context_t *ctx, int screen_idx, hwc_rect_t *rect_out, hwc_rect_t *rect_in)
 {
     int							ret;
@@ -81,19 +105,19 @@ static void hwc_computer_rect(sun4i_hwc_context_t *ctx, int screen_idx, hwc_rect
     {
         if(ctx->mode == HWC_MODE_SCREEN1)
         {
-            ioctl(ctx->mFD_fb[1], FBIOGET_VSCREENINFO, &var);
+            hwc_ioctl(ctx, ctx->mFD_fb[1], FBIOGET_VSCREENINFO, &var);
         }
         else
         {
-            ioctl(ctx->mFD_fb[0], FBIOGET_VSCREENINFO, &var);
+            hwc_ioctl(ctx, ctx->mFD_fb[0], FBIOGET_VSCREENINFO, &var);
         }
         screen_in_width                     = var.xres;
         screen_in_height                    = var.yres;
     }
 
     args[0] = screen_idx;
-    screen_out_width = ioctl(ctx->dispfd,DISP_CMD_SCN_GET_WIDTH,(unsigned long)args);
-    screen_out_height = ioctl(ctx->dispfd,DISP_CMD_SCN_GET_HEIGHT,(unsigned long)args);
+    screen_out_width = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_SCN_GET_WIDTH,(unsigned long)args);
+    screen_out_height = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_SCN_GET_HEIGHT,(unsigned long)args);
 
     LOGV("####in:%d,%d,%d,%d;%d,%d\n", rect_in->left, rect_in->top, rect_in->right - rect_in->left, rect_in->bottom-rect_in->top,screen_in_width, screen_in_height);
 
@@ -154,6 +178,18 @@ static void hwc_computer_rect(sun4i_hwc_context_t *ctx, int screen_idx, hwc_rect
 	LOGV("####out:%d,%d,%d,%d;%d,%d\n", temp_x, temp_y, temp_w, temp_h,screen_out_width, screen_out_height);
 }
 
+//the scaler is needed for yuv input, 3d and any size change, rgb shown 1:1 does without it
+static __disp_layer_work_mode_t hwc_video_layer_mode(sun4i_hwc_context_t *ctx, uint32_t format, 
+                                                     uint32_t src_w, uint32_t src_h, uint32_t scn_w, uint32_t scn_h)
+{
+    if(format == HWC_FORMAT_RGBA_8888 && !ctx->cur_3denable && src_w == scn_w && src_h == scn_h)
+    {
+        return DISP_LAYER_WORK_MODE_NORMAL;
+    }
+
+    return DISP_LAYER_WORK_MODE_SCALER;
+}
+
 static int hwc_set_rect(hwc_composer_device_t *dev,hwc_layer_list_t* list)
 {
     int 						ret = 0;
@@ -174,7 +210,7 @@ static int hwc_set_rect(hwc_composer_device_t *dev,hwc_layer_list_t* list)
             list->hwLayers[i].sourceCrop.left,list->hwLayers[i].sourceCrop.top,list->hwLayers[i].sourceCrop.right,list->hwLayers[i].sourceCrop.bottom,
             list->hwLayers[i].displayFrame.left,list->hwLayers[i].displayFrame.top,list->hwLayers[i].displayFrame.right,list->hwLayers[i].displayFrame.bottom);
 
-        if(list->hwLayers[i].compositionType == HWC_OVERLAY)
+        if(list->hwLayers[i].compositionType == HWC_OVERLAY && hwc_is_video_format(list->hwLayers[i].format))
         {
             hwc_rect_t croprect;
             hwc_rect_t displayframe_src, displayframe_dst;
@@ -196,11 +232,11 @@ static int hwc_set_rect(hwc_composer_device_t *dev,hwc_layer_list_t* list)
 
                     if(ctx->mode==HWC_MODE_SCREEN1)
                     {
-                        ioctl(ctx->mFD_fb[1], FBIOGET_VSCREENINFO, &var);
+                        hwc_ioctl(ctx, ctx->mFD_fb[1], FBIOGET_VSCREENINFO, &var);
                     }
                     else
                     {
-                        ioctl(ctx->mFD_fb[0], FBIOGET_VSCREENINFO, &var);
+                        hwc_ioctl(ctx, ctx->mFD_fb[0], FBIOGET_VSCREENINFO, &var);
                     }
 
                     if(ctx->mode == HWC_MODE_SCREEN0_GPU)
@@ -249,7 +285,7 @@ static int hwc_set_rect(hwc_composer_device_t *dev,hwc_layer_list_t* list)
                 	args[1] 				= ctx->video_layerhdl[screen_idx];
                 	args[2] 				= (unsigned long) (&layer_info);
                 	args[3] 				= 0;
-                	ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+                	ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
                 	if(ret < 0)
                 	{
                 	    LOGV("####DISP_CMD_LAYER_GET_PARA fail in hwc_set_rect, screen_idx:%d,hdl:%d\n",screen_idx,ctx->video_layerhdl[screen_idx]);
@@ -276,12 +312,15 @@ static int hwc_set_rect(hwc_composer_device_t *dev,hwc_layer_list_t* list)
                 	layer_info.scn_win.y = displayframe_dst.top;
                 	layer_info.scn_win.width = displayframe_dst.right - displayframe_dst.left;
                 	layer_info.scn_win.height = displayframe_dst.bottom - displayframe_dst.top;
+                	ctx->video_scn_height[screen_idx] = layer_info.scn_win.height;
+                	layer_info.mode = hwc_video_layer_mode(ctx, ctx->format, layer_info.src_win.width, layer_info.src_win.height,
+                	                                       layer_info.scn_win.width, layer_info.scn_win.height);
                     
                 	args[0] 				= screen_idx;
                 	args[1] 				= ctx->video_layerhdl[screen_idx];
                 	args[2] 				= (unsigned long) (&layer_info);
                 	args[3] 				= 0;
-                	ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+                	hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
                 }
                 
                 ctx->status[screen_idx] |= HWC_STATUS_COMPOSITED;
@@ -304,6 +343,129 @@ static int hwc_set_rect(hwc_composer_device_t *dev,hwc_layer_list_t* list)
 }
 
 
+//frame rate (*1000) and lines of an interlaced output mode, 0 for progressive ones
+static uint32_t hwc_output_field_rate(__disp_output_type_t out_type, __disp_tv_mode_t tv_mode, uint32_t *lines)
+{
+    if(out_type != DISP_OUTPUT_TYPE_TV && out_type != DISP_OUTPUT_TYPE_HDMI)
+    {
+        return 0;
+    }
+
+    switch(tv_mode)
+    {
+        case DISP_TV_MOD_480I:
+        case DISP_TV_MOD_NTSC:
+        case DISP_TV_MOD_NTSC_SVIDEO:
+        case DISP_TV_MOD_PAL_M:
+        case DISP_TV_MOD_PAL_M_SVIDEO:
+            *lines = 480;
+            return 30000;
+        case DISP_TV_MOD_576I:
+        case DISP_TV_MOD_PAL:
+        case DISP_TV_MOD_PAL_SVIDEO:
+        case DISP_TV_MOD_PAL_NC:
+        case DISP_TV_MOD_PAL_NC_SVIDEO:
+            *lines = 576;
+            return 25000;
+        case DISP_TV_MOD_1080I_50HZ:
+            *lines = 1080;
+            return 25000;
+        case DISP_TV_MOD_1080I_60HZ:
+            *lines = 1080;
+            return 30000;
+        default:
+            return 0;
+    }
+}
+
+//picks deinterlacing, field order and frame rate for the stream on the current outputs.
+//the decision is kept until the stream properties, the video window or the hwc mode change,
+//so every frame reaches the display engine with the same settings and no extra ioctls.
+static hwc_video_policy_t *hwc_video_policy(sun4i_hwc_context_t *ctx, libhwclayerpara_t *para)
+{
+    hwc_video_policy_t          *policy = &ctx->video_policy;
+    bool                        progressive = para->bProgressiveSrc ? true : false;
+    bool                        top_field_first = para->bTopFieldFirst ? true : false;
+    bool                        maf_ok = (para->maf_valid && para->flag_addr != 0);
+    uint32_t                    frame_rate = para->pVideoInfo.frame_rate;
+    unsigned long               args[4]={0};
+    __disp_output_type_t        out_type[2];
+    __disp_tv_mode_t            tv_mode[2];
+    bool                        same;
+    int                         screen_idx;
+
+    same = policy->valid && policy->progressive == progressive && policy->top_field_first == top_field_first
+        && policy->maf_ok == maf_ok && policy->frame_rate == frame_rate && policy->hwc_mode == ctx->mode;
+    for(screen_idx=0; screen_idx<2; screen_idx++)
+    {
+        if(policy->scn_height[screen_idx] != ctx->video_scn_height[screen_idx])
+        {
+            same = false;
+        }
+    }
+    if(same)
+    {
+        return policy;
+    }
+
+    //outputs are switched or replugged through a display mode switch, which sets the hwc
+    //mode again and so invalidates the policy: reading them here is enough
+    for(screen_idx=0; screen_idx<2; screen_idx++)
+    {
+        args[0] = screen_idx;
+        out_type[screen_idx] = (__disp_output_type_t)hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,(unsigned long)args);
+        tv_mode[screen_idx] = DISP_TV_MOD_720P_50HZ;
+        if(out_type[screen_idx] == DISP_OUTPUT_TYPE_HDMI)
+        {
+            tv_mode[screen_idx] = (__disp_tv_mode_t)hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_GET_MODE,(unsigned long)args);
+        }
+        else if(out_type[screen_idx] == DISP_OUTPUT_TYPE_TV)
+        {
+            tv_mode[screen_idx] = (__disp_tv_mode_t)hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_TV_GET_MODE,(unsigned long)args);
+        }
+    }
+
+    policy->progressive     = progressive;
+    policy->top_field_first = top_field_first;
+    policy->maf_ok          = maf_ok;
+    policy->frame_rate      = frame_rate;
+    policy->hwc_mode        = ctx->mode;
+
+    for(screen_idx=0; screen_idx<2; screen_idx++)
+    {
+        uint32_t                    field_rate;
+        uint32_t                    lines = 0;
+
+        policy->out_type[screen_idx]    = out_type[screen_idx];
+        policy->tv_mode[screen_idx]     = tv_mode[screen_idx];
+        policy->scn_height[screen_idx]  = ctx->video_scn_height[screen_idx];
+
+        //an interlaced output with the stream's line count and field rate shows the fields as they come,
+        //deinterlacing would only cost bandwidth and blur them. only if the window is not scaled
+        //vertically either, or the fields would be resampled across each other.
+        field_rate = hwc_output_field_rate(out_type[screen_idx], tv_mode[screen_idx], &lines);
+        policy->deinterlace[screen_idx] = !progressive;
+        if(!progressive && field_rate != 0 && lines == ctx->h && ctx->video_scn_height[screen_idx] == lines
+            && (frame_rate == 0 || (frame_rate + 1000 > field_rate && frame_rate < field_rate + 1000)))
+        {
+            policy->deinterlace[screen_idx] = false;
+        }
+    }
+
+    //without a rate from the stream, tell the engine the output rate so it does no rate conversion
+    policy->out_frame_rate = frame_rate;
+    if(policy->out_frame_rate == 0)
+    {
+        policy->out_frame_rate = (ctx->vsync_period > 0) ? (uint32_t)(1000000000000LL / ctx->vsync_period) : 60000;
+    }
+    policy->valid = true;
+
+    LOGD("####hwc_video_policy,progressive:%d,tff:%d,rate:%d,deinterlace:%d/%d,maf:%d\n",
+        progressive,top_field_first,policy->out_frame_rate,policy->deinterlace[0],policy->deinterlace[1],maf_ok);
+
+    return policy;
+}
+
 static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_update)
 {
     __disp_layer_info_t 		tmpLayerAttr;
@@ -376,7 +538,6 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
         tmpLayerAttr.fb.addr[2]         = 0;
         tmpLayerAttr.fb.size.width      = layer_info->w;
         tmpLayerAttr.fb.size.height     = layer_info->h;
-        tmpLayerAttr.mode               = DISP_LAYER_WORK_MODE_SCALER;
         tmpLayerAttr.alpha_en           = 1;
         tmpLayerAttr.alpha_val          = 0xff;
         tmpLayerAttr.pipe               = 1;
@@ -394,11 +555,11 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
         {
             args[0]                         = screen_idx;
             args[1]                         = ctx->video_layerhdl[screen_idx];
-            ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
+            ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
 
             args[0]                         = screen_idx;
             args[1]                         = ctx->video_layerhdl[screen_idx];
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
+            hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
 
             ctx->video_layerhdl[screen_idx] = 0;
         }
@@ -410,7 +571,7 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
             hwc_rect_t rect_out;
                         
             args[0]                         = screen_idx;
-            ctx->video_layerhdl[screen_idx]          = (uint32_t)ioctl(ctx->dispfd, DISP_CMD_LAYER_REQUEST,args);
+            ctx->video_layerhdl[screen_idx]          = (uint32_t)hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_REQUEST,args);
             if(ctx->video_layerhdl[screen_idx] == 0)
             {
                 LOGE("request layer failed!\n");
@@ -419,11 +580,11 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
 
             if((screen_idx == 0) && (ctx->mode != HWC_MODE_SCREEN0_BE))
             {
-                ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &ctx->ui_layerhdl[0]);
+                hwc_ioctl(ctx, ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &ctx->ui_layerhdl[0]);
             }
             else
             {
-                ioctl(ctx->mFD_fb[1], FBIOGET_LAYER_HDL_1, &ctx->ui_layerhdl[1]);
+                hwc_ioctl(ctx, ctx->mFD_fb[1], FBIOGET_LAYER_HDL_1, &ctx->ui_layerhdl[1]);
             }
 
             hwc_computer_rect(ctx, screen_idx, &rect_out,&ctx->rect_out);
@@ -432,16 +593,20 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
             tmpLayerAttr.scn_win.y          = rect_out.top;
             tmpLayerAttr.scn_win.width      = rect_out.right - rect_out.left;
             tmpLayerAttr.scn_win.height     = rect_out.bottom - rect_out.top;
+            ctx->video_scn_height[screen_idx] = tmpLayerAttr.scn_win.height;
+            tmpLayerAttr.mode               = hwc_video_layer_mode(ctx, layer_info->format, 
+                                                                   tmpLayerAttr.src_win.width, tmpLayerAttr.src_win.height,
+                                                                   tmpLayerAttr.scn_win.width, tmpLayerAttr.scn_win.height);
 
         	args[0] 						= screen_idx;
         	args[1] 						= ctx->video_layerhdl[screen_idx];
         	args[2] 						= (unsigned long) (&tmpLayerAttr);
         	args[3] 						= 0;
-        	ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+        	hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
 
             args[0]                         = screen_idx;
             args[1]                         = ctx->video_layerhdl[screen_idx];
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_BOTTOM, args);
+            hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_BOTTOM, args);
             
             ck.ck_min.alpha                 = 0xff;
             ck.ck_min.red                   = 0x00; //0x01;
@@ -457,17 +622,17 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
             ck.blue_match_rule              = 2;
             args[0]                         = screen_idx;
             args[1]                         = (unsigned long)&ck;
-            ioctl(ctx->dispfd,DISP_CMD_SET_COLORKEY,(void*)args);
+            hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_SET_COLORKEY,(void*)args);
 
             args[0]                         = screen_idx;
             args[1]                         = ctx->ui_layerhdl[screen_idx];
-            ioctl(ctx->dispfd,DISP_CMD_LAYER_CK_OFF,(void*)args);
+            hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_LAYER_CK_OFF,(void*)args);
 
         	args[0] 						= screen_idx;
         	args[1] 						= ctx->ui_layerhdl[screen_idx];
         	args[2] 						= (unsigned long) (&tmpLayerAttr);
         	args[3] 						= 0;
-        	ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+        	ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
             if(ret < 0)
             {
                 LOGD("####DISP_CMD_LAYER_GET_PARA fail in hwc_set_init_para, screen_idx:%d,hdl:%d\n",screen_idx,ctx->ui_layerhdl[screen_idx]);
@@ -477,18 +642,18 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
             {
                 args[0]                         = screen_idx;
                 args[1]                         = ctx->video_layerhdl[screen_idx];
-                ioctl(ctx->dispfd,DISP_CMD_LAYER_CK_ON,(void*)args);
+                hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_LAYER_CK_ON,(void*)args);
             }
             else
             {
                 args[0]                         = screen_idx;
                 args[1]                         = ctx->video_layerhdl[screen_idx];
-                ioctl(ctx->dispfd,DISP_CMD_LAYER_CK_OFF,(void*)args);
+                hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_LAYER_CK_OFF,(void*)args);
             }
 
             args[0]                         = screen_idx;
             args[1]                         = ctx->ui_layerhdl[screen_idx];
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_ALPHA_OFF, args);
+            hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_ALPHA_OFF, args);
         }
         ctx->status[screen_idx] &= (~(HWC_STATUS_OPENED | HWC_STATUS_HAVE_FRAME | HWC_STATUS_COMPOSITED));
         LOGV("####ctx->status[%d]=%d in hwc_set_init_para", screen_idx,ctx->status[screen_idx]);
@@ -499,6 +664,7 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
     ctx->h = layer_info->h;
     ctx->format = layer_info->format;
     ctx->screenid = layer_info->screenid;
+    ctx->video_policy.valid = false;
 
 	return 0;
 }
@@ -506,22 +672,39 @@ static int hwc_set_init_para(sun4i_hwc_context_t *ctx,uint32_t value,int alway_u
 static int hwc_set_frame_para(sun4i_hwc_context_t *ctx,uint32_t value)
 {
     __disp_video_fb_t      		tmpFrmBufAddr;
-    libhwclayerpara_t            *overlaypara;
+    libhwclayerpara_t            *overlaypara = (libhwclayerpara_t *)value;
+    hwc_video_policy_t          *policy;
     int                         ret;
     int                         screen_idx;
     unsigned long               args[4]={0};
 
     LOGV("####hwc_set_frame_para,mode:%d,status0:%d,status1:%d\n",ctx->mode,ctx->status[0],ctx->status[1]);
     
+    policy = hwc_video_policy(ctx, overlaypara);
+
     for(screen_idx=0; screen_idx<2; screen_idx++)
     {
         if(((screen_idx == 0) && (ctx->mode==HWC_MODE_SCREEN0 || ctx->mode==HWC_MODE_SCREEN0_AND_SCREEN1 || ctx->mode==HWC_MODE_SCREEN0_BE || ctx->mode==HWC_MODE_SCREEN0_GPU))
             || ((screen_idx == 1) && (ctx->mode==HWC_MODE_SCREEN1 || ctx->mode==HWC_MODE_SCREEN0_TO_SCREEN1 || ctx->mode==HWC_MODE_SCREEN0_AND_SCREEN1)))
         {
-            overlaypara                     = (libhwclayerpara_t *)value;
-            
-        	tmpFrmBufAddr.interlace         = (overlaypara->bProgressiveSrc?0:1);
+        	tmpFrmBufAddr.interlace         = policy->deinterlace[screen_idx];
         	tmpFrmBufAddr.top_field_first   = overlaypara->bTopFieldFirst;
+        	tmpFrmBufAddr.frame_rate        = policy->out_frame_rate;
+        	//motion adaptive deinterlacing only with a flag buffer, anything else sends the engine down the slow path
+        	if(policy->deinterlace[screen_idx] && policy->maf_ok)
+        	{
+            	tmpFrmBufAddr.flag_addr         = overlaypara->flag_addr;
+            	tmpFrmBufAddr.flag_stride       = overlaypara->flag_stride;
+            	tmpFrmBufAddr.maf_valid         = overlaypara->maf_valid;
+            	tmpFrmBufAddr.pre_frame_valid   = overlaypara->pre_frame_valid;
+        	}
+        	else
+        	{
+            	tmpFrmBufAddr.flag_addr         = 0;
+            	tmpFrmBufAddr.flag_stride       = 0;
+            	tmpFrmBufAddr.maf_valid         = 0;
+            	tmpFrmBufAddr.pre_frame_valid   = 0;
+        	}
         	tmpFrmBufAddr.addr[0]           = overlaypara->top_y;
         	tmpFrmBufAddr.addr[1]           = overlaypara->top_c;
         	tmpFrmBufAddr.addr[2]			= overlaypara->bottom_y;
@@ -540,7 +723,7 @@ static int hwc_set_frame_para(sun4i_hwc_context_t *ctx,uint32_t value)
             	args[1] 				= ctx->video_layerhdl[screen_idx];
             	args[2] 				= (unsigned long) (&layer_info);
             	args[3] 				= 0;
-            	ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+            	ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
                 if(ret < 0)
                 {
                     LOGD("####DISP_CMD_LAYER_GET_PARA fail in hwc_set_frame_para, screen_idx:%d,hdl:%d\n",screen_idx,ctx->video_layerhdl[screen_idx]);
@@ -557,11 +740,11 @@ static int hwc_set_frame_para(sun4i_hwc_context_t *ctx,uint32_t value)
             	args[1] 				= ctx->video_layerhdl[screen_idx];
             	args[2] 				= (unsigned long) (&layer_info);
             	args[3] 				= 0;
-            	ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+            	ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
             	
                 args[0]                         = screen_idx;
                 args[1]                         = ctx->video_layerhdl[screen_idx];
-                ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_START, args);
+                ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_START, args);
         	}
 
             //allow to open,have been composited,and have not been opened
@@ -574,7 +757,7 @@ static int hwc_set_frame_para(sun4i_hwc_context_t *ctx,uint32_t value)
         		args[1] 					= ctx->video_layerhdl[screen_idx];
         		args[2] 					= 0;
         		args[3] 					= 0;
-        		ioctl(ctx->dispfd, DISP_CMD_LAYER_OPEN,args);
+        		hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_OPEN,args);
 
         		ctx->status[screen_idx] |= HWC_STATUS_OPENED;
         		LOGV("####ctx->status[%d]=%d in hwc_set_frame_para", screen_idx,ctx->status[screen_idx]);
@@ -584,7 +767,7 @@ static int hwc_set_frame_para(sun4i_hwc_context_t *ctx,uint32_t value)
             args[1]                 = ctx->video_layerhdl[screen_idx];
         	args[2]                 = (unsigned long)(&tmpFrmBufAddr);
         	args[3]                 = 0;
-        	ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_SET_FB,args);
+        	ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_SET_FB,args);
             LOGV("####DISP_CMD_VIDEO_SET_FB,%d,%d,ret:%d\n", screen_idx,ctx->video_layerhdl[screen_idx],ret);
 
         }
@@ -607,13 +790,13 @@ static int hwc_get_frame_id(sun4i_hwc_context_t *ctx)
     {
     	args[0] = 0;
     	args[1] = ctx->video_layerhdl[0];
-    	ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
+    	ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
     }
     else if(ctx->mode==HWC_MODE_SCREEN0_TO_SCREEN1 || ctx->mode==HWC_MODE_SCREEN1)
     {
         args[0] = 1;
         args[1] = ctx->video_layerhdl[1];
-        ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
+        ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
     }
     else if(ctx->mode == HWC_MODE_SCREEN0_AND_SCREEN1)
     {
@@ -621,11 +804,11 @@ static int hwc_get_frame_id(sun4i_hwc_context_t *ctx)
         
     	args[0] = 0;
     	args[1] = ctx->video_layerhdl[0];
-    	ret0 = ioctl(ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
+    	ret0 = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
 
         args[0] = 1;
         args[1] = ctx->video_layerhdl[1];
-        ret1 = ioctl(ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
+        ret1 = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_GET_FRAME_ID, args);
 
         ret = (ret0<ret1)?ret0:ret1;
     }
@@ -637,6 +820,116 @@ static int hwc_get_frame_id(sun4i_hwc_context_t *ctx)
     return ret;
 }
 
+static int64_t hwc_now_ns(void)
+{
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//only wait for vsync while a video layer needs frame times, an idle device should not wake up 60 times a second
+static bool hwc_vsync_wanted(sun4i_hwc_context_t *ctx)
+{
+    return (ctx->status[0] & HWC_STATUS_OPENED) || (ctx->status[1] & HWC_STATUS_OPENED);
+}
+
+static void hwc_vsync_update_period(sun4i_hwc_context_t *ctx, int64_t now)
+{
+    int64_t                     delta = now - ctx->vsync_time;
+
+    if(ctx->vsync_time == 0)
+    {
+        return;
+    }
+
+    //a missed vsync or a new output mode: follow a steady new rate, drop single outliers
+    if(delta < ctx->vsync_period / 2 || delta > ctx->vsync_period * 2)
+    {
+        if(++ctx->vsync_outliers >= 8)
+        {
+            ctx->vsync_period = delta;
+            ctx->vsync_outliers = 0;
+        }
+        return;
+    }
+
+    ctx->vsync_period += (delta - ctx->vsync_period) / 8;
+    ctx->vsync_outliers = 0;
+}
+
+static void *hwc_vsync_loop(void *data)
+{
+    sun4i_hwc_context_t         *ctx = (sun4i_hwc_context_t *)data;
+    uint32_t                    crtc = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    while(ctx->vsync_thread_run)
+    {
+        int64_t                     now;
+        int                         frame_id;
+
+        if(!hwc_vsync_wanted(ctx))
+        {
+            ctx->vsync_time = 0;
+            ctx->last_frame_id = -1;
+            memset(ctx->frame_time, 0, sizeof(ctx->frame_time));
+            pthread_cond_wait(&ctx->vsync_cond, &ctx->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&ctx->lock);
+        if(ioctl(ctx->mFD_fb[0], FBIO_WAITFORVSYNC, &crtc) < 0)
+        {
+            LOGE("####FBIO_WAITFORVSYNC failed: %s, vsync thread exit\n", strerror(errno));
+            pthread_mutex_lock(&ctx->lock);
+            break;
+        }
+        now = hwc_now_ns();
+        pthread_mutex_lock(&ctx->lock);
+
+        hwc_vsync_update_period(ctx, now);
+        ctx->vsync_time = now;
+
+        //the first vsync a frame id shows up on is when that frame hit the screen
+        frame_id = hwc_get_frame_id(ctx);
+        if(frame_id >= 0 && frame_id != ctx->last_frame_id)
+        {
+            hwc_frame_time_t            *ft = &ctx->frame_time[frame_id % HWC_FRAME_TIME_NUM];
+
+            ft->frame_id        = frame_id;
+            ft->display_time    = now;
+            ctx->last_frame_id  = frame_id;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+static int hwc_get_frame_time(sun4i_hwc_context_t *ctx, hwc_frame_time_t *frame_time)
+{
+    hwc_frame_time_t            *ft;
+
+    if(frame_time == NULL)
+    {
+        return -1;
+    }
+
+    ft = &ctx->frame_time[frame_time->frame_id % HWC_FRAME_TIME_NUM];
+
+    frame_time->vsync_time      = ctx->vsync_time;
+    frame_time->vsync_period    = ctx->vsync_period;
+    if(ft->display_time != 0 && ft->frame_id == frame_time->frame_id)
+    {
+        frame_time->display_time = ft->display_time;
+        return 0;
+    }
+
+    frame_time->display_time    = 0;
+    return -1;
+}
+
 static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
 {
 	video3Dinfo_t *_3d_info = (video3Dinfo_t *)para;
@@ -659,7 +952,7 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
             args[0] = screen_idx;
             args[1] = ctx->video_layerhdl[screen_idx];
             args[2] = (unsigned long)&layer_info;
-            ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+            ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
             if(ret < 0)
             {
                 LOGD("####DISP_CMD_LAYER_GET_PARA fail in hwc_set3dmode, screen_idx:%d,hdl:%d\n",screen_idx,ctx->video_layerhdl[screen_idx]);
@@ -711,11 +1004,11 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
             }
 
             args[0] = screen_idx;
-            out_type = (__disp_output_type_t)ioctl(ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,(unsigned long)args);
+            out_type = (__disp_output_type_t)hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_GET_OUTPUT_TYPE,(unsigned long)args);
             if(out_type == DISP_OUTPUT_TYPE_HDMI)
             {
                 args[0] = screen_idx;
-                hdmi_mode = (__disp_tv_mode_t)ioctl(ctx->dispfd,DISP_CMD_HDMI_GET_MODE,(unsigned long)args);
+                hdmi_mode = (__disp_tv_mode_t)hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_GET_MODE,(unsigned long)args);
 
                 if(hdmi_mode == DISP_TV_MOD_1080P_24HZ_3D_FP || hdmi_mode == DISP_TV_MOD_720P_50HZ_3D_FP || hdmi_mode == DISP_TV_MOD_720P_60HZ_3D_FP)
                 {
@@ -728,7 +1021,7 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
                             args[0]                         = 1;
                             args[1]                         = ctx->ui_layerhdl[1];
                             args[2]                         = (unsigned long) (&tmpLayerAttr);
-                            ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+                            ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
 
                             tmpLayerAttr.scn_win.x = ctx->org_scn_win.x;
                             tmpLayerAttr.scn_win.y = ctx->org_scn_win.y;
@@ -738,18 +1031,18 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
                             args[0]                         = 1;
                             args[1]                         = ctx->ui_layerhdl[1];
                             args[2]                         = (unsigned long) (&tmpLayerAttr);
-                            ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+                            ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
                         }
                         
                         args[0] = screen_idx;
-                        ret = ioctl(ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
+                        ret = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
 
                         args[0] = screen_idx;
                         args[1] = ctx->org_hdmi_mode;
-                        ioctl(ctx->dispfd,DISP_CMD_HDMI_SET_MODE,(unsigned long)args);
+                        hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_SET_MODE,(unsigned long)args);
                         
                         args[0] = screen_idx;
-                        ret = ioctl(ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
+                        ret = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
                     }
                 }
                 else
@@ -765,7 +1058,7 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
                             args[0]                         = 1;
                             args[1]                         = ctx->ui_layerhdl[1];
                             args[2]                         = (unsigned long) (&tmpLayerAttr);
-                            ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
+                            ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_GET_PARA, args);
                             
                             ctx->org_scn_win.x = tmpLayerAttr.scn_win.x;
                             ctx->org_scn_win.y = tmpLayerAttr.scn_win.y;
@@ -787,11 +1080,11 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
                             args[0]                         = 1;
                             args[1]                         = ctx->ui_layerhdl[1];
                             args[2]                         = (unsigned long) (&tmpLayerAttr);
-                            ret = ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+                            ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
                         }
                         
                         args[0] = screen_idx;
-                        ret = ioctl(ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
+                        ret = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
                         
                         args[0] = screen_idx;
                         if(_3d_out == HWC_3D_OUT_MODE_HDMI_3D_1080P24_FP)
@@ -806,10 +1099,10 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
                         {
                             args[1] = DISP_TV_MOD_720P_60HZ_3D_FP;
                         }
-                        ioctl(ctx->dispfd,DISP_CMD_HDMI_SET_MODE,(unsigned long)args);
+                        hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_SET_MODE,(unsigned long)args);
                         
                         args[0] = screen_idx;
-                        ret = ioctl(ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
+                        ret = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
                     }
                 }
             }
@@ -843,13 +1136,18 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
                 layer_info.b_trd_out = 0;
             }
 
+            if(layer_info.fb.b_trd_src || layer_info.b_trd_out)
+            {
+                layer_info.mode = DISP_LAYER_WORK_MODE_SCALER;
+            }
+
             if(layer_info.b_trd_out)
             {
                 unsigned int w,h;
                 
                 args[0] = screen_idx;
-                w = ioctl(ctx->dispfd,DISP_CMD_SCN_GET_WIDTH,(unsigned long)args);
-                h = ioctl(ctx->dispfd,DISP_CMD_SCN_GET_HEIGHT,(unsigned long)args);
+                w = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_SCN_GET_WIDTH,(unsigned long)args);
+                h = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_SCN_GET_HEIGHT,(unsigned long)args);
 
                 layer_info.scn_win.x = 0;
                 layer_info.scn_win.y = 0;
@@ -860,7 +1158,8 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
             args[0] = screen_idx;
             args[1] = ctx->video_layerhdl[screen_idx];
             args[2] = (unsigned long)&layer_info;
-            ioctl(ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+            hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+            ctx->video_scn_height[screen_idx] = layer_info.scn_win.height;
         }
     }
 
@@ -870,43 +1169,602 @@ static int hwc_set3dmode(sun4i_hwc_context_t *ctx,int para)
     ctx->cur_3d_src = _3d_info->src_mode;
     ctx->cur_3d_out = _3d_info->display_mode;
     ctx->cur_3denable = layer_info.b_trd_out;
+    ctx->video_policy.valid = false;
     return 0;
 }
 
-static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) 
+static int hwc_layer_get_scanout(hwc_layer_t *layer, hwc_scanout_info_t *info)
 {
-    if(true)
+    private_handle_t const      *hnd = (private_handle_t const *)layer->handle;
+
+    //the display engine can only fetch from physically contiguous memory
+    if(hnd == NULL || hnd->numInts != private_handle_t::sNumIntsContiguous || hnd->magic != private_handle_t::sMagic
+        || !(hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) || hnd->phys == 0)
     {
-        for (size_t i=0 ; i<list->numHwLayers ; i++) 
+        return -1;
+    }
+
+    switch(hnd->format)
+    {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+            info->format    = DISP_FORMAT_ARGB8888;
+            info->seq       = DISP_SEQ_ARGB;
+            info->br_swap   = true;
+            break;
+
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            info->format    = DISP_FORMAT_ARGB8888;
+            info->seq       = DISP_SEQ_ARGB;
+            info->br_swap   = false;
+            break;
+
+        case HAL_PIXEL_FORMAT_RGB_565:
+            info->format    = DISP_FORMAT_RGB565;
+            info->seq       = DISP_SEQ_P10;
+            info->br_swap   = false;
+            break;
+
+        default:
+            return -1;
+    }
+
+    info->paddr     = hnd->phys;
+    info->width     = hnd->stride;
+    info->height    = hnd->height;
+
+    return 0;
+}
+
+static bool hwc_rect_intersect(const hwc_rect_t *a, const hwc_rect_t *b)
+{
+    return (a->left < b->right) && (b->left < a->right)
+        && (a->top < b->bottom) && (b->top < a->bottom);
+}
+
+static bool hwc_can_use_de_layer(sun4i_hwc_context_t *ctx, hwc_layer_t *layer)
+{
+    hwc_scanout_info_t          info;
+    int                         src_w = layer->sourceCrop.right - layer->sourceCrop.left;
+    int                         src_h = layer->sourceCrop.bottom - layer->sourceCrop.top;
+    int                         dst_w = layer->displayFrame.right - layer->displayFrame.left;
+    int                         dst_h = layer->displayFrame.bottom - layer->displayFrame.top;
+
+    if((layer->flags & HWC_SKIP_LAYER) || layer->transform != 0)
+    {
+        return false;
+    }
+
+    //normal mode layers can not scale, the scalers are kept for the video layers
+    if(src_w <= 0 || src_h <= 0 || src_w != dst_w || src_h != dst_h)
+    {
+        return false;
+    }
+
+    if(layer->displayFrame.left < 0 || layer->displayFrame.top < 0
+        || layer->displayFrame.right > (int)ctx->screen_valid_width
+        || layer->displayFrame.bottom > (int)ctx->screen_valid_height)
+    {
+        return false;
+    }
+
+    return hwc_layer_get_scanout(layer, &info) == 0;
+}
+
+/*
+ * The ui framebuffer sits on one pipe of the DE back-end and blends over the
+ * other pipe with its pixel alpha. Layers of the same pipe are not blended, the
+ * pixel of the layer with the higher priority wins. So the layers we take out of
+ * the framebuffer must be a run from the bottom of the list, and a non opaque one
+ * may not cover another hardware layer.
+ */
+static int hwc_plan_rgb_layers(sun4i_hwc_context_t *ctx, hwc_layer_list_t *list)
+{
+    unsigned int                free_num;
+    unsigned int                used_num = 0;
+    size_t                      i, j;
+
+    if(ctx->mode != HWC_MODE_SCREEN0 || ctx->cur_3denable)
+    {
+        return 0;
+    }
+
+    free_num = HWC_DE_LAYER_NUM - 1;
+    if(ctx->video_layerhdl[0] != 0)
+    {
+        free_num--;
+    }
+
+    for(i=0; i<list->numHwLayers && i<HWC_MAX_PLANNED_LAYERS && used_num<free_num; i++)
+    {
+        hwc_layer_t *layer = &list->hwLayers[i];
+
+        if(!hwc_can_use_de_layer(ctx, layer))
         {
-            if((list->hwLayers[i].format == HWC_FORMAT_MBYUV420)
-                ||(list->hwLayers[i].format == HWC_FORMAT_MBYUV422)
-                ||(list->hwLayers[i].format == HWC_FORMAT_YUV420PLANAR)
-                ||(list->hwLayers[i].format == HWC_FORMAT_DEFAULT))
-        	{
-            	list->hwLayers[i].compositionType = HWC_OVERLAY;
-        	}
-        	else
+            break;
+        }
+
+        if(layer->blending != HWC_BLENDING_NONE)
+        {
+            for(j=0; j<i; j++)
+            {
+                if(hwc_rect_intersect(&layer->displayFrame, &list->hwLayers[j].displayFrame))
+                {
+                    break;
+                }
+            }
+            if(j < i)
+            {
+                break;
+            }
+        }
+
+        layer->compositionType = HWC_OVERLAY;
+        layer->hints |= HWC_HINT_CLEAR_FB;
+        ctx->layer_plan[i] = used_num++;
+    }
+
+    LOGV("####hwc_plan_rgb_layers, %d of %d layers to the display engine\n", used_num, list->numHwLayers);
+
+    return used_num;
+}
+
+static bool hwc_rect_equal(const hwc_rect_t *a, const hwc_rect_t *b)
+{
+    return a->left == b->left && a->top == b->top && a->right == b->right && a->bottom == b->bottom;
+}
+
+//if nothing the gpu would compose has changed since the last frame, the framebuffer
+//already holds the right content: hand those layers to the hwc so surfaceflinger does not
+//draw them, and let hwc_set skip the swap. only the overlays are updated on such frames.
+static void hwc_keep_fb_layers(sun4i_hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    bool                        same;
+    size_t                      i;
+
+    same = !(list->flags & HWC_GEOMETRY_CHANGED)
+        && list->numHwLayers <= HWC_MAX_PLANNED_LAYERS
+        && list->numHwLayers == ctx->prev_layer_num;
+
+    for(i=0; i<list->numHwLayers && i<HWC_MAX_PLANNED_LAYERS; i++)
+    {
+        hwc_layer_t                 *layer = &list->hwLayers[i];
+        hwc_layer_state_t           *prev = &ctx->prev_layer[i];
+        bool                        in_fb = (layer->compositionType == HWC_FRAMEBUFFER);
+
+        if(same)
+        {
+            if(prev->in_fb != in_fb)
+            {
+                same = false;
+            }
+            else if(in_fb && ((layer->flags & HWC_SKIP_LAYER)
+                || prev->handle != layer->handle
+                || prev->transform != layer->transform
+                || prev->blending != layer->blending
+                || !hwc_rect_equal(&prev->sourceCrop, &layer->sourceCrop)
+                || !hwc_rect_equal(&prev->displayFrame, &layer->displayFrame)))
+            {
+                same = false;
+            }
+        }
+
+        prev->handle        = layer->handle;
+        prev->sourceCrop    = layer->sourceCrop;
+        prev->displayFrame  = layer->displayFrame;
+        prev->transform     = layer->transform;
+        prev->blending      = layer->blending;
+        prev->in_fb         = in_fb;
+    }
+    ctx->prev_layer_num = list->numHwLayers;
+
+    if(!same)
+    {
+        return;
+    }
+
+    for(i=0; i<list->numHwLayers; i++)
+    {
+        if(list->hwLayers[i].compositionType == HWC_FRAMEBUFFER)
+        {
+            list->hwLayers[i].compositionType = HWC_OVERLAY;
+            list->hwLayers[i].hints &= ~HWC_HINT_CLEAR_FB;
+            ctx->layer_plan[i] = HWC_PLAN_KEEP;
+        }
+    }
+    ctx->skip_swap = true;
+}
+
+static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) 
+{
+    sun4i_hwc_context_t   		*ctx = (sun4i_hwc_context_t *)dev;
+    bool                        have_video = false;
+
+    for (size_t i=0 ; i<HWC_MAX_PLANNED_LAYERS ; i++)
+    {
+        ctx->layer_plan[i] = HWC_PLAN_GPU;
+    }
+    ctx->skip_swap = false;
+
+    if(list == NULL)
+    {
+        ctx->prev_layer_num = 0;
+        return 0;
+    }
+
+    for (size_t i=0 ; i<list->numHwLayers ; i++) 
+    {
+        //surfaceflinger only resets the hints on geometry changes, a layer
+        //that goes back to the gpu must not keep the hint of a former plan
+        list->hwLayers[i].hints &= ~HWC_HINT_CLEAR_FB;
+        if(hwc_is_video_format(list->hwLayers[i].format))
+    	{
+        	list->hwLayers[i].compositionType = HWC_OVERLAY;
+        	if(i < HWC_MAX_PLANNED_LAYERS)
         	{
-            	list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
+        	    ctx->layer_plan[i] = HWC_PLAN_VIDEO;
         	}
+        	have_video = true;
+    	}
+    	else
+    	{
+        	list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
+    	}
+    }
+
+    //the video layer owns the bottom of the hardware pipe
+    if(!have_video)
+    {
+        hwc_plan_rgb_layers(ctx, list);
+    }
+
+    hwc_keep_fb_layers(ctx, list);
+
+    //the trace also takes the ioctls of setparameter, which runs on the player's thread
+    pthread_mutex_lock(&ctx->lock);
+    memset(&ctx->cur_trace, 0, sizeof(ctx->cur_trace));
+    for (size_t i=0 ; i<list->numHwLayers && i<HWC_MAX_PLANNED_LAYERS ; i++) 
+    {
+        int                         plan = ctx->layer_plan[i];
+
+        if(plan == HWC_PLAN_VIDEO)
+        {
+            ctx->cur_trace.video_layers++;
+        }
+        else if(plan == HWC_PLAN_KEEP)
+        {
+            ctx->cur_trace.kept_layers++;
+        }
+        else if(plan >= 0 && list->hwLayers[i].compositionType == HWC_OVERLAY)
+        {
+            ctx->cur_trace.rgb_layers++;
+        }
+        else
+        {
+            ctx->cur_trace.gpu_layers++;
         }
     }
+    if(list->flags & HWC_GEOMETRY_CHANGED)
+    {
+        ctx->cur_trace.flags |= HWC_TRACE_GEOMETRY;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
     return 0;
 }
 
+static int hwc_commit_rgb_layers(sun4i_hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    unsigned long               args[4]={0};
+    uint32_t                    open_mask = 0;
+    int                         i;
+
+    if(list != NULL)
+    {
+        for(i=0; i<(int)list->numHwLayers && i<HWC_MAX_PLANNED_LAYERS; i++)
+        {
+            hwc_layer_t                 *layer = &list->hwLayers[i];
+            hwc_scanout_info_t          info;
+            __disp_layer_info_t         layer_info;
+            int                         idx = ctx->layer_plan[i];
+
+            if(idx < 0 || layer->compositionType != HWC_OVERLAY)
+            {
+                continue;
+            }
+
+            if(hwc_layer_get_scanout(layer, &info) != 0)
+            {
+                continue;
+            }
+
+            if(ctx->rgb_layerhdl[idx] == 0)
+            {
+                args[0]                 = 0;
+                ctx->rgb_layerhdl[idx]  = (uint32_t)hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_REQUEST, args);
+                if(ctx->rgb_layerhdl[idx] == 0)
+                {
+                    LOGE("request rgb layer %d failed!\n", idx);
+                    continue;
+                }
+            }
+
+            memset(&layer_info, 0, sizeof(__disp_layer_info_t));
+            layer_info.mode             = DISP_LAYER_WORK_MODE_NORMAL;
+            layer_info.pipe             = (ctx->ui_pipe == 0) ? 1 : 0;
+            layer_info.alpha_en         = 0;
+            layer_info.fb.addr[0]       = info.paddr;
+            layer_info.fb.size.width    = info.width;
+            layer_info.fb.size.height   = info.height;
+            layer_info.fb.format        = info.format;
+            layer_info.fb.seq           = info.seq;
+            layer_info.fb.mode          = DISP_MOD_INTERLEAVED;
+            layer_info.fb.br_swap       = info.br_swap;
+            layer_info.fb.cs_mode       = DISP_BT601;
+            layer_info.src_win.x        = layer->sourceCrop.left;
+            layer_info.src_win.y        = layer->sourceCrop.top;
+            layer_info.src_win.width    = layer->sourceCrop.right - layer->sourceCrop.left;
+            layer_info.src_win.height   = layer->sourceCrop.bottom - layer->sourceCrop.top;
+            layer_info.scn_win.x        = layer->displayFrame.left;
+            layer_info.scn_win.y        = layer->displayFrame.top;
+            layer_info.scn_win.width    = layer->displayFrame.right - layer->displayFrame.left;
+            layer_info.scn_win.height   = layer->displayFrame.bottom - layer->displayFrame.top;
+
+            args[0]                     = 0;
+            args[1]                     = ctx->rgb_layerhdl[idx];
+            args[2]                     = (unsigned long) (&layer_info);
+            args[3]                     = 0;
+            hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_SET_PARA, args);
+
+            if((ctx->rgb_open_mask & (1 << idx)) == 0)
+            {
+                args[0]                 = 0;
+                args[1]                 = ctx->rgb_layerhdl[idx];
+                hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_OPEN, args);
+            }
+            open_mask |= (1 << idx);
+        }
+
+        //push the layers under the ui one by one, the top most first
+        if(list->flags & HWC_GEOMETRY_CHANGED)
+        {
+            for(i=HWC_MAX_RGB_LAYERS-1; i>=0; i--)
+            {
+                if(open_mask & (1 << i))
+                {
+                    args[0]             = 0;
+                    args[1]             = ctx->rgb_layerhdl[i];
+                    hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_BOTTOM, args);
+                }
+            }
+        }
+    }
+
+    for(i=0; i<HWC_MAX_RGB_LAYERS; i++)
+    {
+        if((ctx->rgb_open_mask & (1 << i)) && (open_mask & (1 << i)) == 0)
+        {
+            args[0]                     = 0;
+            args[1]                     = ctx->rgb_layerhdl[i];
+            hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_CLOSE, args);
+        }
+    }
+    ctx->rgb_open_mask = open_mask;
+
+    return 0;
+}
+
+static int hwc_release_rgb_layers(sun4i_hwc_context_t *ctx)
+{
+    unsigned long               args[4]={0};
+    int                         i;
+
+    for(i=0; i<HWC_MAX_RGB_LAYERS; i++)
+    {
+        if(ctx->rgb_layerhdl[i] != 0)
+        {
+            args[0]                     = 0;
+            args[1]                     = ctx->rgb_layerhdl[i];
+            ioctl(ctx->dispfd, DISP_CMD_LAYER_CLOSE, args);
+
+            args[0]                     = 0;
+            args[1]                     = ctx->rgb_layerhdl[i];
+            ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE, args);
+
+            ctx->rgb_layerhdl[i]        = 0;
+        }
+    }
+    ctx->rgb_open_mask = 0;
+
+    return 0;
+}
+
+static int hwc_histogram_slot(uint32_t value, const uint32_t *limits, int num)
+{
+    int                         i;
+
+    for(i=0; i<num-1; i++)
+    {
+        if(value <= limits[i])
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+//files the frame in the trace ring and the histograms, ctx->lock held
+static void hwc_trace_frame(sun4i_hwc_context_t *ctx, int64_t start)
+{
+    static const uint32_t       swap_limits[HWC_HIST_SWAP_NUM - 1] = {2000, 4000, 8000, 16000, 33000};
+    static const uint32_t       overlay_limits[HWC_HIST_OVERLAY_NUM - 1] = {0, 1, 2, 3};
+    static const uint32_t       ioctl_limits[HWC_HIST_IOCTL_NUM - 1] = {0, 4, 8, 16};
+    hwc_stats_t                 *stats = &ctx->stats;
+    hwc_frame_trace_t           *trace = &ctx->cur_trace;
+
+    trace->start    = start;
+    trace->set_us   = (uint32_t)((hwc_now_ns() - start) / 1000);
+
+    stats->frames++;
+    if(trace->flags & HWC_TRACE_SWAP_SKIPPED)
+    {
+        stats->swap_skipped++;
+    }
+    else
+    {
+        stats->swap_hist[hwc_histogram_slot(trace->swap_us, swap_limits, HWC_HIST_SWAP_NUM)]++;
+    }
+    stats->overlay_hist[hwc_histogram_slot(trace->rgb_layers + trace->video_layers, overlay_limits, HWC_HIST_OVERLAY_NUM)]++;
+    stats->ioctl_hist[hwc_histogram_slot(trace->ioctls, ioctl_limits, HWC_HIST_IOCTL_NUM)]++;
+
+    stats->trace[stats->trace_pos] = *trace;
+    stats->trace_pos = (stats->trace_pos + 1) % HWC_TRACE_NUM;
+}
+
 static int hwc_set(hwc_composer_device_t *dev,
         hwc_display_t dpy,
         hwc_surface_t sur,
         hwc_layer_list_t* list)
 {
-    EGLBoolean sucess = eglSwapBuffers((EGLDisplay)dpy, (EGLSurface)sur);
-    if (!sucess) 
+    sun4i_hwc_context_t   		*ctx = (sun4i_hwc_context_t *)dev;
+    int                         ret;
+    int64_t                     start = hwc_now_ns();
+
+    if(list == NULL || !ctx->skip_swap)
     {
-        return HWC_EGL_ERROR;
+        EGLBoolean sucess = eglSwapBuffers((EGLDisplay)dpy, (EGLSurface)sur);
+        uint32_t swap_us = (uint32_t)((hwc_now_ns() - start) / 1000);
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->cur_trace.swap_us = swap_us;
+        if (!sucess) 
+        {
+            ctx->prev_layer_num = 0;
+            if(list != NULL)
+            {
+                ctx->cur_trace.flags |= HWC_TRACE_SWAP_FAILED;
+                hwc_trace_frame(ctx, start);
+            }
+            pthread_mutex_unlock(&ctx->lock);
+            return HWC_EGL_ERROR;
+        }
+        pthread_mutex_unlock(&ctx->lock);
     }
+    else
+    {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->cur_trace.flags |= HWC_TRACE_SWAP_SKIPPED;
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    hwc_commit_rgb_layers(ctx, list);
+
+    if(list == NULL)
+    {
+        pthread_mutex_unlock(&ctx->lock);
+        return 0;
+    }
+
+    ret = hwc_set_rect(dev,list);
+    hwc_trace_frame(ctx, start);
+    pthread_cond_signal(&ctx->vsync_cond);
+    pthread_mutex_unlock(&ctx->lock);
 
-    return hwc_set_rect(dev,list);
+    return ret;
+}
+
+//appends to the dump buffer, a full buffer keeps len at buff_len - 1 and drops the rest
+static void hwc_dump_printf(char *buff, int buff_len, int *len, const char *fmt, ...)
+{
+    va_list                     ap;
+    int                         ret;
+
+    if(*len >= buff_len - 1)
+    {
+        return;
+    }
+
+    va_start(ap, fmt);
+    ret = vsnprintf(buff + *len, buff_len - *len, fmt, ap);
+    va_end(ap);
+
+    if(ret < 0)
+    {
+        return;
+    }
+    *len += ret;
+    if(*len > buff_len - 1)
+    {
+        *len = buff_len - 1;
+    }
+}
+
+static void hwc_dump_histogram(char *buff, int buff_len, int *len, const char *name,
+                               const char * const *labels, const uint32_t *hist, int num, uint32_t total)
+{
+    int                         i;
+
+    hwc_dump_printf(buff, buff_len, len, "  %s:\n", name);
+    for(i=0; i<num; i++)
+    {
+        hwc_dump_printf(buff, buff_len, len, "    %-8s %8u %3u%%\n", labels[i], hist[i],
+                        total ? (uint32_t)((uint64_t)hist[i] * 100 / total) : 0);
+    }
+}
+
+//dumpsys SurfaceFlinger output: composition histograms since open and the last frames
+static void hwc_dump(hwc_composer_device_t *dev, char *buff, int buff_len)
+{
+    static const char * const   swap_labels[HWC_HIST_SWAP_NUM] = {"<2ms", "<4ms", "<8ms", "<16ms", "<33ms", ">=33ms"};
+    static const char * const   overlay_labels[HWC_HIST_OVERLAY_NUM] = {"0", "1", "2", "3", ">=4"};
+    static const char * const   ioctl_labels[HWC_HIST_IOCTL_NUM] = {"0", "1-4", "5-8", "9-16", ">16"};
+    sun4i_hwc_context_t   		*ctx = (sun4i_hwc_context_t *)dev;
+    hwc_stats_t                 *stats;
+    int                         len = 0;
+    uint32_t                    i;
+    uint32_t                    num;
+
+    if(buff_len <= 0)
+    {
+        return;
+    }
+    buff[0] = 0;
+
+    stats = (hwc_stats_t *)malloc(sizeof(hwc_stats_t));
+    if(stats == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    memcpy(stats, &ctx->stats, sizeof(hwc_stats_t));
+    pthread_mutex_unlock(&ctx->lock);
+
+    hwc_dump_printf(buff, buff_len, &len, "sun4i hwcomposer: %u frames, %u without swap, vsync period %lldns\n",
+                    stats->frames, stats->swap_skipped, (long long)ctx->vsync_period);
+    hwc_dump_histogram(buff, buff_len, &len, "eglSwapBuffers time", swap_labels, stats->swap_hist, HWC_HIST_SWAP_NUM,
+                       stats->frames - stats->swap_skipped);
+    hwc_dump_histogram(buff, buff_len, &len, "layers on overlays", overlay_labels, stats->overlay_hist, HWC_HIST_OVERLAY_NUM,
+                       stats->frames);
+    hwc_dump_histogram(buff, buff_len, &len, "display ioctls per frame", ioctl_labels, stats->ioctl_hist, HWC_HIST_IOCTL_NUM,
+                       stats->frames);
+
+    num = (stats->frames < HWC_TRACE_NUM) ? stats->frames : HWC_TRACE_NUM;
+    hwc_dump_printf(buff, buff_len, &len, "  last %u frames (start ms, swap us, set us, gpu/kept/rgb/video, ioctls, flags):\n", num);
+    for(i=0; i<num; i++)
+    {
+        hwc_frame_trace_t           *trace = &stats->trace[(stats->trace_pos + HWC_TRACE_NUM - num + i) % HWC_TRACE_NUM];
+
+        hwc_dump_printf(buff, buff_len, &len, "    %lld %u %u %u/%u/%u/%u %u %s%s%s\n",
+                        (long long)(trace->start / 1000000), trace->swap_us, trace->set_us,
+                        trace->gpu_layers, trace->kept_layers, trace->rgb_layers, trace->video_layers, trace->ioctls,
+                        (trace->flags & HWC_TRACE_SWAP_SKIPPED) ? "S" : "-",
+                        (trace->flags & HWC_TRACE_SWAP_FAILED) ? "F" : "-",
+                        (trace->flags & HWC_TRACE_GEOMETRY) ? "G" : "-");
+    }
+
+    free(stats);
 }
 
 
@@ -932,25 +1790,25 @@ static int hwc_show(sun4i_hwc_context_t *ctx,uint32_t value)
                     
                     args[0]                         = screen_idx;
                     args[1]                         = ctx->video_layerhdl[screen_idx];
-                    ioctl(ctx->dispfd, DISP_CMD_LAYER_CLOSE,args);
+                    hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_CLOSE,args);
 
                     args[0]                         = screen_idx;
                     args[1]                         = ctx->video_layerhdl[screen_idx];
-                    ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
+                    ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
 
                     args[0] = screen_idx;
-                    hdmi_mode = (__disp_tv_mode_t)ioctl(ctx->dispfd,DISP_CMD_HDMI_GET_MODE,(unsigned long)args);
+                    hdmi_mode = (__disp_tv_mode_t)hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_GET_MODE,(unsigned long)args);
                     if(hdmi_mode == DISP_TV_MOD_1080P_24HZ_3D_FP || hdmi_mode == DISP_TV_MOD_720P_50HZ_3D_FP || hdmi_mode == DISP_TV_MOD_720P_60HZ_3D_FP)
                     {
                         args[0] = screen_idx;
-                        ret = ioctl(ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
+                        ret = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_OFF,(unsigned long)args);
                 
                         args[0] = screen_idx;
                         args[1] = ctx->org_hdmi_mode;
-                        ioctl(ctx->dispfd,DISP_CMD_HDMI_SET_MODE,(unsigned long)args);
+                        hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_SET_MODE,(unsigned long)args);
                         
                         args[0] = screen_idx;
-                        ret = ioctl(ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
+                        ret = hwc_ioctl(ctx, ctx->dispfd,DISP_CMD_HDMI_ON,(unsigned long)args);
                     }
                 }
             }
@@ -988,11 +1846,11 @@ static int hwc_release(sun4i_hwc_context_t *ctx)
             {
                 args[0]                         = screen_idx;
                 args[1]                         = ctx->video_layerhdl[screen_idx];
-                ret = ioctl(ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
+                ret = hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_VIDEO_STOP, args);
 
                 args[0]                         = screen_idx;
                 args[1]                         = ctx->video_layerhdl[screen_idx];
-                ioctl(ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
+                hwc_ioctl(ctx, ctx->dispfd, DISP_CMD_LAYER_RELEASE,args);
 
                 ctx->video_layerhdl[screen_idx] = 0;
             }
@@ -1008,6 +1866,8 @@ static int hwc_set_mode(sun4i_hwc_context_t *ctx,uint32_t value)
     
     LOGD("####hwc_set_mode:%d\n", value);
 
+    //also sent after an output switch that keeps the mode, the outputs may be new
+    ctx->video_policy.valid = false;
     if(value == ctx->mode)
     {
         LOGD("####mode not change\n");
@@ -1044,6 +1904,7 @@ static int hwc_setparameter(hwc_composer_device_t *dev,uint32_t param,uint32_t v
 	int 						ret = 0;
     sun4i_hwc_context_t   		*ctx = (sun4i_hwc_context_t *)dev;
 	
+    pthread_mutex_lock(&ctx->lock);
     if(param == HWC_LAYER_SETINITPARA)
     {
     	ret = hwc_set_init_para(ctx,value, 0);
@@ -1075,6 +1936,12 @@ static int hwc_setparameter(hwc_composer_device_t *dev,uint32_t param,uint32_t v
 	else if(param == HWC_LAYER_SETFORMAT)
 	{
 	}
+	else if(param == HWC_LAYER_GETFRAMETIME)
+	{
+	    ret = hwc_get_frame_time(ctx, (hwc_frame_time_t *)value);
+	}
+    pthread_cond_signal(&ctx->vsync_cond);
+    pthread_mutex_unlock(&ctx->lock);
 
     return ( ret );
 }
@@ -1085,14 +1952,53 @@ static uint32_t hwc_getparameter(hwc_composer_device_t *dev,uint32_t param)
     return 0;
 }
 
+static void hwc_register_procs(hwc_composer_device_t *dev, hwc_procs_t const* procs)
+{
+    sun4i_hwc_context_t   		*ctx = (sun4i_hwc_context_t *)dev;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->procs = (hwc_procs_t *)procs;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
 static int hwc_init(sun4i_hwc_context_t *ctx)
 {
 	unsigned long               arg[4]={0};
     __disp_init_t init_para;
+    __disp_layer_info_t         layer_info;
+    struct fb_var_screeninfo    var;
 
     arg[0] = (unsigned long)&init_para;
     ioctl(ctx->dispfd,DISP_CMD_GET_DISP_INIT_PARA,(unsigned long)arg);
 
+    ioctl(ctx->mFD_fb[0], FBIOGET_VSCREENINFO, &var);
+    ctx->screen_valid_width = var.xres;
+    ctx->screen_valid_height = var.yres;
+
+    //first guess of the refresh period, the vsync thread refines it from real timestamps
+    ctx->vsync_period = 1000000000LL / 60;
+    if(var.pixclock != 0)
+    {
+        uint64_t total = (uint64_t)(var.xres + var.left_margin + var.right_margin + var.hsync_len)
+                        * (var.yres + var.upper_margin + var.lower_margin + var.vsync_len);
+
+        if(total != 0)
+        {
+            //pixclock is in ps
+            ctx->vsync_period = (int64_t)(total * var.pixclock / 1000);
+        }
+    }
+    ctx->last_frame_id = -1;
+
+    ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &ctx->ui_layerhdl[0]);
+    arg[0] = 0;
+    arg[1] = ctx->ui_layerhdl[0];
+    arg[2] = (unsigned long)&layer_info;
+    if(ioctl(ctx->dispfd, DISP_CMD_LAYER_GET_PARA, arg) >= 0)
+    {
+        ctx->ui_pipe = layer_info.pipe;
+    }
+
     if(init_para.disp_mode == DISP_INIT_MODE_SCREEN0_PARTLY)
     {
     	arg[0] = 0;
@@ -1108,7 +2014,17 @@ static int hwc_device_close(struct hw_device_t *dev)
 {
     sun4i_hwc_context_t* ctx = (sun4i_hwc_context_t*)dev;
 
+    if(ctx->vsync_thread_run)
+    {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->vsync_thread_run = false;
+        pthread_cond_signal(&ctx->vsync_cond);
+        pthread_mutex_unlock(&ctx->lock);
+        pthread_join(ctx->vsync_thread, NULL);
+    }
+
     hwc_release(ctx);
+    hwc_release_rgb_layers(ctx);
 
     return 0;
 }
@@ -1127,7 +2043,8 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
 
         /* initialize the procs */
         dev->device.common.tag      = HARDWARE_DEVICE_TAG;
-        dev->device.common.version  = 0;
+        //surfaceflinger only calls dump from version 1 on
+        dev->device.common.version  = 1;
         dev->device.common.module   = const_cast<hw_module_t*>(module);
         dev->device.common.close    = hwc_device_close;
 
@@ -1135,6 +2052,11 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         dev->device.set             = hwc_set;
         dev->device.setparameter    = hwc_setparameter;
         dev->device.getparameter    = hwc_getparameter;
+        dev->device.registerProcs   = hwc_register_procs;
+        dev->device.dump            = hwc_dump;
+
+        pthread_mutex_init(&dev->lock, NULL);
+        pthread_cond_init(&dev->vsync_cond, NULL);
 
         *device = &dev->device.common;
         status = 0;
@@ -1166,6 +2088,13 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         dev->mode = 0;
 
         hwc_init(dev);
+
+        dev->vsync_thread_run = true;
+        if(pthread_create(&dev->vsync_thread, NULL, hwc_vsync_loop, dev) != 0)
+        {
+            LOGE("Failed to create vsync thread : %s\n", strerror(errno));
+            dev->vsync_thread_run = false;
+        }
     }
     return status;
 }
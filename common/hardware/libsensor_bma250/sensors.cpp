@@ -23,6 +23,9 @@
 #include <math.h>
 #include <poll.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
 #include <linux/input.h>
 #include <cutils/atomic.h>
 #include <cutils/log.h>
@@ -56,10 +59,22 @@
 #define INPUT_DIR               "/dev/input"
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
+// input events fetched by a single read(), 16 samples of x/y/z/syn
+#define INPUT_EVENT_NUM         64
+#define WAKE_MESSAGE            'W'
+
 struct sensors_poll_context_t {
 	struct sensors_poll_device_t device; 
 	int fd;
+	int wake_fds[2];
+	int enabled;
+	int monotonic;                      // input timestamps are CLOCK_MONOTONIC
+	int64_t clock_offset;               // else monotonic - realtime, ns
 	char class_path[256];
+	struct input_event events[INPUT_EVENT_NUM];
+	int event_pos;
+	int event_count;
+	sensors_event_t pending;            // sample being assembled
 };
 
 static int set_sysfs_input_attr(char *class_path,
@@ -91,6 +106,12 @@ static int poll__close(struct hw_device_t *dev)
 {
 	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
 	if (ctx) {
+		if (ctx->fd >= 0)
+			close(ctx->fd);
+		if (ctx->wake_fds[0] >= 0)
+			close(ctx->wake_fds[0]);
+		if (ctx->wake_fds[1] >= 0)
+			close(ctx->wake_fds[1]);
 		delete ctx;
 	}
 
@@ -102,10 +123,16 @@ static int poll__activate(struct sensors_poll_device_t *device,
 
 	sensors_poll_context_t *dev = (sensors_poll_context_t *)device;
 	char buffer[20];
+	char msg = WAKE_MESSAGE;
 
 	int bytes = sprintf(buffer, "%d\n", enabled);
 
 	set_sysfs_input_attr(dev->class_path,"enable",buffer,bytes);
+	dev->enabled = enabled;
+
+	// kick poll__poll out of poll() so it sees the new state right away
+	if (write(dev->wake_fds[1], &msg, 1) < 0 && errno != EAGAIN)
+		LOGE("error sending wake message (%s)\n", strerror(errno));
 
 	return 0;
 }
@@ -126,71 +153,139 @@ static int poll__setDelay(struct sensors_poll_device_t *device,
 
 }
 
-static int poll__poll(struct sensors_poll_device_t *device,
-        sensors_event_t* data, int count) {
-	
-	struct input_event event;
-	int ret;
-	sensors_poll_context_t *dev = (sensors_poll_context_t *)device;
+static int64_t sensor_clock_offset(void)
+{
+	struct timespec mono, real;
 
-	if (dev->fd < 0)
-	return 0;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
 
-	while (1) {
-	
-		ret = read(dev->fd, &event, sizeof(event));
+	return ((int64_t)mono.tv_sec - real.tv_sec) * 1000000000LL
+			+ (mono.tv_nsec - real.tv_nsec);
+}
+
+// decode the buffered input events into at most count samples
+static int sensor_decode_events(sensors_poll_context_t *dev,
+        sensors_event_t* data, int count)
+{
+	int num = 0;
 
-		if (event.type == EV_ABS) {
+	while (num < count && dev->event_pos < dev->event_count) {
+		const struct input_event *event = &dev->events[dev->event_pos++];
 
-			switch (event.code) {
+		if (event->type == EV_ABS) {
+
+			switch (event->code) {
 				#ifdef GSENSOR_XY_REVERT
 			case ABS_Y:
-				data->acceleration.x =
-						event.value * CONVERT_X;
+				dev->pending.acceleration.x =
+						event->value * CONVERT_X;
 				break;
 			case ABS_X:
-				data->acceleration.y =
-						event.value * CONVERT_Y;
+				dev->pending.acceleration.y =
+						event->value * CONVERT_Y;
 				break;				
 				#else
 			case ABS_X:
-				data->acceleration.x =
-						event.value * CONVERT_X;
+				dev->pending.acceleration.x =
+						event->value * CONVERT_X;
 				break;
 			case ABS_Y:
-				data->acceleration.y =
-						event.value * CONVERT_Y;
+				dev->pending.acceleration.y =
+						event->value * CONVERT_Y;
 				break;
 				#endif
 			case ABS_Z:
-				data->acceleration.z =
-						event.value * CONVERT_Z;
+				dev->pending.acceleration.z =
+						event->value * CONVERT_Z;
 				break;
 			}
-		} else if (event.type == EV_SYN) {
-
-			data->timestamp =
-			(int64_t)((int64_t)event.time.tv_sec*1000000000
-					+ (int64_t)event.time.tv_usec*1000);
-			data->sensor = 0;
-			data->type = SENSOR_TYPE_ACCELEROMETER;
-			data->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
-			
-		
+		} else if (event->type == EV_SYN) {
+
+			dev->pending.timestamp =
+			(int64_t)((int64_t)event->time.tv_sec*1000000000
+					+ (int64_t)event->time.tv_usec*1000);
+			if (!dev->monotonic)
+				dev->pending.timestamp += dev->clock_offset;
+
+			// samples still queued after a disable are dropped
+			if (!dev->enabled)
+				continue;
+
+			data[num++] = dev->pending;
+
 #ifdef DEBUG_SENSOR
 			LOGD("Sensor data: t x,y,x: %f %f, %f, %f\n",
-					data->timestamp / 1000000000.0,
-							data->acceleration.x,
-							data->acceleration.y,
-							data->acceleration.z);
+					dev->pending.timestamp / 1000000000.0,
+							dev->pending.acceleration.x,
+							dev->pending.acceleration.y,
+							dev->pending.acceleration.z);
 #endif
-			
-		return 1;	
-
 		}
 	}
+
+	return num;
+}
+
+static int poll__poll(struct sensors_poll_device_t *device,
+        sensors_event_t* data, int count) {
 	
+	struct pollfd fds[2];
+	int num = 0;
+	int woken = 0;
+	int ret;
+	sensors_poll_context_t *dev = (sensors_poll_context_t *)device;
+
+	if (dev->fd < 0)
 	return 0;
+
+	while (1) {
+
+		num += sensor_decode_events(dev, data + num, count - num);
+		if (num >= count || woken)
+			break;
+
+		// once we hold some samples only take what is already queued
+		fds[0].fd = dev->fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = dev->wake_fds[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+
+		ret = poll(fds, 2, num ? 0 : -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("poll() failed (%s)\n", strerror(errno));
+			return num ? num : -errno;
+		}
+		if (ret == 0)
+			break;
+
+		if (fds[1].revents & POLLIN) {
+			char msg[8];
+			while (read(dev->wake_fds[0], msg, sizeof(msg)) > 0)
+				;
+			woken = 1;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			ret = read(dev->fd, dev->events, sizeof(dev->events));
+			if (ret < 0) {
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				LOGE("read input events failed (%s)\n", strerror(errno));
+				return num ? num : -errno;
+			}
+			dev->event_pos = 0;
+			dev->event_count = ret / sizeof(struct input_event);
+			if (!dev->monotonic)
+				dev->clock_offset = sensor_clock_offset();
+		}
+	}
+	
+	return num;
 }
 
 
@@ -364,7 +459,9 @@ static int open_sensors(const struct hw_module_t* module, const char* name,
 	int status = -EINVAL;
 
 	sensors_poll_context_t *dev = new sensors_poll_context_t();
-	memset(&dev->device, 0, sizeof(sensors_poll_device_t));
+	memset(dev, 0, sizeof(sensors_poll_context_t));
+	dev->fd = -1;
+	dev->wake_fds[0] = dev->wake_fds[1] = -1;
 
 	dev->device.common.tag = HARDWARE_DEVICE_TAG;
 	dev->device.common.version  = 0;
@@ -377,10 +474,32 @@ static int open_sensors(const struct hw_module_t* module, const char* name,
 
 	if(sensor_get_class_path(dev) < 0) {
 		LOGD("g sensor get class path error \n");
+		delete dev;
 		return -1;
 	}
 
+	if (pipe(dev->wake_fds) < 0) {
+		status = -errno;
+		LOGE("error creating wake pipe (%s)\n", strerror(errno));
+		delete dev;
+		return status;
+	}
+	fcntl(dev->wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(dev->wake_fds[1], F_SETFL, O_NONBLOCK);
+
 	dev->fd = open_input_device();
+#ifdef EVIOCSCLOCKID
+	if (dev->fd >= 0) {
+		int clk = CLOCK_MONOTONIC;
+		dev->monotonic = !ioctl(dev->fd, EVIOCSCLOCKID, &clk);
+	}
+#endif
+
+	dev->pending.version = sizeof(sensors_event_t);
+	dev->pending.sensor = 0;
+	dev->pending.type = SENSOR_TYPE_ACCELEROMETER;
+	dev->pending.acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+
 	*device = &dev->device.common;
 	status = 0;
 
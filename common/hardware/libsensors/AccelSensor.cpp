@@ -35,8 +35,16 @@ AccelSensor::AccelSensor()
       mPendingMask(0),
       mInputReader(32),
       mMinPollDelay(0),
-      mMaxPollDelay(0)
+      mMaxPollDelay(0),
+      mDelay(20000000),
+      mMaxLatency(0),
+      mFifoDepth(0),
+      mBatchHead(0),
+      mBatchCount(0),
+      mBatchStart(0),
+      mBatchFlushing(false)
 {
+    fifo_latency_file[0] = '\0';
 #if defined(ACCELEROMETER_SENSOR_MMA7660)
     data_name = "mma7660";
 #elif defined(ACCELEROMETER_SENSOR_MMA8451)
@@ -120,6 +128,11 @@ int AccelSensor::enable(int32_t handle, int en)
         if (!err) {
             mEnabled &= ~(1<<what);
             mEnabled |= (uint32_t(flags)<<what);
+            if (!en) {
+                // samples batched for a disabled sensor are never reported
+                mBatchCount = 0;
+                mBatchFlushing = false;
+            }
         }
     }
     return err;
@@ -198,6 +211,29 @@ int AccelSensor::getPollFile(const char* inputName)
                         fclose(fd);
                     }					
 
+                    /* Get the hardware FIFO depth, if the chip has one */
+                    filename = sysfs_name + path_len;
+                    strcpy(filename, "fifo_depth");
+                    fd = fopen(sysfs_name, "r");
+                    if (fd) {
+                        memset(buf, 0, 32);
+                        n = fread(buf, 1, 6, fd);
+                        if (n > 0)
+                            mFifoDepth = strtol(buf, &endptr, 10);
+                        fclose(fd);
+                    }
+                    filename = sysfs_name + path_len;
+                    strcpy(filename, "fifo_latency");
+                    fd = fopen(sysfs_name, "r+");
+                    if (fd) {
+                        strcpy(fifo_latency_file, sysfs_name);
+                        fclose(fd);
+                    } else {
+                        mFifoDepth = 0;
+                    }
+                    if (mFifoDepth)
+                        LOGD("Found %d samples hardware FIFO\n", mFifoDepth);
+
                     return 0;
                 }
             }
@@ -225,6 +261,7 @@ int AccelSensor::setDelay(int32_t handle, int64_t ns)
            snprintf(buf, len, "%d", ms);
            n = fwrite(buf, 1, len, fd);
            fclose(fd);
+           mDelay = ns;
            ret = 0;
        }else
            LOGE("file %s open failure\n", poll_sysfs_file);
@@ -234,45 +271,193 @@ int AccelSensor::setDelay(int32_t handle, int64_t ns)
     return ret;
 }
 
+int AccelSensor::batch(int32_t handle, int64_t ns, int64_t timeout)
+{
+    if (handle != ID_A)
+        return -EINVAL;
+    if (timeout < 0)
+        return -EINVAL;
+
+    int err = setDelay(handle, ns);
+
+    if (mFifoDepth) {
+        // let the chip hold samples in its FIFO and only interrupt when
+        // the latency (or its watermark) is reached
+        FILE *fd = fopen(fifo_latency_file, "r+");
+        if (fd) {
+            fprintf(fd, "%d", int(timeout / 1000000));
+            fclose(fd);
+        } else {
+            LOGE("file %s open failure\n", fifo_latency_file);
+        }
+    }
+
+    mMaxLatency = timeout;
+    if (!mMaxLatency && mBatchCount)
+        mBatchFlushing = true;
+    return err;
+}
+
+bool AccelSensor::hasPendingEvents() const
+{
+    return batchDue(getTimestamp());
+}
+
+int AccelSensor::getPollTimeout() const
+{
+    if (!mBatchCount)
+        return -1;
+    if (batchDue(getTimestamp()))
+        return 0;
+    int64_t left = mBatchStart + mMaxLatency - getTimestamp();
+    return left > 0 ? int((left + 999999) / 1000000) : 0;
+}
+
+void AccelSensor::enqueueBatch(const sensors_event_t& event)
+{
+    if (!mBatchCount)
+        mBatchStart = getTimestamp();
+    mBatch[(mBatchHead + mBatchCount) % BATCH_SIZE] = event;
+    mBatchCount++;
+}
+
+bool AccelSensor::batchDue(int64_t now) const
+{
+    if (!mBatchCount)
+        return false;
+    return mBatchFlushing || !mMaxLatency ||
+           mBatchCount == BATCH_SIZE ||
+           now - mBatchStart >= mMaxLatency;
+}
+
+void AccelSensor::respaceBatch()
+{
+    // a drained chip FIFO arrives as one burst of input events that all
+    // carry (nearly) the same time; space them back out at the sampling
+    // period, walking back from the newest sample which is the accurate one.
+    for (int k = mBatchCount - 2; k >= 0; k--) {
+        sensors_event_t& cur = mBatch[(mBatchHead + k) % BATCH_SIZE];
+        const sensors_event_t& next = mBatch[(mBatchHead + k + 1) % BATCH_SIZE];
+        if (next.timestamp - cur.timestamp < mDelay / 2)
+            cur.timestamp = next.timestamp - mDelay;
+    }
+}
+
+int AccelSensor::flushBatch(sensors_event_t* data, int count)
+{
+    if (!mBatchFlushing && mFifoDepth && mDelay > 0)
+        respaceBatch();
+    mBatchFlushing = true;
+
+    int numEventReceived = 0;
+    while (count && mBatchCount) {
+        *data++ = mBatch[mBatchHead];
+        mBatchHead = (mBatchHead + 1) % BATCH_SIZE;
+        mBatchCount--;
+        count--;
+        numEventReceived++;
+    }
+    if (!mBatchCount)
+        mBatchFlushing = false;
+    return numEventReceived;
+}
+
+int AccelSensor::readBatch(sensors_event_t* data, int count)
+{
+    // we may be called only because the batch is due, don't block on
+    // an input device that has nothing for us
+    struct pollfd pfd;
+    pfd.fd = data_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) > 0) {
+        ssize_t n = mInputReader.fill(data_fd);
+        if (n < 0)
+            return n;
+    }
+
+    input_event const* events;
+    ssize_t avail;
+
+    while (mBatchCount < BATCH_SIZE &&
+           (avail = mInputReader.readEvents(&events)) > 0) {
+        ssize_t i;
+        for (i = 0 ; mBatchCount < BATCH_SIZE && i < avail ; i++) {
+            const input_event& event = events[i];
+            if (event.type == EV_ABS) {
+                processEvent(event.code, event.value);
+            } else if (event.type == EV_SYN) {
+                int64_t time = timevalToNano(event.time);
+                for (int j=0 ; mPendingMask && j<numSensors ; j++) {
+                    if (mPendingMask & (1<<j)) {
+                        mPendingMask &= ~(1<<j);
+                        mPendingEvents[j].timestamp = time;
+                        if (mEnabled & (1<<j))
+                            enqueueBatch(mPendingEvents[j]);
+                    }
+                }
+            } else {
+                LOGE("AccelSensor: unknown event (type=%d, code=%d)",
+                        event.type, event.code);
+            }
+        }
+        mInputReader.next(i);
+    }
+
+    if (!batchDue(getTimestamp()))
+        return 0;
+    return flushBatch(data, count);
+}
+
 int AccelSensor::readEvents(sensors_event_t* data, int count)
 {
 
     if (count < 1)
         return -EINVAL;
 
+    if (mMaxLatency || mBatchCount)
+        return readBatch(data, count);
+
     ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
         return n;
 
     int numEventReceived = 0;
-    input_event const* event;
-
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_ABS) {
-            processEvent(event->code, event->value);
-            mInputReader.next();
-        } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            for (int j=0 ; count && mPendingMask && j<numSensors ; j++) {
-                if (mPendingMask & (1<<j)) {
-                    mPendingMask &= ~(1<<j);
-                    mPendingEvents[j].timestamp = time;
-                    if (mEnabled & (1<<j)) {
-                        *data++ = mPendingEvents[j];
-                        count--;
-                        numEventReceived++;
+    input_event const* events;
+    ssize_t avail;
+
+    // decode one contiguous span of the ring at a time; an EV_SYN is only
+    // consumed once every sensor it completes has been handed out.
+    while (count && (avail = mInputReader.readEvents(&events)) > 0) {
+        ssize_t i = 0;
+        while (count && i < avail) {
+            const input_event& event = events[i];
+            if (event.type == EV_ABS) {
+                processEvent(event.code, event.value);
+            } else if (event.type == EV_SYN) {
+                int64_t time = timevalToNano(event.time);
+                for (int j=0 ; count && mPendingMask && j<numSensors ; j++) {
+                    if (mPendingMask & (1<<j)) {
+                        mPendingMask &= ~(1<<j);
+                        mPendingEvents[j].timestamp = time;
+                        if (mEnabled & (1<<j)) {
+                            *data++ = mPendingEvents[j];
+                            count--;
+                            numEventReceived++;
+                        }
                     }
                 }
+                if (mPendingMask)
+                    break;
+            } else {
+                LOGE("AccelSensor: unknown event (type=%d, code=%d)",
+                        event.type, event.code);
             }
-            if (!mPendingMask) {
-                mInputReader.next();
-            }
-        } else {
-            LOGE("AccelSensor: unknown event (type=%d, code=%d)",
-                    type, event->code);
-            mInputReader.next();
+            i++;
         }
+        mInputReader.next(i);
+        if (i < avail)
+            break;
     }
 
     return numEventReceived;
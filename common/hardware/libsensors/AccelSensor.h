@@ -42,11 +42,18 @@ public:
     };
 
     virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int batch(int32_t handle, int64_t ns, int64_t timeout);
+    virtual int getPollTimeout() const;
+    virtual bool hasPendingEvents() const;
     virtual int enable(int32_t handle, int enabled);
     virtual int readEvents(sensors_event_t* data, int count);
     void processEvent(int code, int value);
 
 private:
+    enum {
+        BATCH_SIZE      = 128
+    };
+
     uint32_t mEnabled;
     uint32_t mPendingMask;
     InputEventCircularReader mInputReader;
@@ -56,7 +63,21 @@ private:
     char poll_sysfs_file[PATH_MAX];
 	char sensor_delay_file[PATH_MAX];
     int poll_sysfs_file_len;
+    int64_t mDelay;
+    int64_t mMaxLatency;
+    int mFifoDepth;
+    char fifo_latency_file[PATH_MAX];
+    sensors_event_t mBatch[BATCH_SIZE];
+    int mBatchHead;
+    int mBatchCount;
+    int64_t mBatchStart;
+    bool mBatchFlushing;
     int getPollFile(const char* inputName);
+    int readBatch(sensors_event_t* data, int count);
+    void enqueueBatch(const sensors_event_t& event);
+    bool batchDue(int64_t now) const;
+    void respaceBatch();
+    int flushBatch(sensors_event_t* data, int count);
     static inline int accel_is_sensor_enabled(uint32_t sensor_type)
     {
         //dummy now......
@@ -33,7 +33,7 @@
 struct input_event;
 
 InputEventCircularReader::InputEventCircularReader(size_t numEvents)
-    : mBuffer(new input_event[numEvents * 2]),
+    : mBuffer(new input_event[numEvents]),
       mBufferEnd(mBuffer + numEvents),
       mHead(mBuffer),
       mCurr(mBuffer),
@@ -50,7 +50,15 @@ ssize_t InputEventCircularReader::fill(int fd)
 {
     size_t numEventsRead = 0;
     if (mFreeSpace) {
-        const ssize_t nread = read(fd, mHead, mFreeSpace * sizeof(input_event));
+        // only read the free span up to the end of the ring. evdev has
+        // no readv of its own: the kernel reads each iovec in turn, and
+        // on a blocking fd a second one would wait for the next event.
+        // the rest of the free space is picked up by the next fill().
+        size_t first = mBufferEnd - mHead;
+        if (first > (size_t)mFreeSpace)
+            first = mFreeSpace;
+
+        const ssize_t nread = read(fd, mHead, first * sizeof(input_event));
         if (nread<0 || nread % sizeof(input_event)) {
             // we got a partial event!!
             return nread<0 ? -errno : -EINVAL;
@@ -60,10 +68,8 @@ ssize_t InputEventCircularReader::fill(int fd)
         if (numEventsRead) {
             mHead += numEventsRead;
             mFreeSpace -= numEventsRead;
-            if (mHead > mBufferEnd) {
-                size_t s = mHead - mBufferEnd;
-                memcpy(mBuffer, mBufferEnd, s * sizeof(input_event));
-                mHead = mBuffer + s;
+            if (mHead >= mBufferEnd) {
+                mHead -= mBufferEnd - mBuffer;
             }
         }
     }
@@ -71,19 +77,30 @@ ssize_t InputEventCircularReader::fill(int fd)
     return numEventsRead;
 }
 
-ssize_t InputEventCircularReader::readEvent(input_event const** events)
+ssize_t InputEventCircularReader::readEvents(input_event const** events)
 {
     *events = mCurr;
     ssize_t available = (mBufferEnd - mBuffer) - mFreeSpace;
-    return available ? 1 : 0;
+    ssize_t contiguous = mBufferEnd - mCurr;
+    return available < contiguous ? available : contiguous;
 }
 
-void InputEventCircularReader::next()
+void InputEventCircularReader::next(size_t numEvents)
 {
-    mCurr++;
-    mFreeSpace++;
+    mCurr += numEvents;
+    mFreeSpace += numEvents;
     if (mCurr >= mBufferEnd) {
-        mCurr = mBuffer;
+        mCurr -= mBufferEnd - mBuffer;
     }
 }
 
+ssize_t InputEventCircularReader::readEvent(input_event const** events)
+{
+    return readEvents(events) ? 1 : 0;
+}
+
+void InputEventCircularReader::next()
+{
+    next(1);
+}
+
@@ -27,6 +27,12 @@
 
 struct input_event;
 
+/*
+ * Ring of numEvents input_events. fill() reads straight into the free
+ * space up to the end of the ring so no event is ever copied twice;
+ * readEvents() hands out the longest contiguous span of pending
+ * events so that sensors can decode a whole batch in one pass.
+ */
 class InputEventCircularReader
 {
     struct input_event* const mBuffer;
@@ -39,6 +45,8 @@ public:
     InputEventCircularReader(size_t numEvents);
     ~InputEventCircularReader();
     ssize_t fill(int fd);
+    ssize_t readEvents(input_event const** events);
+    void next(size_t numEvents);
     ssize_t readEvent(input_event const** events);
     void next();
 };
@@ -172,28 +172,32 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
         return n;
 
     int numEventReceived = 0;
-    input_event const* event;
-
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_ABS) {
-            if (event->code == EVENT_TYPE_LIGHT) {
-                mPendingEvent.light = event->value;
-                setIntLux();
-            }
-        } else if (type == EV_SYN) {
-            mPendingEvent.timestamp = timevalToNano(event->time);
-            if (mEnabled && (mPendingEvent.light != mPreviousLight)) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
-                mPreviousLight = mPendingEvent.light;
+    input_event const* events;
+    ssize_t avail;
+
+    while (count && (avail = mInputReader.readEvents(&events)) > 0) {
+        ssize_t i;
+        for (i = 0 ; count && i < avail ; i++) {
+            const input_event& event = events[i];
+            if (event.type == EV_ABS) {
+                if (event.code == EVENT_TYPE_LIGHT) {
+                    mPendingEvent.light = event.value;
+                    setIntLux();
+                }
+            } else if (event.type == EV_SYN) {
+                mPendingEvent.timestamp = timevalToNano(event.time);
+                if (mEnabled && (mPendingEvent.light != mPreviousLight)) {
+                    *data++ = mPendingEvent;
+                    count--;
+                    numEventReceived++;
+                    mPreviousLight = mPendingEvent.light;
+                }
+            } else {
+                LOGE("LightSensor: unknown event (type=%d, code=%d)",
+                        event.type, event.code);
             }
-        } else {
-            LOGE("LightSensor: unknown event (type=%d, code=%d)",
-                    type, event->code);
         }
-        mInputReader.next();
+        mInputReader.next(i);
     }
 
     return numEventReceived;
@@ -77,6 +77,17 @@ int SensorBase::setDelay(int32_t handle, int64_t ns) {
     return 0;
 }
 
+int SensorBase::batch(int32_t handle, int64_t ns, int64_t timeout) {
+    // sensors that can't batch only accept "report right away"
+    if (timeout)
+        return -EINVAL;
+    return setDelay(handle, ns);
+}
+
+int SensorBase::getPollTimeout() const {
+    return -1;
+}
+
 bool SensorBase::hasPendingEvents() const {
     return false;
 }
@@ -58,6 +58,8 @@ public:
     virtual bool hasPendingEvents() const;
     virtual int getFd() const;
     virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int batch(int32_t handle, int64_t ns, int64_t timeout);
+    virtual int getPollTimeout() const;
     virtual int enable(int32_t handle, int enabled) = 0;
 };
 
@@ -31,6 +31,8 @@
 #include <utils/Atomic.h>
 #include <utils/Log.h>
 
+#include <cutils/properties.h>
+
 #include "sensors.h"
 
 #include "LightSensor.h"
@@ -137,6 +139,8 @@ private:
         }
         return -EINVAL;
     }
+
+    static int64_t maxReportLatency(int handle);
 };
 
 /*****************************************************************************/
@@ -187,17 +191,46 @@ int sensors_poll_context_t::activate(int handle, int enabled) {
     return err;
 }
 
+/*
+ * The poll device has no batch() entry point, so the maximum report
+ * latency of each sensor comes from a property (in ms), e.g.
+ * "sensors.accel.max_latency" set while the screen is off.
+ */
+int64_t sensors_poll_context_t::maxReportLatency(int handle)
+{
+    const char* name;
+    switch (handle) {
+        case ID_A: name = "accel"; break;
+        case ID_L: name = "light"; break;
+        default: return 0;
+    }
+
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    snprintf(key, sizeof(key), "sensors.%s.max_latency", name);
+    property_get(key, value, "0");
+    int ms = atoi(value);
+    return ms > 0 ? int64_t(ms) * 1000000LL : 0;
+}
+
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
 
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->setDelay(handle, ns);
+    int64_t timeout = maxReportLatency(handle);
+    int err = mSensors[index]->batch(handle, ns, timeout);
+    if (err == -EINVAL && timeout) {
+        // this sensor can't batch, report right away
+        err = mSensors[index]->batch(handle, ns, 0);
+    }
+    return err;
 }
 
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 {
     int nbEvents = 0;
     int n = 0;
+    int timeout;
 
     do {
         // see if we have some leftover from the last poll()
@@ -220,7 +253,15 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
             // anything to return
-            n = poll(mPollFds, numFds, nbEvents ? 0 : -1);
+            // a batching sensor wants to be revisited when its oldest
+            // sample reaches its report latency
+            timeout = -1;
+            for (int i=0 ; !nbEvents && i<numSensorDrivers ; i++) {
+                int t = mSensors[i]->getPollTimeout();
+                if (t >= 0 && (timeout < 0 || t < timeout))
+                    timeout = t;
+            }
+            n = poll(mPollFds, numFds, nbEvents ? 0 : timeout);
             if (n<0) {
                 LOGE("poll() failed (%s)", strerror(errno));
                 return -errno;
@@ -233,8 +274,9 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
                 mPollFds[wake].revents = 0;
             }
         }
-        // if we have events and space, go read them
-    } while (n && count);
+        // if we have events and space, go read them; a poll() that timed
+        // out on a batch deadline goes round again to flush the batch
+    } while ((n || !nbEvents) && count);
 
     return nbEvents;
 }
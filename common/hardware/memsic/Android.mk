@@ -11,7 +11,7 @@ include $(BUILD_MULTI_PREBUILT)
 # MEMSIC sensors daemon
 include $(CLEAR_VARS)
 LOCAL_PRELINK_MODULE	:= false
-LOCAL_SHARED_LIBRARIES	:= 
+LOCAL_SHARED_LIBRARIES	:= liblog libcutils
 LOCAL_STATIC_LIBRARIES	:= compasslib_h5_gcc_armv4t compasslib_h6_gcc_armv4t
 LOCAL_LDLIBS		+= -Idl
 LOCAL_CFLAGS		+= -static
@@ -49,6 +49,7 @@ LOCAL_SRC_FILES		:= daemon/memsicd.c			\
 			   adapter/sensors_mag_adapter.c    	\
 			   adapter/sensors_mag_mmc31xx.c    	\
 			   adapter/sensors_mag_mmc328x.c    	\
+			   adapter/sensors_sample_adapter.c	\
 			   adapter/sensors_algo_adapter.c	\
 			   adapter/sensors_algo_ids_h5.c	\
 			   adapter/sensors_algo_ids_h6.c	\
@@ -82,7 +83,7 @@ LOCAL_MODULE_PATH	:= $(TARGET_OUT_SHARED_LIBRARIES)/hw
 # COMPASS_ALGO_H6      - IDS 3+3 algorithm
 #LOCAL_CFLAGS		+= -DDEVICE_ACC_LIS33DE -DDEVICE_MAG_MMC328X -DCOMPASS_ALGO_H6
 LOCAL_CFLAGS		+= -DDEVICE_ACC_MXC622X -DDEVICE_MAG_MMC312X -DCOMPASS_ALGO_H5
-LOCAL_C_INCLUDES	+= 
+LOCAL_C_INCLUDES	+= $(LOCAL_PATH)/adapter
 
 
 ifeq ($(SW_BOARD_GSENSOR_DIRECT_X), true)
@@ -72,3 +72,20 @@ struct algo_t *sensors_get_algorithm(void)
 	return &algo;
 }
 
+int sensors_algo_fuse(struct algo_t *algo, const struct SensorData_Real *real,
+	float mag_cald[3], struct SensorData_Orientation *orien)
+{
+	struct SensorData_Algo sva;
+
+	ids_degree_real_to_algo(&sva, real);
+	algo->calc_magcal_data(&sva, mag_cald);
+
+	// prepare data for calibration
+	ids_degree_real_to_algo(&sva, real);
+	// ecompass calibration
+	algo->data_in(&sva);
+	algo->calibrate(&sva);
+	// calculate orientation
+	return algo->calc_orientation(orien, &sva);
+}
+
@@ -113,4 +113,17 @@ struct algo_t {
  */
 struct algo_t *sensors_get_algorithm(void);
 
+/**
+ * @brief Run one sample through the eCompass algorithm: calibrated
+ *        magnetic data, calibration and orientation, as memsicd does
+ *        on every poll
+ * @param algo is the eCompass algorithm
+ * @param real contain the sample in the ids coordinate system
+ * @param mag_cald[3] contain calibrated magnetic data to return
+ * @param orien contain the orientation to return
+ * @return 0 for success, others for failure
+ */
+int sensors_algo_fuse(struct algo_t *algo, const struct SensorData_Real *real,
+	float mag_cald[3], struct SensorData_Orientation *orien);
+
 #endif /* __SENSORS_ALGO_ADAPTER_H__ */
@@ -26,7 +26,6 @@
 #include <assert.h>
 #include <time.h>
 #include <math.h>
-#include <sys/mman.h>
 
 #include <CompassLib_H5.h>
 #include <sensors_algo_adapter.h>
@@ -55,10 +54,11 @@
 #endif
 #endif
 
+#ifndef NVM_PATH
 #define NVM_PATH		"/data/misc/sensors/ecs_nvm"
+#endif
 #define NVM_SIZE		(26 + 2)
 #define NVM_STATE_BYTE		26
-#define MAPPED_MEM_SIZE		256
 
 #define FILTER			0
 
@@ -101,56 +101,37 @@ static uint8 NVM_Restore[NVM_SIZE] =
 	0x00, 0x00
 };
 
+static uint8 NVM_Shadow[NVM_SIZE];
+
+static struct ids_nvm_t nvm =
+	IDS_NVM_INITIALIZER(NVM_PATH, NVM_Restore, NVM_RAM, NVM_Shadow, NVM_SIZE);
+
 /* initial parameter must be global virable */
 static COMPASSLIB_H5_INIT_STRUCT init_parm;
 
 int ids_h5_nvm_restore()
 {
-	memcpy(NVM, NVM_Restore, NVM_SIZE);
-	NVM[NVM_STATE_BYTE] = 1;
+	ids_nvm_reset(&nvm);
+	ids_nvm_write(&nvm, NVM_STATE_BYTE, 1);
 
-	if (NVM != NVM_RAM) {
-		msync(NVM, NVM_SIZE, MS_SYNC);
-	}
-	return 0;
+	// memsicd picks the new file up through ids_nvm_refresh()
+	return ids_nvm_save(&nvm, 1);
 }
 
 int ids_h5_nvm_load()
 {
-	int fd;
-	int n;
-	uint8 buf[NVM_SIZE];
-
-	fd = open(NVM_PATH, O_RDWR | O_CREAT, 0666);
-	if (fd == -1) {
-		LOGE("%s: fail to open %s\n", __FUNCTION__, NVM_PATH);
-		NVM = NVM_RAM;
+	NVM = NVM_RAM;
+	if (ids_nvm_load(&nvm)) {
+		LOGE("%s: fail to store %s\n", __FUNCTION__, NVM_PATH);
 		return -1;
 	}
 
-	lseek(fd, 0, SEEK_SET);
-	n = read(fd, buf, NVM_SIZE);
-	if (n != NVM_SIZE) {	// empty or broken parm file
-		// restore parm file to default
-		lseek(fd, 0, SEEK_SET);
-		n = write(fd, NVM_Restore, NVM_SIZE);
-	}
-	NVM = mmap(0, MAPPED_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (NVM == MAP_FAILED) {
-		// set NVM to RAM if failure
-		NVM = NVM_RAM;
-	}
-	close(fd);
-
 	return 0;
 }
 
 int ids_h5_nvm_save()
 {
-	if (NVM != NVM_RAM) {
-		msync(NVM, NVM_SIZE, MS_SYNC);
-	}
-	return 0;
+	return ids_nvm_save(&nvm, 0);
 }
 
 uint16 ids_h5_nvm_read(uint16 offset)
@@ -165,7 +146,7 @@ uint16 ids_h5_nvm_read(uint16 offset)
 uint8 ids_h5_nvm_write(uint16 offset, uint8 data)
 {
 	if (offset < CompassLib_H5_GetNVMBlockSize()) {
-		NVM[offset] = data;
+		ids_nvm_write(&nvm, offset, data);
 		return 1;
 	}
 
@@ -223,12 +204,8 @@ int ids_h5_open(void)
 
 int ids_h5_close(void)
 {
-	ids_h5_nvm_save();
-	if (!NVM && NVM != NVM_RAM) {
-		munmap(NVM, MAPPED_MEM_SIZE);
-		NVM = NULL;
-	}
-	return 0;
+	// the process may be about to exit, don't leave it to the writer
+	return ids_nvm_save(&nvm, 1);
 }
 
 int ids_h5_restart(void)
@@ -241,6 +218,7 @@ int ids_h5_get_state(void)
 {
 	int state = 0;
 	if (NVM) {
+		ids_nvm_refresh(&nvm);
 		state = NVM[NVM_STATE_BYTE];
 	}
 	return state;
@@ -249,7 +227,7 @@ int ids_h5_get_state(void)
 void ids_h5_clear_state(void)
 {
 	if (NVM) {
-		NVM[NVM_STATE_BYTE] = 0;
+		ids_nvm_write(&nvm, NVM_STATE_BYTE, 0);
 	}
 }
 
@@ -26,7 +26,6 @@
 #include <assert.h>
 #include <time.h>
 #include <math.h>
-#include <sys/mman.h>
 
 #include <CompassLib_H6.h>
 #include <sensors_algo_adapter.h>
@@ -55,10 +54,11 @@
 #endif
 #endif
 
+#ifndef NVM_PATH
 #define NVM_PATH		"/data/misc/sensors/ecs_nvm"
+#endif
 #define NVM_SIZE		(26 + 2)
 #define NVM_STATE_BYTE		26
-#define MAPPED_MEM_SIZE		256
 
 #define FILTER			0
 
@@ -68,14 +68,29 @@
 #define MAG_MAX			4.5	// > 4.0 (MMC314x MaxRange)
 #define MAG_NOI_THRESHOLD	20.0
 
+/*
+ * The AVG_BUFF_SIZE most extreme accepted samples of one axis, kept sorted
+ * in a ring: entry 0 (at head) is the next to drop, the last entry is the
+ * current extreme. Once the sentinels are gone every accepted sample is a
+ * new extreme, so it just takes the place of entry 0 and the ring turns.
+ * The sum and the differential average only change along with the entries,
+ * so they are cached; they are recomputed in the same order as before so
+ * the centre comes out bit for bit the same.
+ */
 struct magnetic_cali_buff {
-	float vx[AVG_BUFF_SIZE];
-	float vy[AVG_BUFF_SIZE];
-	float vz[AVG_BUFF_SIZE];
+	float v[AVG_BUFF_SIZE];
+	int head;
+	int max;	// 1: ascending buffer of maxima, 0: descending of minima
+	float sum;
+	float diff;
 };
 
-static struct magnetic_cali_buff mcb_max;	// ascending buffer
-static struct magnetic_cali_buff mcb_min;	// descending buffer
+#define MCB_AT(b, i)	((b)->v[((b)->head + (i)) % AVG_BUFF_SIZE])
+
+static struct magnetic_cali_buff mcb_max[3];	// ascending buffer
+static struct magnetic_cali_buff mcb_min[3];	// descending buffer
+
+static void magnetic_buff_init(struct magnetic_cali_buff *b, int max);
 
 static uint8 *NVM = NULL;
 
@@ -101,56 +116,37 @@ static uint8 NVM_Restore[NVM_SIZE] =
 	0x00, 0x00
 };
 
+static uint8 NVM_Shadow[NVM_SIZE];
+
+static struct ids_nvm_t nvm =
+	IDS_NVM_INITIALIZER(NVM_PATH, NVM_Restore, NVM_RAM, NVM_Shadow, NVM_SIZE);
+
 /* initial parameter must be global virable */
 static COMPASSLIB_H6_INIT_STRUCT init_parm;
 
 int ids_h6_nvm_restore()
 {
-	memcpy(NVM, NVM_Restore, NVM_SIZE);
-	NVM[NVM_STATE_BYTE] = 1;
+	ids_nvm_reset(&nvm);
+	ids_nvm_write(&nvm, NVM_STATE_BYTE, 1);
 
-	if (NVM != NVM_RAM) {
-		msync(NVM, NVM_SIZE, MS_SYNC);
-	}
-	return 0;
+	// memsicd picks the new file up through ids_nvm_refresh()
+	return ids_nvm_save(&nvm, 1);
 }
 
 int ids_h6_nvm_load()
 {
-	int fd;
-	int n;
-	uint8 buf[NVM_SIZE];
-
-	fd = open(NVM_PATH, O_RDWR | O_CREAT, 0666);
-	if (fd == -1) {
-		LOGE("%s: fail to open %s\n", __FUNCTION__, NVM_PATH);
-		NVM = NVM_RAM;
+	NVM = NVM_RAM;
+	if (ids_nvm_load(&nvm)) {
+		LOGE("%s: fail to store %s\n", __FUNCTION__, NVM_PATH);
 		return -1;
 	}
 
-	lseek(fd, 0, SEEK_SET);
-	n = read(fd, buf, NVM_SIZE);
-	if (n != NVM_SIZE) {	// empty or broken parm file
-		// restore parm file to default
-		lseek(fd, 0, SEEK_SET);
-		n = write(fd, NVM_Restore, NVM_SIZE);
-	}
-	NVM = mmap(0, MAPPED_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (NVM == MAP_FAILED) {
-		// set NVM to RAM if failure
-		NVM = NVM_RAM;
-	}
-	close(fd);
-
 	return 0;
 }
 
 int ids_h6_nvm_save()
 {
-	if (NVM != NVM_RAM) {
-		msync(NVM, NVM_SIZE, MS_SYNC);
-	}
-	return 0;
+	return ids_nvm_save(&nvm, 0);
 }
 
 uint16 ids_h6_nvm_read(uint16 offset)
@@ -165,7 +161,7 @@ uint16 ids_h6_nvm_read(uint16 offset)
 uint8 ids_h6_nvm_write(uint16 offset, uint8 data)
 {
 	if (offset < CompassLib_H6_GetNVMBlockSize()) {
-		NVM[offset] = data;
+		ids_nvm_write(&nvm, offset, data);
 		return 1;
 	}
 
@@ -178,13 +174,9 @@ int ids_h6_init(void)
 	COMPASSLIB_H6_INIT_RESULT initRes;
 	int i;
 
-	for (i = 0; i < AVG_BUFF_SIZE; i++) {
-		mcb_max.vx[i] = -MAG_MAX;
-		mcb_max.vy[i] = -MAG_MAX;
-		mcb_max.vz[i] = -MAG_MAX;
-		mcb_min.vx[i] = MAG_MAX;
-		mcb_min.vy[i] = MAG_MAX;
-		mcb_min.vz[i] = MAG_MAX;
+	for (i = 0; i < 3; i++) {
+		magnetic_buff_init(&mcb_max[i], 1);
+		magnetic_buff_init(&mcb_min[i], 0);
 	}
 	// Bring non-volatile memory online first of all
 	ids_h6_nvm_load();
@@ -222,12 +214,8 @@ int ids_h6_open(void)
 
 int ids_h6_close(void)
 {
-	ids_h6_nvm_save();
-	if (!NVM && NVM != NVM_RAM) {
-		munmap(NVM, MAPPED_MEM_SIZE);
-		NVM = NULL;
-	}
-	return 0;
+	// the process may be about to exit, don't leave it to the writer
+	return ids_nvm_save(&nvm, 1);
 }
 
 int ids_h6_restart(void)
@@ -240,6 +228,7 @@ int ids_h6_get_state(void)
 {
 	int state = 0;
 	if (NVM) {
+		ids_nvm_refresh(&nvm);
 		state = NVM[NVM_STATE_BYTE];
 	}
 	return state;
@@ -248,7 +237,7 @@ int ids_h6_get_state(void)
 void ids_h6_clear_state(void)
 {
 	if (NVM) {
-		NVM[NVM_STATE_BYTE] = 0;
+		ids_nvm_write(&nvm, NVM_STATE_BYTE, 0);
 	}
 }
 
@@ -405,160 +394,125 @@ int ids_h6_calibration(struct SensorData_Algo *d)
 }
 
 #if BUFFER_DUMP
-void dump(const float v[], int size, int type, const char *str)
+void dump(const struct magnetic_cali_buff *b, const char *str)
 {
 	int i;
 
-	LOGD("Dump %s - %s:", str, type ? "MAX": "MIN");
-        for (i = 0; i < size; i++) {
-		LOGD(" %1.3f", v[i]);
+	LOGD("Dump %s - %s:", str, b->max ? "MAX": "MIN");
+        for (i = 0; i < AVG_BUFF_SIZE; i++) {
+		LOGD(" %1.3f", MCB_AT(b, i));
 	}
 	LOGD("\n");
 }
 #else
-#define dump(v, s, t, f)
+#define dump(b, f)
 #endif
 
-static int float_max( const void *a , const void *b )
-{
-	return ((*(float *)a > *(float *)b) ? 1 : -1);
-} 
+// x may stay in front of y in buffer b
+#define magnetic_in_order(b, x, y)	((b)->max ? !((x) > (y)) : !((x) < (y)))
+#define magnetic_is_sentinel(b)		(MCB_AT(b, 0) == ((b)->max ? -MAG_MAX : MAG_MAX))
 
-static int float_min( const void *a , const void *b )
+static void magnetic_buff_update(struct magnetic_cali_buff *b)
 {
-	return ((*(float *)a < *(float *)b) ? 1 : -1);
-} 
-
-#define magnetic_max_sort(v, size)	qsort((v), (size), sizeof((v)[0]), float_max)
-#define magnetic_min_sort(v, size)	qsort((v), (size), sizeof((v)[0]), float_min)
-#define magnetic_max_is_new(v, nd)	(((v)[0] == -MAG_MAX) || ((nd) > (v)[AVG_BUFF_SIZE-1]))
-#define magnetic_min_is_new(v, nd)	(((v)[0] == MAG_MAX) || ((nd) < (v)[AVG_BUFF_SIZE-1]))
-#define magnetic_max_insert(v, nm)	((v)[0] = (nm))	// replace the minimum in vector v
-#define magnetic_min_insert(v, nm)	((v)[0] = (nm))	// replace the maximum in vector v
-
-static int magnetic_max_is_valid(const float v[], float new_max)
-{
-	int i = 0;
-	float diff_a = .0, delt = .0;
-
-	if (v[0] == -MAG_MAX) {
-		return 1;
-	}
+	int i;
 
-	delt = new_max - v[AVG_BUFF_SIZE-1];
-	if (delt < 0) {
-		return 0;	// invalid if negative delta
+	b->sum = .0;
+	for (i = 0; i < AVG_BUFF_SIZE; i++) {
+		b->sum += MCB_AT(b, i);
 	}
 
 	// differential sum
+	b->diff = .0;
 	for (i = 0; i < AVG_BUFF_SIZE - 1; i++) {
-		diff_a += v[(AVG_BUFF_SIZE-i)-1] - v[(AVG_BUFF_SIZE-i)-2];
-	}	
+		if (b->max) {
+			b->diff += MCB_AT(b, (AVG_BUFF_SIZE-i)-1) - MCB_AT(b, (AVG_BUFF_SIZE-i)-2);
+		} else {
+			b->diff += MCB_AT(b, i) - MCB_AT(b, i+1);
+		}
+	}
 	// differential average
-	diff_a /= (AVG_BUFF_SIZE - 1);
+	b->diff /= (AVG_BUFF_SIZE - 1);
+}
+
+static void magnetic_buff_init(struct magnetic_cali_buff *b, int max)
+{
+	int i;
 
-	return ((diff_a * MAG_NOI_THRESHOLD - delt) > 0.0);
+	for (i = 0; i < AVG_BUFF_SIZE; i++) {
+		b->v[i] = max ? -MAG_MAX : MAG_MAX;
+	}
+	b->head = 0;
+	b->max = max;
+	magnetic_buff_update(b);
 }
 
-static int magnetic_min_is_valid(const float v[], float new_min)
+static int magnetic_is_new(const struct magnetic_cali_buff *b, float nd)
 {
-	int i = 0;
-	float diff_a = .0, delt = .0;
+	float last = MCB_AT(b, AVG_BUFF_SIZE-1);
 
-	if (v[0] == MAG_MAX) {
+	return magnetic_is_sentinel(b) || (b->max ? (nd > last) : (nd < last));
+}
+
+static int magnetic_is_valid(const struct magnetic_cali_buff *b, float nd)
+{
+	float delt = .0;
+
+	if (magnetic_is_sentinel(b)) {
 		return 1;
 	}
 
-	delt = v[AVG_BUFF_SIZE-1] - new_min;
+	delt = b->max ? nd - MCB_AT(b, AVG_BUFF_SIZE-1) : MCB_AT(b, AVG_BUFF_SIZE-1) - nd;
 	if (delt < 0) {
 		return 0;	// invalid if negative delta
 	}
 
-	// differential
-	for (i = 0; i < AVG_BUFF_SIZE - 1; i++) {
-		diff_a += v[i] - v[i+1];
-	}	
-	// differential average
-	diff_a /= (AVG_BUFF_SIZE - 1);
-
-	return ((diff_a * MAG_NOI_THRESHOLD - delt) > 0.0);
+	return ((b->diff * MAG_NOI_THRESHOLD - delt) > 0.0);
 }
 
-int ids_h6_calc_magcentre(const float mag[3], float centre[3])
+// replace the least extreme entry by nd and keep the ring sorted
+static void magnetic_insert(struct magnetic_cali_buff *b, float nd)
 {
-	int i = 0;	
-	float avg_max_x = .0, avg_min_x = .0;
-	float avg_max_y = .0, avg_min_y = .0;
-	float avg_max_z = .0, avg_min_z = .0;
-	
-	
-	if (magnetic_max_is_new(mcb_max.vx, mag[0])) {
-		if (magnetic_max_is_valid(mcb_max.vx, mag[0])) {
-			magnetic_max_insert(mcb_max.vx, mag[0]);
-			magnetic_max_sort(mcb_max.vx, AVG_BUFF_SIZE);
-			dump(mcb_max.vx, AVG_BUFF_SIZE, 1, "X");
-		}
-	}
-	if (magnetic_min_is_new(mcb_min.vx, mag[0])) {
-		if (magnetic_min_is_valid(mcb_min.vx, mag[0])) {
-			magnetic_min_insert(mcb_min.vx, mag[0]);
-			magnetic_min_sort(mcb_min.vx, AVG_BUFF_SIZE);
-			dump(mcb_min.vx, AVG_BUFF_SIZE, 0, "X");
-		}
-	}
+	int i;
+	float tmp;
 
-	if (magnetic_max_is_new(mcb_max.vy, mag[1])) {
-		if (magnetic_max_is_valid(mcb_max.vy, mag[1])) {
-			magnetic_max_insert(mcb_max.vy, mag[1]);
-			magnetic_max_sort(mcb_max.vy, AVG_BUFF_SIZE);
-			dump(mcb_max.vy, AVG_BUFF_SIZE, 1, "Y");
-		}
-	}
-	if (magnetic_min_is_new(mcb_min.vy, mag[1])) {
-		if (magnetic_min_is_valid(mcb_min.vy, mag[1])) {
-			magnetic_min_insert(mcb_min.vy, mag[1]);
-			magnetic_min_sort(mcb_min.vy, AVG_BUFF_SIZE);
-			dump(mcb_min.vy, AVG_BUFF_SIZE, 0, "Y");
+	MCB_AT(b, 0) = nd;
+	if (magnetic_in_order(b, MCB_AT(b, AVG_BUFF_SIZE-1), nd)) {
+		// new extreme, the usual case: turn the ring
+		b->head = (b->head + 1) % AVG_BUFF_SIZE;
+	} else {
+		// still filling up: sink it to its place
+		for (i = 0; i < AVG_BUFF_SIZE - 1 && !magnetic_in_order(b, MCB_AT(b, i), MCB_AT(b, i+1)); i++) {
+			tmp = MCB_AT(b, i);
+			MCB_AT(b, i) = MCB_AT(b, i+1);
+			MCB_AT(b, i+1) = tmp;
 		}
 	}
+	magnetic_buff_update(b);
+}
+
+int ids_h6_calc_magcentre(const float mag[3], float centre[3])
+{
+	int i = 0;	
+	float avg_max = .0, avg_min = .0;
 	
-	if (magnetic_max_is_new(mcb_max.vz, mag[2])) {
-		if (magnetic_max_is_valid(mcb_max.vz, mag[2])) {
-			magnetic_max_insert(mcb_max.vz, mag[2]);
-			magnetic_max_sort(mcb_max.vz, AVG_BUFF_SIZE);
-			dump(mcb_max.vz, AVG_BUFF_SIZE, 1, "Z");
+	for (i = 0; i < 3; i++) {
+		if (magnetic_is_new(&mcb_max[i], mag[i])) {
+			if (magnetic_is_valid(&mcb_max[i], mag[i])) {
+				magnetic_insert(&mcb_max[i], mag[i]);
+				dump(&mcb_max[i], i == 0 ? "X" : (i == 1 ? "Y" : "Z"));
+			}
 		}
-	}
-	if (magnetic_min_is_new(mcb_min.vz, mag[2])) {
-		if (magnetic_min_is_valid(mcb_min.vz, mag[2])) {
-			magnetic_min_insert(mcb_min.vz, mag[2]);
-			magnetic_min_sort(mcb_min.vz, AVG_BUFF_SIZE);
-			dump(mcb_min.vz, AVG_BUFF_SIZE, 0, "Z");
+		if (magnetic_is_new(&mcb_min[i], mag[i])) {
+			if (magnetic_is_valid(&mcb_min[i], mag[i])) {
+				magnetic_insert(&mcb_min[i], mag[i]);
+				dump(&mcb_min[i], i == 0 ? "X" : (i == 1 ? "Y" : "Z"));
+			}
 		}
-	}
-	
-	for (i = 0; i < AVG_BUFF_SIZE; i++) {
-		avg_max_x += mcb_max.vx[i];
-		avg_min_x += mcb_min.vx[i];
 
-		avg_max_y += mcb_max.vy[i];
-		avg_min_y += mcb_min.vy[i];
-
-		avg_max_z += mcb_max.vz[i];
-		avg_min_z += mcb_min.vz[i];
+		avg_max = mcb_max[i].sum / AVG_BUFF_SIZE;
+		avg_min = mcb_min[i].sum / AVG_BUFF_SIZE;
+		centre[i] = (avg_max + avg_min) / 2;
 	}
-	avg_max_x /= AVG_BUFF_SIZE;
-	avg_min_x /= AVG_BUFF_SIZE;
-
-	avg_max_y /= AVG_BUFF_SIZE;
-	avg_min_y /= AVG_BUFF_SIZE;
-
-	avg_max_z /= AVG_BUFF_SIZE;
-	avg_min_z /= AVG_BUFF_SIZE;
-
-	centre[0] = (avg_max_x + avg_min_x) / 2;
-	centre[1] = (avg_max_y + avg_min_y) / 2;
-	centre[2] = (avg_max_z + avg_min_z) / 2;
 
 	return 0;
 }
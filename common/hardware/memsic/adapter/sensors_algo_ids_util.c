@@ -18,17 +18,302 @@
 #if ((defined COMPASS_ALGO_H5) ||	\
      (defined COMPASS_ALGO_H6))
 
+#define LOG_TAG "SensorAlgo"
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 
+#include <utils/Log.h>
+
 #include <sensors_data_struct.h>
 #include <sensors_algo_ids_util.h>
 
+#define NVM_CHECK_INTV		1000	// ms
+
+static long ids_nvm_get_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static void ids_nvm_set_dirty(struct ids_nvm_t *nvm, int lo, int hi)
+{
+	if (lo < nvm->dirty_lo) {
+		nvm->dirty_lo = lo;
+	}
+	if (hi > nvm->dirty_hi) {
+		nvm->dirty_hi = hi;
+	}
+}
+
+/*
+ * Write image buf of generation gen to the file, unless a newer one is
+ * there already. The file identity is recorded under io_lock, so that
+ * ids_nvm_refresh() never mistakes our own rename for another writer.
+ */
+static int ids_nvm_write_file(struct ids_nvm_t *nvm, const uint8 *buf, int gen)
+{
+	char tmp[256];
+	struct stat st;
+	int fd, n, res = 0;
+
+	pthread_mutex_lock(&nvm->io_lock);
+	if (gen <= nvm->written_gen) {
+		pthread_mutex_unlock(&nvm->io_lock);
+		return 0;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", nvm->path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		res = -1;
+		goto out;
+	}
+	n = write(fd, buf, nvm->size);
+	if (n != nvm->size || fsync(fd)) {
+		close(fd);
+		unlink(tmp);
+		res = -1;
+		goto out;
+	}
+	close(fd);
+	if (rename(tmp, nvm->path)) {
+		unlink(tmp);
+		res = -1;
+		goto out;
+	}
+	nvm->written_gen = gen;
+
+	if (!stat(nvm->path, &st)) {
+		pthread_mutex_lock(&nvm->lock);
+		nvm->ino = st.st_ino;
+		nvm->mtime = st.st_mtime;
+		nvm->fsize = st.st_size;
+		pthread_mutex_unlock(&nvm->lock);
+	}
+
+out:
+	pthread_mutex_unlock(&nvm->io_lock);
+	// memsicd runs with stdout closed: printf could land in any file
+	// opened since, so errors only go to the log
+	LOGE_IF(res, "%s: fail to write %s (%s)", __FUNCTION__, nvm->path, strerror(errno));
+	return res;
+}
+
+static void *ids_nvm_writer(void *arg)
+{
+	struct ids_nvm_t *nvm = (struct ids_nvm_t *)arg;
+	uint8 *buf;
+	int gen;
+
+	buf = malloc(nvm->size);
+	if (!buf) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&nvm->lock);
+	while (1) {
+		while (!nvm->pending) {
+			pthread_cond_wait(&nvm->cond, &nvm->lock);
+		}
+		memcpy(buf, nvm->shadow, nvm->size);
+		gen = nvm->gen;
+		nvm->pending = 0;
+		pthread_mutex_unlock(&nvm->lock);
+
+		ids_nvm_write_file(nvm, buf, gen);
+
+		pthread_mutex_lock(&nvm->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the whole file into buf and return its identity in st; buf is
+ * only valid if this succeeds.
+ */
+static int ids_nvm_read_file(struct ids_nvm_t *nvm, uint8 *buf, struct stat *st)
+{
+	int fd, n;
+
+	fd = open(nvm->path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	n = read(fd, buf, nvm->size);
+	if (n != nvm->size || fstat(fd, st)) {	// empty or broken parm file
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	return 0;
+}
+
+int ids_nvm_load(struct ids_nvm_t *nvm)
+{
+	struct stat st;
+
+	nvm->check_ms = ids_nvm_get_ms();
+	pthread_mutex_lock(&nvm->io_lock);
+	if (!ids_nvm_read_file(nvm, nvm->ram, &st)) {
+		pthread_mutex_lock(&nvm->lock);
+		memcpy(nvm->shadow, nvm->ram, nvm->size);
+		nvm->ino = st.st_ino;
+		nvm->mtime = st.st_mtime;
+		nvm->fsize = st.st_size;
+		nvm->dirty_lo = nvm->size;
+		nvm->dirty_hi = -1;
+		pthread_mutex_unlock(&nvm->lock);
+		pthread_mutex_unlock(&nvm->io_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&nvm->io_lock);
+
+	// restore parm file to default
+	ids_nvm_reset(nvm);
+	return ids_nvm_save(nvm, 1);
+}
+
+void ids_nvm_write(struct ids_nvm_t *nvm, int offset, uint8 data)
+{
+	if (nvm->ram[offset] != data) {
+		nvm->ram[offset] = data;
+		ids_nvm_set_dirty(nvm, offset, offset);
+	}
+}
+
+void ids_nvm_reset(struct ids_nvm_t *nvm)
+{
+	memcpy(nvm->ram, nvm->defaults, nvm->size);
+	ids_nvm_set_dirty(nvm, 0, nvm->size - 1);
+}
+
+int ids_nvm_save(struct ids_nvm_t *nvm, int sync)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	int gen;
+
+	pthread_mutex_lock(&nvm->lock);
+	if (nvm->dirty_lo <= nvm->dirty_hi) {
+		memcpy(nvm->shadow + nvm->dirty_lo, nvm->ram + nvm->dirty_lo,
+			nvm->dirty_hi - nvm->dirty_lo + 1);
+		++nvm->gen;
+		nvm->dirty_lo = nvm->size;
+		nvm->dirty_hi = -1;
+	} else if (!sync) {
+		pthread_mutex_unlock(&nvm->lock);
+		return 0;	// nothing changed since the last save
+	}
+	gen = nvm->gen;
+
+	if (sync) {
+		// also covers an image the writer has not written yet;
+		// ids_nvm_write_file() skips it if it is on disk already
+		nvm->pending = 0;
+		pthread_mutex_unlock(&nvm->lock);
+		return ids_nvm_write_file(nvm, nvm->ram, gen);
+	}
+
+	if (!nvm->writer_up) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (!pthread_create(&thread, &attr, ids_nvm_writer, nvm)) {
+			nvm->writer_up = 1;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	if (!nvm->writer_up) {
+		pthread_mutex_unlock(&nvm->lock);
+		return ids_nvm_write_file(nvm, nvm->ram, gen);
+	}
+	nvm->pending = 1;
+	pthread_cond_signal(&nvm->cond);
+	pthread_mutex_unlock(&nvm->lock);
+
+	return 0;
+}
+
+int ids_nvm_refresh(struct ids_nvm_t *nvm)
+{
+	struct stat st;
+	uint8 *buf;
+	long now;
+	int changed;
+
+	now = ids_nvm_get_ms();
+	if (now - nvm->check_ms < NVM_CHECK_INTV) {
+		return 0;
+	}
+	nvm->check_ms = now;
+
+	// io_lock keeps our own writer from renaming the file in between
+	pthread_mutex_lock(&nvm->io_lock);
+	if (stat(nvm->path, &st)) {
+		pthread_mutex_unlock(&nvm->io_lock);
+		return 0;
+	}
+	pthread_mutex_lock(&nvm->lock);
+	changed = (st.st_ino != nvm->ino || st.st_mtime != nvm->mtime ||
+		   st.st_size != nvm->fsize);
+	pthread_mutex_unlock(&nvm->lock);
+	if (!changed) {
+		pthread_mutex_unlock(&nvm->io_lock);
+		return 0;
+	}
+
+	// e.g. the accelerometer calibration restored the defaults. A short
+	// or broken file leaves the NVM as it is.
+	buf = malloc(nvm->size);
+	if (!buf || ids_nvm_read_file(nvm, buf, &st)) {
+		pthread_mutex_unlock(&nvm->io_lock);
+		free(buf);
+		return 0;
+	}
+
+	// the new file wins over unsaved changes and over queued images
+	pthread_mutex_lock(&nvm->lock);
+	memcpy(nvm->ram, buf, nvm->size);
+	memcpy(nvm->shadow, buf, nvm->size);
+	nvm->ino = st.st_ino;
+	nvm->mtime = st.st_mtime;
+	nvm->fsize = st.st_size;
+	nvm->dirty_lo = nvm->size;
+	nvm->dirty_hi = -1;
+	nvm->pending = 0;
+	nvm->written_gen = nvm->gen;
+	pthread_mutex_unlock(&nvm->lock);
+	pthread_mutex_unlock(&nvm->io_lock);
+
+	free(buf);
+	return 1;
+}
+
+static int (*ids_clock)(void) = NULL;
+
+void ids_set_clock(int (*get_ms)(void))
+{
+	ids_clock = get_ms;
+}
+
 int ids_get_milliseconds()
 {
 	struct timeval tv_cur;
 
+	if (ids_clock) {
+		return ids_clock() % 65536;
+	}
 	gettimeofday(&tv_cur, NULL);
 	return (tv_cur.tv_sec * 1000 + tv_cur.tv_usec / 1000) % 65536;
 }
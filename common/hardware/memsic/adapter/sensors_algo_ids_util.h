@@ -18,8 +18,88 @@
 #ifndef __SENSORS_ALGO_IDS_UTIL_H__
 #define __SENSORS_ALGO_IDS_UTIL_H__
 
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
 #include <sensors_data_struct.h>
 
+/**
+ * @brief
+ * Non-volatile memory of the algorithm library. It lives in RAM and is
+ * written back to its file only when it changed, asynchronously, through
+ * a temp file and rename() so the file is never seen half written.
+ */
+struct ids_nvm_t {
+	const char *path;		///< backing file
+	const uint8 *defaults;		///< content of a new or broken file
+	uint8 *ram;			///< live copy, owned by the algorithm thread
+	uint8 *shadow;			///< image queued for the writer thread
+	int size;
+
+	int dirty_lo;			///< first changed byte, > dirty_hi if clean
+	int dirty_hi;			///< last changed byte
+	long check_ms;			///< last check for changes by another process
+
+	pthread_mutex_t lock;		///< guards the fields below
+	pthread_mutex_t io_lock;	///< serializes writes of the file
+	pthread_cond_t cond;
+	int writer_up;
+	int pending;			///< shadow waits to be written
+	int gen;			///< generation of the last queued image
+	int written_gen;		///< generation of the file on disk
+	ino_t ino;			///< identity of the file as last seen
+	time_t mtime;
+	off_t fsize;
+};
+
+#define IDS_NVM_INITIALIZER(_path, _defaults, _ram, _shadow, _size) {	\
+	path		: (_path),					\
+	defaults	: (_defaults),					\
+	ram		: (_ram),					\
+	shadow		: (_shadow),					\
+	size		: (_size),					\
+	dirty_lo	: (_size),					\
+	dirty_hi	: -1,						\
+	lock		: PTHREAD_MUTEX_INITIALIZER,			\
+	io_lock		: PTHREAD_MUTEX_INITIALIZER,			\
+	cond		: PTHREAD_COND_INITIALIZER,			\
+}
+
+/**
+ * @brief Load the NVM from its file, or from the defaults if there is none.
+ * @return 0 for success, others for failure
+ */
+int ids_nvm_load(struct ids_nvm_t *nvm);
+/**
+ * @brief Change one byte of the NVM; unchanged values don't dirty it.
+ */
+void ids_nvm_write(struct ids_nvm_t *nvm, int offset, uint8 data);
+/**
+ * @brief Reset the NVM to its defaults.
+ */
+void ids_nvm_reset(struct ids_nvm_t *nvm);
+/**
+ * @brief Write the NVM back if it changed.
+ * @param sync is 0 to hand the write to the writer thread, 1 to write it
+ * before returning, including an image still queued for the writer.
+ * @return 0 for success, others for failure
+ */
+int ids_nvm_save(struct ids_nvm_t *nvm, int sync);
+/**
+ * @brief Reload the NVM if another process replaced its file; checked at
+ * most once a second. Unsaved changes are dropped in favour of the file,
+ * a short or broken file is ignored.
+ * @return 1 if reloaded, 0 otherwise
+ */
+int ids_nvm_refresh(struct ids_nvm_t *nvm);
+
+/**
+ * @brief Replace the clock the algorithm library runs on, e.g. with the
+ * time base of a recorded trace. NULL restores the wall clock.
+ * @param get_ms returns the current time in ms
+ */
+void ids_set_clock(int (*get_ms)(void));
 int ids_get_milliseconds(void);
 int ids_get_shitcount(int offset);
 
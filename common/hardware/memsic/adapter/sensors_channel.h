@@ -0,0 +1,64 @@
+/*****************************************************************************
+ *  Copyright Statement:
+ *  --------------------
+ *  This software is protected by Copyright and the information and source code
+ *  contained herein is confidential. The software including the source code
+ *  may not be copied and the information contained herein may not be used or
+ *  disclosed except with the written permission of MEMSIC Inc. (C) 2010
+ *****************************************************************************/
+
+/**
+ * @file
+ *
+ * @brief
+ * This file define the shared memory channel from memsicd to the sensor HAL.
+ * <br>
+ * memsicd listens on an abstract unix socket. A client that connects gets
+ * an ashmem region holding a ring of sensor records and an eventfd that is
+ * signalled for every record, both passed with SCM_RIGHTS. memsicd is the
+ * only writer; the reader keeps its own tail and never writes the ring.
+ * Without a client memsicd reports through ECOMPASS_IOC_SET_YPR as before.
+ */
+
+#ifndef __SENSORS_CHANNEL_H__
+#define __SENSORS_CHANNEL_H__
+
+#include <stdint.h>
+
+#define SENSORS_CHANNEL_SOCKET		"memsicd"	// abstract namespace
+#define SENSORS_CHANNEL_MAGIC		0x4d454d53	// 'MEMS'
+#define SENSORS_CHANNEL_VERSION		1
+#define SENSORS_CHANNEL_RECORDS		64		// must be power of 2
+
+/*
+ * abstract datagram socket: the HAL sends a byte after it changed the
+ * ecs_ctrl flags or delay, memsicd then reads them again right away
+ * instead of at its next idle timeout
+ */
+#define SENSORS_CHANNEL_KICK		"memsicd-kick"
+
+/**
+ * @brief
+ * One complete sample of all enabled sensors
+ */
+struct sensors_channel_record {
+	int64_t timestamp;	///< sample time in ns, CLOCK_MONOTONIC
+	int32_t sensors;	///< sensors valid in this record, SENSORS_* bits
+	int32_t val[12];	///< same layout as ECOMPASS_IOC_SET_YPR
+};
+
+/**
+ * @brief
+ * Layout of the shared region
+ */
+struct sensors_channel_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t records;	///< SENSORS_CHANNEL_RECORDS
+	volatile uint32_t head;	///< records written so far, wraps around
+	struct sensors_channel_record ring[SENSORS_CHANNEL_RECORDS];
+};
+
+#define SENSORS_CHANNEL_AT(ch, n)	((ch)->ring[(n) & (SENSORS_CHANNEL_RECORDS - 1)])
+
+#endif /* __SENSORS_CHANNEL_H__ */
@@ -335,3 +335,42 @@ void coordinate_real_to_ids(float *out, const float *in, int dir)
 	}
 }
 
+void coordinate_raw_to_real_matrix(float m[3][4],
+	void (*convert)(float *, const float *, int),
+	const int *offset, const int *sensit, int dir)
+{
+	int r, k;
+	float unit[3], col[3];
+
+	if ((!m) || (!convert) || (!offset) || (!sensit)) {
+		return;
+	}
+
+	// the axis mapping is linear, so its columns are the images of the
+	// unit vectors; that keeps it in step with the tables above
+	for (k = 0; k < 3; k++) {
+		unit[0] = unit[1] = unit[2] = 0.0;
+		unit[k] = 1.0 / sensit[k];
+		convert(col, unit, dir);
+		for (r = 0; r < 3; r++) {
+			m[r][k] = col[r];
+		}
+	}
+	for (r = 0; r < 3; r++) {
+		m[r][3] = -(m[r][0] * offset[0] + m[r][1] * offset[1] + m[r][2] * offset[2]);
+	}
+}
+
+void coordinate_apply_matrix(float *out, const float m[3][4], const int *raw)
+{
+	int r;
+
+	if ((!out) || (!m) || (!raw)) {
+		return;
+	}
+
+	for (r = 0; r < 3; r++) {
+		out[r] = m[r][0] * raw[0] + m[r][1] * raw[1] + m[r][2] * raw[2] + m[r][3];
+	}
+}
+
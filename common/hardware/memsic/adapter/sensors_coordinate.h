@@ -110,5 +110,27 @@ void coordinate_real_to_android(float *vec_out, const float *vec_in, int dir);
  */
 void coordinate_real_to_ids(float *vec_out, const float *vec_in, int dir);
 
+/**
+ * @brief Build the transform from raw data straight to a target coordinate.
+ * Offset removal, sensitivity scaling and the axis mapping are fused into
+ * one 3x4 matrix, the last column being the bias.
+ * @param m is the transform, out = m[.][0..2] * raw + m[.][3].
+ * @param convert is coordinate_real_to_android or coordinate_real_to_ids.
+ * @param offset is the offset vector.
+ * @param sensit is the sensitivity vector.
+ * @param dir is the sensor placement on target board.
+ */
+void coordinate_raw_to_real_matrix(float m[3][4],
+	void (*convert)(float *, const float *, int),
+	const int *offset, const int *sensit, int dir);
+/**
+ * @brief Convert sensor raw data vector with a transform from
+ * coordinate_raw_to_real_matrix.
+ * @param vec_out is the real data vector in target coordinate.
+ * @param m is the transform.
+ * @param raw is the raw data vector from sensor device.
+ */
+void coordinate_apply_matrix(float *vec_out, const float m[3][4], const int *raw);
+
 #endif /* __SENSORS_COORDINATE_H__ */
 
@@ -51,7 +51,10 @@ static struct device_mag_t dev_mag = {
 	read_data	: mag_mmc328x_read_data,
 	get_offset	: mag_mmc328x_get_offset,
 	get_sensitivity	: mag_mmc328x_get_sensitivity,
-	get_install_dir	: mag_mmc328x_get_install_dir
+	get_install_dir	: mag_mmc328x_get_install_dir,
+	start_measure	: mag_mmc328x_start_measure,
+	read_measure	: mag_mmc328x_read_measure,
+	measure_time	: MMC328X_MEASURE_TIME
 #else
 	#error "Mag sensor device not specify!"
 #endif
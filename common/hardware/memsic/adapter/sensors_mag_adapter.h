@@ -66,6 +66,24 @@ struct device_mag_t {
 	 * @return sensor placement defined in sensors_placement_t
 	 */
 	int (*get_install_dir)(void);
+
+	/**
+	 * @brief Start a measurement without waiting for it (optional)
+	 * @param fd is the file descriptor of sensor device
+	 * @return 0 for success, others for failure
+	 */
+	int (*start_measure)(int fd);
+	/**
+	 * @brief Collect the measurement started by start_measure (optional)
+	 * @param fd is the file descriptor of sensor device
+	 * @param data is the raw data vector
+	 * @return 0 for success, others for failure
+	 */
+	int (*read_measure)(int fd, int *data);
+	/**
+	 * @brief Time a measurement takes to complete, in us
+	 */
+	int measure_time;
 };
 
 /**
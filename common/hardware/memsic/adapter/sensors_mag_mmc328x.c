@@ -50,6 +50,11 @@
 #define MMC328X_IOC_READ		_IOR(MMC328X_IOM, 0x02, int[3])
 #define MMC328X_IOC_READXYZ		_IOR(MMC328X_IOM, 0x03, int[3])
 
+/* measurements between two SET/RESET, as READXYZ does in the driver */
+#define MMC328X_RESET_INTV		10
+
+static int measure_count;
+
 int mag_mmc328x_init(void)
 {
 	return 0;
@@ -63,6 +68,7 @@ int mag_mmc328x_open(void)
 	if (fd < 0) {
 		return -1;
 	}
+	measure_count = 0;
 
 	return fd;
 }
@@ -79,6 +85,24 @@ int mag_mmc328x_read_data(int fd, int *data)
 	return ioctl(fd, MMC328X_IOC_READXYZ, data);
 }
 
+int mag_mmc328x_start_measure(int fd)
+{
+	// TM alone never refreshes the sensor magnetization, so a strong
+	// field would leave the offset drifting: SET/RESET every few samples
+	if (measure_count++ % MMC328X_RESET_INTV == 0) {
+		if (ioctl(fd, MMC328X_IOC_RM)) {
+			return -1;
+		}
+	}
+
+	return ioctl(fd, MMC328X_IOC_TM);
+}
+
+int mag_mmc328x_read_measure(int fd, int *data)
+{
+	return ioctl(fd, MMC328X_IOC_READ, data);
+}
+
 int mag_mmc328x_get_offset(int fd, int *offset_xyz)
 {
 	offset_xyz[0] = MMC328X_OFFSET_X;
@@ -18,6 +18,9 @@
 #ifndef __SENSORS_MAG_MMC328X_H__
 #define __SENSORS_MAG_MMC328X_H__
 
+/* time from MMC328X_IOC_TM until the data is ready, in us */
+#define MMC328X_MEASURE_TIME		10000
+
 int mag_mmc328x_init(void);
 
 int mag_mmc328x_open(void);
@@ -28,5 +31,8 @@ int mag_mmc328x_get_offset(int fd, int *offset_xyz);
 int mag_mmc328x_get_sensitivity(int fd, int *sensit_xyz);
 int mag_mmc328x_get_install_dir(void);
 
+int mag_mmc328x_start_measure(int fd);
+int mag_mmc328x_read_measure(int fd, int *data);
+
 #endif /* __SENSORS_MAG_MMC328X_H__ */
 
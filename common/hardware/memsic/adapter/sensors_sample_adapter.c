@@ -0,0 +1,119 @@
+/*****************************************************************************
+ *  Copyright Statement:
+ *  --------------------
+ *  This software is protected by Copyright and the information and source code
+ *  contained herein is confidential. The software including the source code
+ *  may not be copied and the information contained herein may not be used or
+ *  disclosed except with the written permission of MEMSIC Inc. (C) 2009
+ *****************************************************************************/
+
+/**
+ * @file
+ *
+ * @brief
+ * This file implement the synchronized acc/mag sample API.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sensors_sample_adapter.h>
+
+// a mag conversion in flight older than this is not used, it would be
+// from before the sensors were last idle; above the slowest sampling rate
+#define SAMPLE_MAG_STALE_NS		(250 * 1000000LL)
+
+// the mag conversion started at the end of the previous sample
+static int mag_pending = 0;
+static int mag_pending_fd = -1;
+static int64_t mag_pending_start = 0;
+
+static int64_t sample_get_time(void)
+{
+	struct timespec t;
+
+	t.tv_sec = t.tv_nsec = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+int sensors_read_sample(struct device_acc_t *acc, int fd_acc,
+	struct device_mag_t *mag, int fd_mag,
+	int *acc_data, int *mag_data, int64_t *timestamp)
+{
+	int64_t t_start, t_acc, wait;
+
+	if (!mag || !mag->start_measure || !mag->read_measure) {
+		// whatever is in flight belongs to a mag that is off now
+		mag_pending = 0;
+	}
+
+	if (!mag) {
+		t_start = sample_get_time();
+		if (acc->read_data(fd_acc, acc_data)) {
+			return -1;
+		}
+		if (timestamp) {
+			*timestamp = (t_start + sample_get_time()) / 2;
+		}
+		return 0;
+	}
+
+	if (!mag->start_measure || !mag->read_measure) {
+		// no pipelining, read them back to back
+		t_start = sample_get_time();
+		if (acc->read_data(fd_acc, acc_data)) {
+			return -1;
+		}
+		if (mag->read_data(fd_mag, mag_data)) {
+			return -1;
+		}
+		if (timestamp) {
+			*timestamp = (t_start + sample_get_time()) / 2;
+		}
+		return 0;
+	}
+
+	// the mag conversion started at the end of the previous sample has
+	// completed by now; only the first sample after a start or a pause
+	// has to start one and wait for it
+	t_start = sample_get_time();
+	if (!mag_pending || mag_pending_fd != fd_mag ||
+	    t_start - mag_pending_start > SAMPLE_MAG_STALE_NS) {
+		if (mag->start_measure(fd_mag)) {
+			mag_pending = 0;
+			return -1;
+		}
+		mag_pending_start = t_start;
+	}
+	mag_pending = 0;
+	if (acc->read_data(fd_acc, acc_data)) {
+		return -1;
+	}
+	t_acc = sample_get_time();
+
+	wait = mag->measure_time - (t_acc - mag_pending_start) / 1000;
+	if (wait > 0) {
+		usleep(wait);
+	}
+	if (mag->read_measure(fd_mag, mag_data)) {
+		return -1;
+	}
+
+	// convert the next one while the caller sleeps until its next sample
+	if (!mag->start_measure(fd_mag)) {
+		mag_pending = 1;
+		mag_pending_fd = fd_mag;
+		mag_pending_start = sample_get_time();
+	}
+
+	// the mag lags by up to one sampling interval, the sample is stamped
+	// with the acc read
+	if (timestamp) {
+		*timestamp = (t_start + t_acc) / 2;
+	}
+
+	return 0;
+}
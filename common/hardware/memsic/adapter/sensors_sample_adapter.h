@@ -0,0 +1,44 @@
+/*****************************************************************************
+ *  Copyright Statement:
+ *  --------------------
+ *  This software is protected by Copyright and the information and source code
+ *  contained herein is confidential. The software including the source code
+ *  may not be copied and the information contained herein may not be used or
+ *  disclosed except with the written permission of MEMSIC Inc. (C) 2009
+ *****************************************************************************/
+
+/**
+ * @file
+ *
+ * @brief
+ * This file define the synchronized acc/mag sample API.
+ */
+
+#ifndef __SENSORS_SAMPLE_ADAPTER_H__
+#define __SENSORS_SAMPLE_ADAPTER_H__
+
+#include <stdint.h>
+
+#include <sensors_acc_adapter.h>
+#include <sensors_mag_adapter.h>
+
+/**
+ * @brief Read acceleration and magnetic raw data as one sample.
+ * Both sensors are read back to back. When the mag device can start a
+ * measurement on its own, each call starts the conversion the next call
+ * collects, so the mag converts while the caller sleeps; the first call
+ * after a start or a pause waits for one conversion. Not thread safe.
+ * @param acc is the acceleration sensor device
+ * @param fd_acc is the file descriptor of acceleration sensor device
+ * @param mag is the magnetic sensor device, NULL to read acc only
+ * @param fd_mag is the file descriptor of magnetic sensor device
+ * @param acc_data is the acceleration raw data vector
+ * @param mag_data is the magnetic raw data vector
+ * @param timestamp is the sample time in ns (CLOCK_MONOTONIC), may be NULL
+ * @return 0 for success, others for failure
+ */
+int sensors_read_sample(struct device_acc_t *acc, int fd_acc,
+	struct device_mag_t *mag, int fd_mag,
+	int *acc_data, int *mag_data, int64_t *timestamp);
+
+#endif /* __SENSORS_SAMPLE_ADAPTER_H__ */
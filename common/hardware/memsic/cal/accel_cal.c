@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <math.h>
 
 #include <cutils/atomic.h>
 #include <utils/Log.h>
@@ -35,8 +36,25 @@
 #include <sensors_algo_adapter.h>
 
 
-#define ACCEL_NUM_AVG			10
+#define ACCEL_NUM_AVG			10	// samples at least per try
+#define ACCEL_NUM_MAX			64	// samples at most per try
 #define ACCEL_TRIES_MAX			20
+/*
+ * 95% confidence of the mean, in counts: half an LSB, finer than the
+ * offset the driver can store. A still part shows about 0.3-1 count rms
+ * noise, so t * sigma / sqrt(n) gets there after 10-20 samples; only
+ * a noisy or vibrating part runs to ACCEL_NUM_MAX.
+ */
+#define ACCEL_CI_LIMIT			0.5
+/*
+ * Pause between reads, in us. The drivers return the last latched sample,
+ * so reading faster than the output rate of the part counts the same
+ * sample twice and makes the spread look smaller than it is.
+ */
+#define ACCEL_READ_INTV			20000
+
+#define ACCEL_READ_OK			0
+#define ACCEL_READ_MOVED		1
 
 /**
  * @brief
@@ -52,61 +70,114 @@ static struct algo_t *algo = NULL;
 static struct device_acc_t *dev_acc = NULL;
 static int fd_acc = -1;
 static int ACCEL_MIN_MAX_THRESHOLD = 10;
+
+/**
+ * @brief
+ * Running mean and variance of the samples, updated with Welford's method
+ */
+struct accel_stat {
+	int n;
+	double mean[3];
+	double m2[3];	///< sum of squared differences from the mean
+};
+
+/**
+ * @brief Two-sided 95% Student-t quantile for df degrees of freedom
+ */
+static double t_quantile_975(int df)
+{
+	static const double t[30] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+	};
+
+	if (df < 1)
+		return t[0];
+	if (df <= 30)
+		return t[df - 1];
+	// stays above the true value up to ACCEL_NUM_MAX
+	return 2.042;
+}
+
 /**
- * @brief Reads out acceleration data and averages them, measures min and max
- * @param num_avg numer of samples for averaging
+ * @brief Reads out acceleration data and averages them, measures min and max.
+ * Stops as soon as the mean is known to ACCEL_CI_LIMIT, and gives up early
+ * when a sample shows the device is being moved.
+ * @param num_min number of samples at least for averaging
+ * @param num_max number of samples at most for averaging
  * @param *min returns the minimum measured value
  * @param *max returns the maximum measured value
  * @param *avg returns the average value
- * @return 0 for success, others for failure
+ * @return ACCEL_READ_OK for a settled average, ACCEL_READ_MOVED if the device
+ * moved, negative for read failure
  */
-static int read_accel_avg(int num_avg, acc_t *min, acc_t *max, acc_t *avg)
+static int read_accel_avg(int num_min, int num_max, acc_t *min, acc_t *max, acc_t *avg)
 {
-	long x_avg = 0, y_avg = 0, z_avg = 0;
-	int comres = 0;
+	struct accel_stat st;
+	double d, ci;
+	int raw_acc[3];
+	int settled;
 	int i;
-	acc_t accel;		/* read accel data */
-	int raw_acc[3];
 
-	x_avg = 0; y_avg = 0; z_avg = 0;                  
+	memset(&st, 0, sizeof(st));
 	max->x = -512; max->y = -512; max->z = -512;
 	min->x = 512; min->y = 512; min->z = 512;
-     
-
-	for (i = 0; i < num_avg; i++) {
-		/* read num_avg acceleration data triples */
-		comres += dev_acc->read_data(fd_acc, raw_acc);
-		accel.x = raw_acc[0];
-		accel.y = raw_acc[1];
-		accel.z = raw_acc[2];
-
-		if (accel.x > max->x)
-			max->x = accel.x;
-		if (accel.x < min->x) 
-			min->x=accel.x;
-
-		if (accel.y > max->y)
-			max->y = accel.y;
-		if (accel.y < min->y) 
-			min->y=accel.y;
-
-		if (accel.z > max->z)
-			max->z = accel.z;
-		if (accel.z < min->z) 
-			min->z=accel.z;
-		
-		x_avg += accel.x;
-		y_avg += accel.y;
-		z_avg += accel.z;
+
+	while (st.n < num_max) {
+		if (st.n > 0) {
+			usleep(ACCEL_READ_INTV);
+		}
+		if (dev_acc->read_data(fd_acc, raw_acc)) {
+			return -1;
+		}
+
+		if (raw_acc[0] > max->x)
+			max->x = raw_acc[0];
+		if (raw_acc[0] < min->x)
+			min->x = raw_acc[0];
+
+		if (raw_acc[1] > max->y)
+			max->y = raw_acc[1];
+		if (raw_acc[1] < min->y)
+			min->y = raw_acc[1];
+
+		if (raw_acc[2] > max->z)
+			max->z = raw_acc[2];
+		if (raw_acc[2] < min->z)
+			min->z = raw_acc[2];
+
+		st.n++;
+		settled = (st.n >= num_min);
+		for (i = 0; i < 3; i++) {
+			d = raw_acc[i] - st.mean[i];
+			// the device is not lying still, no point in going on
+			if (st.n > 1 && (d > ACCEL_MIN_MAX_THRESHOLD || d < -ACCEL_MIN_MAX_THRESHOLD)) {
+				LOGD("%s: moved after %d samples", __FUNCTION__, st.n);
+				return ACCEL_READ_MOVED;
+			}
+			st.mean[i] += d / st.n;
+			st.m2[i] += d * (raw_acc[i] - st.mean[i]);
+
+			if (st.n > 1) {
+				ci = t_quantile_975(st.n - 1) * sqrt(st.m2[i] / (st.n - 1) / st.n);
+				if (ci > ACCEL_CI_LIMIT) {
+					settled = 0;
+				}
+			}
+		}
+		if (settled) {
+			break;
+		}
 	}
-	/* calculate averages, min and max values */
-	avg->x = x_avg /= num_avg;
-	avg->y = y_avg /= num_avg;
-	avg->z = z_avg /= num_avg;
-
-	return comres;
+
+	/* calculate averages */
+	avg->x = st.mean[0];
+	avg->y = st.mean[1];
+	avg->z = st.mean[2];
+
+	return ACCEL_READ_OK;
 }
-	 
 
 /**
  * @brief Verifies the accerleration values to be good enough for calibration calculations
@@ -119,16 +190,12 @@ static int verify_min_max(acc_t min, acc_t max, acc_t avg)
 {
 	short dx, dy, dz;
 	int ver_ok = 1;
-	int sensitivity_for_threshold[3];
 	
 	/* calc delta max-min */
 	dx =  max.x - min.x;
 	dy =  max.y - min.y;
 	dz =  max.z - min.z;
 
-	dev_acc->get_sensitivity(fd_acc, sensitivity_for_threshold);
-	ACCEL_MIN_MAX_THRESHOLD = ( sensitivity_for_threshold[0] / 60 ) + 2;
-
 	if (dx > ACCEL_MIN_MAX_THRESHOLD || dx < -ACCEL_MIN_MAX_THRESHOLD)
 		ver_ok = 0;
 	if (dy > ACCEL_MIN_MAX_THRESHOLD || dy < -ACCEL_MIN_MAX_THRESHOLD)
@@ -170,13 +237,16 @@ int accel_calibrate(void)
 	algo->init();
 	algo->open();
 
+	dev_acc->get_sensitivity(fd_acc, sensit_xyz);
+	ACCEL_MIN_MAX_THRESHOLD = ( sensit_xyz[0] / 60 ) + 2;
+
 	do {
 		/* read acceleration data min, max, avg */
-		res = read_accel_avg(ACCEL_NUM_AVG, &min, &max, &avg);
-		if (res)	// there's failure in read acc data
+		res = read_accel_avg(ACCEL_NUM_AVG, ACCEL_NUM_MAX, &min, &max, &avg);
+		if (res < 0)	// there's failure in read acc data
 			break;
 
-		min_max_ok = verify_min_max(min, max, avg);
+		min_max_ok = (res == ACCEL_READ_OK) && verify_min_max(min, max, avg);
 
 		if (tries <= 0)	/*number of maximum tries reached? */
 			break;
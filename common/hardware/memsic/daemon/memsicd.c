@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <dirent.h>
 #include <stdio.h>
 #include <string.h>
@@ -36,12 +37,23 @@
 #include <stdarg.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+
+#include <cutils/ashmem.h>
 
 #include <sensors_data_struct.h>
 #include <sensors_acc_adapter.h>
 #include <sensors_mag_adapter.h>
+#include <sensors_sample_adapter.h>
 #include <sensors_algo_adapter.h>
 #include <sensors_coordinate.h>
+#include <sensors_channel.h>
 
 #define DEBUG			1
 
@@ -72,13 +84,19 @@
 #define SENSOR_STATUS_ACCURACY_HIGH	3
 
 #define DAEMON_POLLING_INTV		20			// ms
+#define DAEMON_POLLING_MIN		10			// ms
+#define DAEMON_POLLING_MAX		200			// ms
+#define DAEMON_IDLE_INTV		1000			// ms, the HAL kicks on a change
 #define DAEMON_NVM_STORE_INTV		(30 * 1000)		// ms
 
+#define CHANNEL_UID_SYSTEM		1000			// AID_SYSTEM, the sensor service
+
 /* Use 'e' as magic number */
 #define ECOMPASS_IOM			'e'
 
 /* IOCTLs for ECOMPASS device */
 #define ECOMPASS_IOC_SET_MODE		_IOW(ECOMPASS_IOM, 0x00, short)
+/* sampling interval in ms; it used to be us, which a short caps at 32 ms */
 #define ECOMPASS_IOC_SET_DELAY		_IOW(ECOMPASS_IOM, 0x01, short)
 #define ECOMPASS_IOC_GET_DELAY		_IOR(ECOMPASS_IOM, 0x02, short)
 
@@ -107,9 +125,28 @@ static float version[1] = {
 };
 
 static struct algo_t *algo = NULL;
+static volatile sig_atomic_t memsicd_stop = 0;
 static struct device_acc_t *dev_acc = NULL;
 static struct device_mag_t *dev_mag = NULL;
 static int fd_acc = -1, fd_mag = -1, fd_ctrl = -1;
+static int fd_timer = -1;
+
+/* shared memory channel to the HAL, see sensors_channel.h */
+static struct sensors_channel_t *chan = NULL;
+static int fd_chan_listen = -1, fd_chan_client = -1, fd_chan_bell = -1;
+static int fd_chan_mem = -1;
+static int fd_kick = -1;
+
+/*
+ * calibration of a sensor device, loaded once when sensors get enabled:
+ * raw counts straight to the IDS and android coordinate systems
+ */
+struct ecompass_cal_t {
+	float ids[3][4];
+	float android[3][4];
+};
+
+static struct ecompass_cal_t cal_acc, cal_mag;
 
 static int memsicd_log(const char *fmt, ...)
 {
@@ -172,16 +209,13 @@ static void memsicd_abort(void)
 	memsicd_log("memsicd abort\n");
 }
 
+/*
+ * Only flag the signal: it interrupts memsicd_wait(), and the main loop
+ * then saves the NVM and exits outside of signal context.
+ */
 static void memsicd_sigterm(int signo)
 {
-	if (algo) {
-		algo->nvm_store();
-	}
-	memsicd_abort();
-	memsicd_log("signal: %d\n", signo);
-	/* catched signal */
-	memsicd_log("memsicd stopped\n");
-	exit(0);
+	memsicd_stop = signo;
 }
 
 static int open_ctrl_dev(int mode)
@@ -228,8 +262,347 @@ static int control_read_sensors_state(int fd)
 	return sensors;
 }
 
+/*
+ * polling interval requested by the HAL through ECOMPASS_IOC_SET_DELAY, in ms.
+ * 0 is SENSOR_DELAY_FASTEST and gets the shortest interval we run at
+ */
+static int control_read_delay(int fd)
+{
+	short delay;
+
+	if (fd < 0 || ioctl(fd, ECOMPASS_IOC_GET_DELAY, &delay) || delay < 0) {
+		return DAEMON_POLLING_INTV;
+	}
+	if (delay < DAEMON_POLLING_MIN) {
+		return DAEMON_POLLING_MIN;
+	}
+	if (delay > DAEMON_POLLING_MAX) {
+		return DAEMON_POLLING_MAX;
+	}
+
+	return delay;
+}
+
+/*
+ * arm the sampling timer with a period of ms, or disarm it with 0
+ */
+static int timer_set_period(int fd, int ms)
+{
+	struct itimerspec its;
+
+	its.it_interval.tv_sec = ms / 1000;
+	its.it_interval.tv_nsec = (ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+
+	return timerfd_settime(fd, 0, &its, NULL);
+}
+
+/*
+ * create the shared ring and the socket the HAL asks for it on
+ */
+static int channel_init(void)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+
+	fd_chan_mem = ashmem_create_region("memsicd-channel", sizeof(*chan));
+	if (fd_chan_mem < 0) {
+		return -1;
+	}
+	chan = mmap(NULL, sizeof(*chan), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd_chan_mem, 0);
+	if (chan == MAP_FAILED) {
+		chan = NULL;
+		goto err_mem;
+	}
+	memset(chan, 0, sizeof(*chan));
+	chan->magic = SENSORS_CHANNEL_MAGIC;
+	chan->version = SENSORS_CHANNEL_VERSION;
+	chan->records = SENSORS_CHANNEL_RECORDS;
+	// clients get to map it read only
+	ashmem_set_prot_region(fd_chan_mem, PROT_READ);
+
+	fd_chan_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd_chan_listen < 0) {
+		goto err_map;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path + 1, SENSORS_CHANNEL_SOCKET);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(SENSORS_CHANNEL_SOCKET);
+	if (bind(fd_chan_listen, (struct sockaddr *)&addr, len) ||
+	    listen(fd_chan_listen, 1)) {
+		goto err_sock;
+	}
+	fcntl(fd_chan_listen, F_SETFL, O_NONBLOCK);
+
+	return 0;
+
+err_sock:
+	close(fd_chan_listen);
+	fd_chan_listen = -1;
+err_map:
+	munmap(chan, sizeof(*chan));
+	chan = NULL;
+err_mem:
+	close(fd_chan_mem);
+	fd_chan_mem = -1;
+	return -1;
+}
+
+/*
+ * socket the HAL kicks when it changed a flag or the delay, see
+ * SENSORS_CHANNEL_KICK
+ */
+static int control_kick_init(void)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+
+	fd_kick = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd_kick < 0) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path + 1, SENSORS_CHANNEL_KICK);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(SENSORS_CHANNEL_KICK);
+	if (bind(fd_kick, (struct sockaddr *)&addr, len)) {
+		close(fd_kick);
+		fd_kick = -1;
+		return -1;
+	}
+	fcntl(fd_kick, F_SETFL, O_NONBLOCK);
+
+	return 0;
+}
+
+static void channel_close_client(void)
+{
+	if (fd_chan_client >= 0) {
+		close(fd_chan_client);
+		fd_chan_client = -1;
+	}
+	if (fd_chan_bell >= 0) {
+		close(fd_chan_bell);
+		fd_chan_bell = -1;
+	}
+}
+
+/*
+ * hand the ring and a fresh doorbell to a new client; there is one
+ * sensor HAL, a new connection replaces the previous one
+ */
+static void channel_accept(void)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	char ver = SENSORS_CHANNEL_VERSION;
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+	int fds[2];
+	int fd, bell;
+
+	fd = accept(fd_chan_listen, NULL, NULL);
+	if (fd < 0) {
+		return;
+	}
+	// the abstract socket is open to every process: only the sensor
+	// service (or root) may take over the channel
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) ||
+	    (cred.uid != CHANNEL_UID_SYSTEM && cred.uid != 0)) {
+		memsicd_log("channel: refused pid %d\n", cred_len == sizeof(cred) ? cred.pid : -1);
+		close(fd);
+		return;
+	}
+	bell = eventfd(0, 0);
+	if (bell < 0) {
+		close(fd);
+		return;
+	}
+	fcntl(bell, F_SETFL, O_NONBLOCK);
+
+	fds[0] = fd_chan_mem;
+	fds[1] = bell;
+	iov.iov_base = &ver;
+	iov.iov_len = sizeof(ver);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(ver)) {
+		memsicd_log("channel: send fds failed (%s)\n", strerror(errno));
+		close(bell);
+		close(fd);
+		return;
+	}
+
+	channel_close_client();
+	fd_chan_client = fd;
+	fd_chan_bell = bell;
+	memsicd_log("channel: client connected\n");
+}
+
+/*
+ * publish one sample to the connected client
+ * return 0 if it went through the ring, -1 if there is no client
+ */
+static int channel_post(int sensors, const int *val, int64_t timestamp)
+{
+	struct sensors_channel_record *rec;
+	uint64_t one = 1;
+
+	if (fd_chan_client < 0) {
+		return -1;
+	}
+
+	rec = &SENSORS_CHANNEL_AT(chan, chan->head);
+	rec->timestamp = timestamp;
+	rec->sensors = sensors;
+	memcpy(rec->val, val, sizeof(rec->val));
+	// the record must be complete before the reader can see it
+	__sync_synchronize();
+	chan->head++;
+
+	write(fd_chan_bell, &one, sizeof(one));
+
+	return 0;
+}
+
+/*
+ * sleep until the next sample is due (active) or until the sensor flags
+ * or the delay change. The HAL kicks fd_kick after changing them; a
+ * control driver may also raise POLLPRI. Other writers of the flags are
+ * only noticed when the idle wait times out every DAEMON_IDLE_INTV.
+ * Channel clients are served from here too.
+ */
+static void memsicd_wait(int delay)
+{
+	struct pollfd fds[5];
+	uint64_t expirations;
+	char c;
+	ssize_t n;
+	int nfds = 0;
+	int timeout = -1;
+	int timer = -1, server = -1, client = -1, kick = -1;
+
+	if (delay && fd_timer < 0) {
+		usleep(delay * 1000);
+		return;
+	}
+
+	fds[nfds].fd = fd_ctrl;
+	fds[nfds].events = POLLPRI;
+	fds[nfds].revents = 0;
+	nfds++;
+	if (delay) {
+		timer = nfds;
+		fds[nfds].fd = fd_timer;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		nfds++;
+	} else {
+		timeout = DAEMON_IDLE_INTV;
+	}
+	if (fd_kick >= 0) {
+		kick = nfds;
+		fds[nfds].fd = fd_kick;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		nfds++;
+	}
+	if (fd_chan_listen >= 0) {
+		server = nfds;
+		fds[nfds].fd = fd_chan_listen;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		nfds++;
+	}
+	if (fd_chan_client >= 0) {
+		client = nfds;
+		fds[nfds].fd = fd_chan_client;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		nfds++;
+	}
+
+	while (1) {
+		if (poll(fds, nfds, timeout) < 0) {
+			if (errno != EINTR) {
+				usleep(DAEMON_POLLING_INTV * 1000);
+			}
+			return;
+		}
+		if (client >= 0 && fds[client].revents &&
+		    fds[client].fd == fd_chan_client) {
+			// the client never writes, so this is a hang up
+			n = recv(fd_chan_client, &c, sizeof(c), MSG_DONTWAIT);
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+				memsicd_log("channel: client gone\n");
+				channel_close_client();
+				fds[client].fd = -1;
+			}
+		}
+		if (server >= 0 && (fds[server].revents & POLLIN)) {
+			channel_accept();
+			// watch the new client from the next poll on
+			if (fd_chan_client >= 0) {
+				if (client < 0) {
+					client = nfds++;
+				}
+				fds[client].fd = fd_chan_client;
+				fds[client].events = POLLIN;
+				fds[client].revents = 0;
+			}
+		}
+		if (kick >= 0 && (fds[kick].revents & POLLIN)) {
+			while (recv(fd_kick, &c, sizeof(c), MSG_DONTWAIT) >= 0)
+				;
+			break;
+		}
+		if (timer < 0 || (fds[timer].revents & POLLIN) ||
+		    (fds[0].revents & POLLPRI)) {
+			break;
+		}
+		// only the channel woke us up, keep the sampling period
+	}
+	if (timer >= 0 && (fds[timer].revents & POLLIN)) {
+		read(fd_timer, &expirations, sizeof(expirations));
+	}
+}
+
+static void ecompass_cal_load(struct ecompass_cal_t *cal,
+	const int *offset, const int *sensit, int dir)
+{
+	coordinate_raw_to_real_matrix(cal->ids, coordinate_real_to_ids, offset, sensit, dir);
+	coordinate_raw_to_real_matrix(cal->android, coordinate_real_to_android, offset, sensit, dir);
+}
+
 static int ecompass_init()
 {
+	struct SensorData_Raw raw;
+
+	// offsets may have been rewritten by the calibration tool since the
+	// last time, so this runs every time sensors get enabled
+	dev_acc->get_offset(fd_acc, raw.off_a);
+	dev_acc->get_sensitivity(fd_acc, raw.sens_a);
+	raw.dir_a = dev_acc->get_install_dir();
+	ecompass_cal_load(&cal_acc, raw.off_a, raw.sens_a, raw.dir_a);
+
+	dev_mag->get_offset(fd_mag, raw.off_m);
+	dev_mag->get_sensitivity(fd_mag, raw.sens_m);
+	raw.dir_m = dev_mag->get_install_dir();
+	ecompass_cal_load(&cal_mag, raw.off_m, raw.sens_m, raw.dir_m);
+
 	return 0;
 } 
 
@@ -241,34 +614,26 @@ static int ecompass_poll(int state)
 	float mag_cald[3] = {0.0, 0.0, 0.0};
 	float mag_off[3] = {0.0, 0.0, 0.0};
 	static int val[12];
+	int64_t timestamp;
 
 	struct SensorData_Raw raw;	// raw sensor data collection
-	struct SensorData_Real real_d;	// real data for sensor device coordinate
 	struct SensorData_Real real_a;	// real data for android coordinate
 	struct SensorData_Real real_i;	// real data for ids coordinate
-	struct SensorData_Algo sva;	// sensor vector for algorithm
 
 	struct SensorData_Orientation orien;
 
 	if (state & SENSORS_ACCELERATION || state & SENSORS_MAGNETIC_FIELD || state & SENSORS_ORIENTATION) {
-		/* read raw data from acc-sensor */
-		if(dev_acc->read_data(fd_acc, raw.acc)){
+		/* read raw data from acc-sensor, and mag-sensor along with it */
+		if (sensors_read_sample(dev_acc, fd_acc,
+			(state & (SENSORS_MAGNETIC_FIELD | SENSORS_ORIENTATION)) ? dev_mag : NULL,
+			fd_mag, raw.acc, raw.mag, &timestamp)) {
 			return -1;
 		}
-		dev_acc->get_offset(fd_acc, raw.off_a);
-		dev_acc->get_sensitivity(fd_acc, raw.sens_a);
-		raw.dir_a = dev_acc->get_install_dir();
-
-		// acceleration in unit G (GRAVITY_EARTH)
-		real_d.acc[0] = ACC_UNIFY(raw.acc[0], raw.off_a[0], raw.sens_a[0]);
-		real_d.acc[1] = ACC_UNIFY(raw.acc[1], raw.off_a[1], raw.sens_a[1]);
-		real_d.acc[2] = ACC_UNIFY(raw.acc[2], raw.off_a[2], raw.sens_a[2]);
-
-		// convert data to ids coordinate system
-		coordinate_real_to_ids(real_i.acc, real_d.acc, raw.dir_a);
 
-		// convert data to android coordinate system
-		coordinate_real_to_android(real_a.acc, real_d.acc, raw.dir_a);
+		// acceleration in unit G (GRAVITY_EARTH), in ids and android
+		// coordinate system
+		coordinate_apply_matrix(real_i.acc, cal_acc.ids, raw.acc);
+		coordinate_apply_matrix(real_a.acc, cal_acc.android, raw.acc);
 
 		val[0] = ACC_NORM2(real_a.acc[0]);
 		val[1] = ACC_NORM2(real_a.acc[1]);
@@ -277,48 +642,29 @@ static int ecompass_poll(int state)
 	}
 
 	if (state & SENSORS_MAGNETIC_FIELD || state & SENSORS_ORIENTATION) {
-		/* read raw data from mag-sensor */
-		if (dev_mag->read_data(fd_mag, raw.mag)){
-			return -1;
-		}
-		dev_mag->get_offset(fd_mag, raw.off_m);
-		dev_mag->get_sensitivity(fd_mag, raw.sens_m);
-		raw.dir_m = dev_mag->get_install_dir();
-
-		// magnetic in unit Guass
-		real_d.mag[0] = MAG_UNIFY(raw.mag[0], raw.off_m[0], raw.sens_m[0]);
-		real_d.mag[1] = MAG_UNIFY(raw.mag[1], raw.off_m[1], raw.sens_m[1]);
-		real_d.mag[2] = MAG_UNIFY(raw.mag[2], raw.off_m[2], raw.sens_m[2]);
+		// magnetic in unit Guass, in ids and android coordinate system
+		coordinate_apply_matrix(real_i.mag, cal_mag.ids, raw.mag);
+		coordinate_apply_matrix(real_a.mag, cal_mag.android, raw.mag);
 
-		// convert data to ids coordinate system
-		coordinate_real_to_ids(real_i.mag, real_d.mag, raw.dir_m);
+		// calibrated magnetic field, ecompass calibration, orientation;
+		// shared with the replay tool
+		sensors_algo_fuse(algo, &real_i, mag_cald, &orien);
 
-		// convert data to android coordinate system
-		coordinate_real_to_android(real_a.mag, real_d.mag, raw.dir_m);
-
-		ids_degree_real_to_algo(&sva, &real_i);
-		algo->calc_magcal_data(&sva, mag_cald);
 		val[4] = MAG_NORM2(mag_cald[0]);
 		val[5] = MAG_NORM2(mag_cald[1]);
 		val[6] = MAG_NORM2(mag_cald[2]);
 		val[7] = SENSOR_STATUS_ACCURACY_HIGH;
-	}
-	if (state & SENSORS_MAGNETIC_FIELD || state & SENSORS_ORIENTATION) {
-		// prepare data for calibration
-		ids_degree_real_to_algo(&sva, &real_i);
-		// ecompass calibration
-		algo->data_in(&sva);
-		algo->calibrate(&sva);
-		// calculate orientation
-		algo->calc_orientation(&orien, &sva);
-
 		val[8] = orien.azimuth;
 		val[9] = orien.pitch;
 		val[10] = orien.roll;
 		val[11] = orien.quality;
 	}
 
-	res = ioctl(fd_ctrl, ECOMPASS_IOC_SET_YPR, val);
+	// through the kernel input device only when the HAL isn't on the channel
+	res = channel_post(state, val, timestamp);
+	if (res) {
+		res = ioctl(fd_ctrl, ECOMPASS_IOC_SET_YPR, val);
+	}
 #if 0
 	if (state & SENSORS_ACCELERATION || state & SENSORS_MAGNETIC_FIELD || state & SENSORS_ORIENTATION) {
 		pr_trace("+Acc Raw Data, [x: %04d] [y: %04d] [z: %04d], [dir: %d]\n",raw.acc[0], raw.acc[1], raw.acc[2], raw.dir_a);
@@ -338,7 +684,8 @@ static int ecompass_poll(int state)
 int main(void)
 {
 	int stat_curr = 0, stat_prev = 0;
-	int store_count = 0;
+	int delay_curr = 0, delay;
+	int store_elapse = 0;
 
 	if (memsicd_init() == -1) {
 		memsicd_log("can't fork self\n");
@@ -386,16 +733,22 @@ int main(void)
 		return -1;
 	}
 
-	ecompass_init();
-	while (1) {
-		struct timeval tv_begin;
-		struct timeval tv_now;
-		unsigned int usec_elapse = 0;	/* usec */ 
-
-		gettimeofday (&tv_begin, NULL);
+	fd_timer = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (fd_timer < 0) {
+		memsicd_log("timerfd create failed, fall back to sleep\n");
+	}
+	if (channel_init()) {
+		memsicd_log("channel init failed, report through ecs_ctrl only\n");
+	}
+	if (control_kick_init()) {
+		memsicd_log("kick socket failed, flag changes wait for the idle timeout\n");
+	}
 
+	ecompass_init();
+	while (!memsicd_stop) {
 		stat_curr = control_read_sensors_state(fd_ctrl);
 		if (!stat_prev && stat_curr) {
+			ecompass_init();
 			// make sure init algo before open
 			algo->init();
 			algo->open();
@@ -407,13 +760,27 @@ int main(void)
 		stat_prev = stat_curr;
 
 		if (stat_curr) {
+			// follow the rate the HAL asked for
+			delay = control_read_delay(fd_ctrl);
+			if (delay != delay_curr) {
+				if (fd_timer >= 0) {
+					timer_set_period(fd_timer, delay);
+				}
+				delay_curr = delay;
+			}
+
 			ecompass_poll(stat_curr);
 
-			store_count++;
-			if (store_count >= (DAEMON_NVM_STORE_INTV / DAEMON_POLLING_INTV)) {
+			store_elapse += delay_curr;
+			if (store_elapse >= DAEMON_NVM_STORE_INTV) {
 				algo->nvm_store();
-				store_count = 0;
+				store_elapse = 0;
+			}
+		} else if (delay_curr) {
+			if (fd_timer >= 0) {
+				timer_set_period(fd_timer, 0);
 			}
+			delay_curr = 0;
 		}
 
 		if (algo->get_state()) {
@@ -421,15 +788,16 @@ int main(void)
 			algo->restart();
 		}
 
-		gettimeofday (&tv_now, NULL);
-		usec_elapse = (tv_now.tv_sec - tv_begin.tv_sec) * 1000000 + tv_now.tv_usec - tv_begin.tv_usec;
-		//pr_trace("time:%d\n",usec_elapse);
-		if (usec_elapse >= DAEMON_POLLING_INTV * 1000) {
-			usleep(1000);
-		} else {
-			usleep(DAEMON_POLLING_INTV * 1000 - usec_elapse);
-		}
+		memsicd_wait(delay_curr);
+	}
+
+	/* catched signal */
+	if (stat_prev) {
+		algo->close();
 	}
+	memsicd_abort();
+	memsicd_log("signal: %d\n", memsicd_stop);
+	memsicd_log("memsicd stopped\n");
 
 	return 0;
 }
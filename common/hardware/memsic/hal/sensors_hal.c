@@ -30,7 +30,12 @@
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <linux/input.h>
 
@@ -40,6 +45,8 @@
 #include <cutils/atomic.h>
 #include <utils/Log.h>
 
+#include <sensors_channel.h>
+
 
 #define SENSORS_HAL_DEBUG		1
 
@@ -65,6 +72,16 @@
 
 #define ECS_CTRL_DEV_NAME		"/dev/ecompass_ctrl"
 
+#define INPUT_EVENT_NUM			64	// events read at a time
+#define SAMPLE_QUEUE_SIZE		(16 * SENSORS_SUPPORT_COUNT)
+#define CHANNEL_RETRY_INTV		1000	// ms
+#define CHANNEL_HANDSHAKE_TIMEOUT	200	// ms
+
+// linux 3.4, older kernel headers lack it
+#ifndef EVIOCSCLOCKID
+#define EVIOCSCLOCKID			_IOW('E', 0xa0, int)
+#endif
+
 
 #define EVENT_TYPE_ACCEL_X		ABS_X
 #define EVENT_TYPE_ACCEL_Y		ABS_Y
@@ -123,6 +140,7 @@
 
 /* IOCTLs for ECOMPASS device */
 #define ECOMPASS_IOC_SET_MODE		_IOW(ECOMPASS_IOM, 0x00, short)
+/* sampling interval in ms; it used to be us, which a short caps at 32 ms */
 #define ECOMPASS_IOC_SET_DELAY		_IOW(ECOMPASS_IOM, 0x01, short)
 #define ECOMPASS_IOC_GET_DELAY		_IOR(ECOMPASS_IOM, 0x02, short)
 
@@ -155,9 +173,28 @@ struct sensors_poll_context_t {
 	struct sensors_poll_device_t	device;
 	int				ecs_fd;
 	int				events_fd;
+	int				events_realtime;	// evdev stamps are CLOCK_REALTIME
 	uint32_t			active_sensors;
-	uint32_t			pending_sensors;
+	uint32_t			new_sensors;	// updated since last EV_SYN
+	int64_t				delay_ns[SENSORS_SUPPORT_COUNT];	// per handle
+	uint32_t			delay_set;	// handles with a delay_ns, 1 << (handle - SENSORS_HANDLE_BASE)
 	sensors_event_t			sensors[SENSORS_SUPPORT_COUNT];
+
+	struct input_event		events[INPUT_EVENT_NUM];
+	int				event_pos;
+	int				event_count;
+
+	// complete samples not handed out yet
+	sensors_event_t			queue[SAMPLE_QUEUE_SIZE];
+	int				queue_head;
+	int				queue_count;
+
+	// shared memory channel from memsicd, only touched by the poll thread
+	const struct sensors_channel_t	*chan;
+	int				chan_fd;	// hangs up with memsicd
+	int				chan_bell;
+	uint32_t			chan_tail;
+	int64_t				chan_retry;	// next connect attempt
 };
 
 static int sSensorAccr[SENSORS_SUPPORT_COUNT] = {0, 0, 0};	// default: SENSOR_STATUS_UNRELIABLE
@@ -425,38 +462,448 @@ static uint32_t control_read_sensors_state(int fd)
 	return sensors;
 }
 
+static int64_t data_get_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/*
+ * CLOCK_MONOTONIC - CLOCK_REALTIME in ns, for kernels whose evdev can
+ * only stamp events with the wall clock
+ */
+static int64_t data_realtime_offset(void)
+{
+	struct timespec mono, real;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	return (mono.tv_sec - real.tv_sec) * 1000000000LL +
+		(mono.tv_nsec - real.tv_nsec);
+}
+
+static void channel_close(struct sensors_poll_context_t *dev)
+{
+	if (dev->chan) {
+		munmap((void *)dev->chan, sizeof(*dev->chan));
+		dev->chan = NULL;
+	}
+	if (dev->chan_bell >= 0) {
+		close(dev->chan_bell);
+		dev->chan_bell = -1;
+	}
+	if (dev->chan_fd >= 0) {
+		close(dev->chan_fd);
+		dev->chan_fd = -1;
+	}
+}
+
+/*
+ * ask memsicd for the shared ring, see sensors_channel.h.
+ * Without it the samples keep coming through the input device.
+ */
+static int channel_open(struct sensors_poll_context_t *dev)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	struct timeval tv;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	char ver;
+	int fds[2] = {-1, -1};
+	void *mem;
+
+	dev->chan_retry = data_get_ms() + CHANNEL_RETRY_INTV;
+
+	dev->chan_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (dev->chan_fd < 0) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path + 1, SENSORS_CHANNEL_SOCKET);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(SENSORS_CHANNEL_SOCKET);
+	if (connect(dev->chan_fd, (struct sockaddr *)&addr, len)) {
+		goto err;
+	}
+	// a stuck memsicd must not hang the sensor service in open()
+	tv.tv_sec = 0;
+	tv.tv_usec = CHANNEL_HANDSHAKE_TIMEOUT * 1000;
+	setsockopt(dev->chan_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	iov.iov_base = &ver;
+	iov.iov_len = sizeof(ver);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	if (recvmsg(dev->chan_fd, &msg, 0) != sizeof(ver)) {
+		goto err;
+	}
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		goto err;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	dev->chan_bell = fds[1];
+
+	mem = mmap(NULL, sizeof(*dev->chan), PROT_READ, MAP_SHARED, fds[0], 0);
+	close(fds[0]);
+	if (mem == MAP_FAILED) {
+		goto err;
+	}
+	dev->chan = (const struct sensors_channel_t *)mem;
+	if (ver != SENSORS_CHANNEL_VERSION ||
+	    dev->chan->magic != SENSORS_CHANNEL_MAGIC ||
+	    dev->chan->version != SENSORS_CHANNEL_VERSION ||
+	    dev->chan->records != SENSORS_CHANNEL_RECORDS) {
+		LOGE("%s: memsicd channel mismatch", __FUNCTION__);
+		goto err;
+	}
+	dev->chan_tail = dev->chan->head;
+
+	LOGD("Using memsicd channel");
+	return 0;
+
+err:
+	channel_close(dev);
+	return -1;
+}
+
+static int data_fill_events(struct sensors_poll_context_t *dev)
+{
+	ssize_t n;
+
+	do {
+		n = read(dev->events_fd, dev->events, sizeof(dev->events));
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		LOGE("%s: read error (%s)", __FUNCTION__, strerror(errno));
+		return -errno;
+	}
+	if (n % sizeof(struct input_event)) {
+		LOGE("%s: partial event, %d bytes", __FUNCTION__, (int)n);
+	}
+
+	dev->event_pos = 0;
+	dev->event_count = n / sizeof(struct input_event);
+
+	return dev->event_count;
+}
+
+static void data_queue_sensors(struct sensors_poll_context_t *dev,
+	uint32_t sensors, int64_t t)
+{
+	while (sensors) {
+		uint32_t i = 31 - __builtin_clz(sensors);
+		sensors &= ~(1 << i);
+		dev->sensors[i].timestamp = t;
+		dev->queue[(dev->queue_head + dev->queue_count) % SAMPLE_QUEUE_SIZE] =
+			dev->sensors[i];
+		dev->queue_count++;
+	}
+}
+
+/*
+ * Feed one input event into the samples being assembled.
+ * Returns 1 when it was consumed, 0 when it has to wait for the queue
+ * to drain, and -1 for the wake-up event.
+ */
+static int data_assemble_event(struct sensors_poll_context_t *dev,
+	const struct input_event *event)
+{
+	LOGD_IF(0, "type: %d code: %d value: %-5d time: %ds-%dns",
+		event->type, event->code, event->value,
+		(int)event->time.tv_sec, (int)event->time.tv_usec);
+
+	if (event->type == EV_ABS) {
+		switch (event->code) {
+		#ifdef GSENSOR_XY_REVERT
+		case EVENT_TYPE_ACCEL_Y:
+			dev->new_sensors |= SENSORS_ACCELERATION;
+			dev->sensors[ID_A].acceleration.x = event->value * CONVERT_A_Y;
+			break;
+		case EVENT_TYPE_ACCEL_X:
+			dev->new_sensors |= SENSORS_ACCELERATION;
+			dev->sensors[ID_A].acceleration.y = event->value * CONVERT_A_X;
+			break;
+		#else
+		case EVENT_TYPE_ACCEL_X:
+			dev->new_sensors |= SENSORS_ACCELERATION;
+			dev->sensors[ID_A].acceleration.x = event->value * CONVERT_A_X;
+			break;
+		case EVENT_TYPE_ACCEL_Y:
+			dev->new_sensors |= SENSORS_ACCELERATION;
+			dev->sensors[ID_A].acceleration.y = event->value * CONVERT_A_Y;
+			break;
+		#endif
+		case EVENT_TYPE_ACCEL_Z:
+			dev->new_sensors |= SENSORS_ACCELERATION;
+			dev->sensors[ID_A].acceleration.z = event->value * CONVERT_A_Z;
+			break;
+
+		case EVENT_TYPE_MAGV_X:
+			dev->new_sensors |= SENSORS_MAGNETIC_FIELD;
+			dev->sensors[ID_M].magnetic.x = event->value * CONVERT_M_X;
+			break;
+		case EVENT_TYPE_MAGV_Y:
+			dev->new_sensors |= SENSORS_MAGNETIC_FIELD;
+			dev->sensors[ID_M].magnetic.y = event->value * CONVERT_M_Y;
+			break;
+		case EVENT_TYPE_MAGV_Z:
+			dev->new_sensors |= SENSORS_MAGNETIC_FIELD;
+			dev->sensors[ID_M].magnetic.z = event->value * CONVERT_M_Z;
+			break;
+
+		case EVENT_TYPE_ORIENT_YAW:
+			dev->new_sensors |= SENSORS_ORIENTATION;
+			dev->sensors[ID_O].orientation.azimuth =  event->value * CONVERT_O_Y;
+			break;
+		case EVENT_TYPE_ORIENT_PITCH:
+			dev->new_sensors |= SENSORS_ORIENTATION;
+			dev->sensors[ID_O].orientation.pitch = event->value * CONVERT_O_P;
+			break;
+		case EVENT_TYPE_ORIENT_ROLL:
+			dev->new_sensors |= SENSORS_ORIENTATION;
+			dev->sensors[ID_O].orientation.roll = event->value * CONVERT_O_R;
+			break;
+
+		case EVENT_TYPE_ACCEL_STATUS:
+			// accuracy of the acceleration
+			dev->sensors[ID_A].acceleration.status = event->value;
+			sSensorAccr[ID_A] = dev->sensors[ID_A].acceleration.status;
+			break;
+		case EVENT_TYPE_MAGV_STATUS:
+			// accuracy of the magnetic sensor
+			dev->sensors[ID_M].magnetic.status = event->value;
+			sSensorAccr[ID_M] = dev->sensors[ID_M].magnetic.status;
+			break;
+		case EVENT_TYPE_ORIENT_STATUS:
+			// accuracy of the ecompass calibration
+			dev->sensors[ID_O].orientation.status = event->value;
+			sSensorAccr[ID_O] = dev->sensors[ID_O].orientation.status;
+			break;
+		default:
+			break;
+		}
+	} else if (event->type == EV_SYN) {
+		if (event->code == SYN_CONFIG) {
+			// we use SYN_CONFIG to signal that we need to exit the
+			// main loop, once the samples before it are out.
+			return dev->queue_count ? 0 : -1;
+		}
+		if (dev->new_sensors) {
+			if (dev->queue_count + SENSORS_SUPPORT_COUNT > SAMPLE_QUEUE_SIZE) {
+				return 0;
+			}
+			int64_t timestamp = event->time.tv_sec * 1000000000LL +
+				event->time.tv_usec * 1000;
+			if (dev->events_realtime) {
+				timestamp += data_realtime_offset();
+			}
+			data_queue_sensors(dev, dev->new_sensors, timestamp);
+			dev->new_sensors = 0;
+		}
+	}
+
+	return 1;
+}
+
+static void data_apply_record(struct sensors_poll_context_t *dev,
+	const struct sensors_channel_record *rec)
+{
+	uint32_t sensors = rec->sensors & dev->active_sensors;
+
+	if (sensors & SENSORS_ACCELERATION) {
+	#ifdef GSENSOR_XY_REVERT
+		dev->sensors[ID_A].acceleration.x = rec->val[1] * CONVERT_A_Y;
+		dev->sensors[ID_A].acceleration.y = rec->val[0] * CONVERT_A_X;
+	#else
+		dev->sensors[ID_A].acceleration.x = rec->val[0] * CONVERT_A_X;
+		dev->sensors[ID_A].acceleration.y = rec->val[1] * CONVERT_A_Y;
+	#endif
+		dev->sensors[ID_A].acceleration.z = rec->val[2] * CONVERT_A_Z;
+		dev->sensors[ID_A].acceleration.status = rec->val[3];
+		sSensorAccr[ID_A] = rec->val[3];
+	}
+	if (sensors & SENSORS_MAGNETIC_FIELD) {
+		dev->sensors[ID_M].magnetic.x = rec->val[4] * CONVERT_M_X;
+		dev->sensors[ID_M].magnetic.y = rec->val[5] * CONVERT_M_Y;
+		dev->sensors[ID_M].magnetic.z = rec->val[6] * CONVERT_M_Z;
+		dev->sensors[ID_M].magnetic.status = rec->val[7];
+		sSensorAccr[ID_M] = rec->val[7];
+	}
+	if (sensors & SENSORS_ORIENTATION) {
+		dev->sensors[ID_O].orientation.azimuth = rec->val[8] * CONVERT_O_Y;
+		dev->sensors[ID_O].orientation.pitch = rec->val[9] * CONVERT_O_P;
+		dev->sensors[ID_O].orientation.roll = rec->val[10] * CONVERT_O_R;
+		dev->sensors[ID_O].orientation.status = rec->val[11];
+		sSensorAccr[ID_O] = rec->val[11];
+	}
+
+	data_queue_sensors(dev, sensors, rec->timestamp);
+}
+
+/*
+ * move the records memsicd published since the last call into the queue,
+ * as far as the queue takes them
+ */
+static void data_read_channel(struct sensors_poll_context_t *dev)
+{
+	const struct sensors_channel_t *chan = dev->chan;
+	struct sensors_channel_record rec;
+	uint32_t head;
+
+	while (dev->queue_count + SENSORS_SUPPORT_COUNT <= SAMPLE_QUEUE_SIZE) {
+		head = chan->head;
+		__sync_synchronize();
+		if (head == dev->chan_tail) {
+			break;
+		}
+		// memsicd may already be filling the record after head, so
+		// one is only safe while it is less than records - 1 behind
+		if (head - dev->chan_tail >= SENSORS_CHANNEL_RECORDS - 1) {
+			LOGW("%s: lost %u records", __FUNCTION__,
+				head - dev->chan_tail - SENSORS_CHANNEL_RECORDS + 2);
+			dev->chan_tail = head - SENSORS_CHANNEL_RECORDS + 2;
+			continue;
+		}
+
+		rec = SENSORS_CHANNEL_AT(chan, dev->chan_tail);
+		__sync_synchronize();
+		if (chan->head - dev->chan_tail >= SENSORS_CHANNEL_RECORDS - 1) {
+			continue;	// overwritten while we copied it
+		}
+		dev->chan_tail++;
+
+		data_apply_record(dev, &rec);
+	}
+}
+
+/*
+ * block until there is something new to look at: input events, which
+ * are read into the buffer, or channel records
+ */
+static int data_wait(struct sensors_poll_context_t *dev)
+{
+	struct pollfd fds[3];
+	uint64_t bells;
+
+	if (!dev->chan && data_get_ms() >= dev->chan_retry) {
+		channel_open(dev);
+	}
+	if (!dev->chan) {
+		return data_fill_events(dev);
+	}
+
+	fds[0].fd = dev->events_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = dev->chan_bell;
+	fds[1].events = POLLIN;
+	fds[2].fd = dev->chan_fd;
+	fds[2].events = POLLIN;
+	fds[0].revents = fds[1].revents = fds[2].revents = 0;
+
+	if (poll(fds, 3, -1) < 0) {
+		return (errno == EINTR) ? 0 : -errno;
+	}
+	if (fds[1].revents & POLLIN) {
+		read(dev->chan_bell, &bells, sizeof(bells));
+	}
+	if (fds[2].revents) {
+		// memsicd went away, it reports through the input device again
+		LOGW("%s: memsicd channel closed", __FUNCTION__);
+		data_read_channel(dev);
+		channel_close(dev);
+	}
+	if (fds[0].revents & POLLIN) {
+		return data_fill_events(dev);
+	}
+
+	return 0;
+}
+
 static int data_pick_sensors(struct sensors_poll_context_t *dev, 
     sensors_event_t* data, int count)
 {
-	uint32_t mask = SUPPORTED_SENSORS;
 	int num = 0;
 
-	while (mask) {
-		uint32_t i = 31 - __builtin_clz(mask);
-		mask &= ~(1 << i);
-		if (dev->pending_sensors & (1 << i)) {
-			dev->pending_sensors &= ~(1 << i);
-			data[num] = dev->sensors[i];
-			LOGD_IF(0, "%s: %d-%d [%f, %f, %f], sensor: %d, type: %d", 
-				__FUNCTION__, num, i,
-				data[num].data[0], data[num].data[1], data[num].data[2],
-				data[num].sensor, data[num].type);
-			num++;
-			if (num >= count) {
-				goto FINISH;
-			}
+	while (num < count && dev->queue_count) {
+		data[num] = dev->queue[dev->queue_head];
+		LOGD_IF(0, "%s: %d [%f, %f, %f], sensor: %d, type: %d", 
+			__FUNCTION__, num,
+			data[num].data[0], data[num].data[1], data[num].data[2],
+			data[num].sensor, data[num].type);
+		dev->queue_head = (dev->queue_head + 1) % SAMPLE_QUEUE_SIZE;
+		dev->queue_count--;
+		num++;
+	}
+
+	return num;
+}
+
+/*
+ * memsicd runs all sensors at one rate: give it the shortest delay asked
+ * for by the enabled sensors, so that one sensor slowing down doesn't
+ * starve another.
+ */
+static int control_apply_delay(struct sensors_poll_context_t *dev)
+{
+	int64_t ns = -1;
+	int i;
+
+	if (dev->ecs_fd < 0) {
+		return 0;
+	}
+	for (i = 0; i < SENSORS_SUPPORT_COUNT; i++) {
+		if (!(dev->active_sensors & (1 << (SENSORS_HANDLE_BASE + i))) ||
+		    !(dev->delay_set & (1 << i))) {
+			continue;
+		}
+		if (ns < 0 || dev->delay_ns[i] < ns) {
+			ns = dev->delay_ns[i];
 		}
 	}
+	if (ns < 0) {
+		return 0;
+	}
 
-	if (num == 0) {
-		LOGE("No sensor to return! pending_sensors=%08x", dev->pending_sensors);
-		// we may end-up in a busy loop, slow things down, just in case.
-		usleep(100000);
-		return -1;
+	// memsicd samples at this interval, in ms, and clamps it to the range
+	// it supports: 0 (SENSOR_DELAY_FASTEST) runs at its shortest interval
+	short delay = (ns / 1000000 > SHRT_MAX) ? SHRT_MAX : ns / 1000000;
+	if (ioctl(dev->ecs_fd, ECOMPASS_IOC_SET_DELAY, &delay) < 0) {
+		return -errno;
 	}
 
-FINISH:
-	return num;
+	return 0;
+}
+
+/*
+ * tell memsicd the flags or the delay changed, see SENSORS_CHANNEL_KICK.
+ * Best effort: without it memsicd notices at its next idle timeout.
+ */
+static void control_kick(void)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path + 1, SENSORS_CHANNEL_KICK);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(SENSORS_CHANNEL_KICK);
+	sendto(fd, "k", 1, MSG_DONTWAIT, (struct sockaddr *)&addr, len);
+	close(fd);
 }
 
 static int __control_activate(struct sensors_poll_device_t *device,
@@ -504,6 +951,10 @@ static int __control_activate(struct sensors_poll_device_t *device,
 
     dev->sensors[handle].orientation.status = sSensorAccr[handle];
 
+	// the rate may have been held down by the sensor just turned off
+	control_apply_delay(dev);
+	control_kick();
+
 	return 0;
 }
 
@@ -512,17 +963,25 @@ static int __control_set_delay(struct sensors_poll_device_t *device,
 {
 	struct sensors_poll_context_t *dev;
 	dev = (struct sensors_poll_context_t *)device;
-	LOGD("+%s: ns=%d", __FUNCTION__, (int)ns);
+	LOGD("+%s: handle=%d ns=%d", __FUNCTION__, handle, (int)ns);
 
-	if (dev->ecs_fd < 0) {
+	if ((handle < SENSORS_HANDLE_BASE) || 
+	    (handle >= SENSORS_HANDLE_BASE + SENSORS_SUPPORT_COUNT)) {
 		return -1;
 	}
-	short delay = ns / 1000;
-	if (!ioctl(dev->ecs_fd, ECOMPASS_IOC_SET_DELAY, &delay)) {
-		return -errno;
+
+	if (ns < 0) {
+		return -EINVAL;
 	}
 
-	return 0;
+	// kept per sensor, applied now or when the driver gets opened
+	dev->delay_ns[handle - SENSORS_HANDLE_BASE] = ns;
+	dev->delay_set |= 1 << (handle - SENSORS_HANDLE_BASE);
+
+	int ret = control_apply_delay(dev);
+	control_kick();
+
+	return ret;
 }
 
 static int __data_poll(struct sensors_poll_device_t *device, 
@@ -543,111 +1002,31 @@ static int __data_poll(struct sensors_poll_device_t *device,
 	LOGD_IF(0, "%s, sensors_event: %p, count: %d",
 		__FUNCTION__, data, count);
 
-	// there are pending sensors, returns them now...
-	if (dev->pending_sensors) {
-		return data_pick_sensors(dev, data, count);
-	}
-
-	// wait until we get a complete event for an enabled sensor
-	uint32_t new_sensors = 0;
 	while (1) {
-		/* read the next event */
-		struct input_event event;
-		if (read(fd, &event, sizeof(event)) != sizeof(event)) {
-			continue;
-		}
-		uint32_t v;
-		LOGD_IF(0, "type: %d code: %d value: %-5d time: %ds-%dns",
-			event.type, event.code, event.value,
-			(int)event.time.tv_sec, (int)event.time.tv_usec);
-		if (event.type == EV_ABS) {
-			switch (event.code) {
-			#ifdef GSENSOR_XY_REVERT
-			case EVENT_TYPE_ACCEL_Y:
-				new_sensors |= SENSORS_ACCELERATION;
-				dev->sensors[ID_A].acceleration.x = event.value * CONVERT_A_Y;
-				break;
-			case EVENT_TYPE_ACCEL_X:
-				new_sensors |= SENSORS_ACCELERATION;
-				dev->sensors[ID_A].acceleration.y = event.value * CONVERT_A_X;
-				break;			
-			#else
-			case EVENT_TYPE_ACCEL_X:
-				new_sensors |= SENSORS_ACCELERATION;
-				dev->sensors[ID_A].acceleration.x = event.value * CONVERT_A_X;
-				break;
-			case EVENT_TYPE_ACCEL_Y:
-				new_sensors |= SENSORS_ACCELERATION;
-				dev->sensors[ID_A].acceleration.y = event.value * CONVERT_A_Y;
-				break;
-			#endif
-			case EVENT_TYPE_ACCEL_Z:
-				new_sensors |= SENSORS_ACCELERATION;
-				dev->sensors[ID_A].acceleration.z = event.value * CONVERT_A_Z;
-				break;
-
-			case EVENT_TYPE_MAGV_X:
-				new_sensors |= SENSORS_MAGNETIC_FIELD;
-				dev->sensors[ID_M].magnetic.x = event.value * CONVERT_M_X;
-				break;
-			case EVENT_TYPE_MAGV_Y:
-				new_sensors |= SENSORS_MAGNETIC_FIELD;
-				dev->sensors[ID_M].magnetic.y = event.value * CONVERT_M_Y;
-				break;
-			case EVENT_TYPE_MAGV_Z:
-				new_sensors |= SENSORS_MAGNETIC_FIELD;
-				dev->sensors[ID_M].magnetic.z = event.value * CONVERT_M_Z;
-				break;
-
-			case EVENT_TYPE_ORIENT_YAW:
-				new_sensors |= SENSORS_ORIENTATION;
-				dev->sensors[ID_O].orientation.azimuth =  event.value * CONVERT_O_Y;
-				break;
-			case EVENT_TYPE_ORIENT_PITCH:
-				new_sensors |= SENSORS_ORIENTATION;
-				dev->sensors[ID_O].orientation.pitch = event.value * CONVERT_O_P;
-				break;
-			case EVENT_TYPE_ORIENT_ROLL:
-				new_sensors |= SENSORS_ORIENTATION;
-				dev->sensors[ID_O].orientation.roll = event.value * CONVERT_O_R;
-				break;
-
-			case EVENT_TYPE_ACCEL_STATUS:
-				// accuracy of the acceleration
-				dev->sensors[ID_A].acceleration.status = event.value;
-				sSensorAccr[ID_A] = dev->sensors[ID_A].acceleration.status;
-				break;
-			case EVENT_TYPE_MAGV_STATUS:
-				// accuracy of the magnetic sensor
-				dev->sensors[ID_M].magnetic.status = event.value;
-				sSensorAccr[ID_M] = dev->sensors[ID_M].magnetic.status;
-				break;
-			case EVENT_TYPE_ORIENT_STATUS:
-				// accuracy of the ecompass calibration
-				dev->sensors[ID_O].orientation.status = event.value;
-				sSensorAccr[ID_O] = dev->sensors[ID_O].orientation.status;
-				break;
-			default:
+		// assemble what was read already, as far as the queue takes it
+		while (dev->event_pos < dev->event_count) {
+			int res = data_assemble_event(dev, &dev->events[dev->event_pos]);
+			if (res == 0) {
 				break;
 			}
-		} else if (event.type == EV_SYN) {
-			if (event.code == SYN_CONFIG) {
-				// we use SYN_CONFIG to signal that we need to exit the
-				// main loop.
-				//LOGD("got empty message: value=%d", event.value);
+			dev->event_pos++;
+			if (res < 0) {
 				return 0x7FFFFFFF;
 			}
-			if (new_sensors) {
-				dev->pending_sensors = new_sensors;
-				int64_t t = event.time.tv_sec * 1000000000LL +
-						event.time.tv_usec * 1000;
-				while (new_sensors) {
-					uint32_t i = 31 - __builtin_clz(new_sensors);
-					new_sensors &= ~(1 << i);
-					dev->sensors[i].timestamp = t;
-				}
-				return data_pick_sensors(dev, data, count);
-			}
+		}
+		if (dev->chan) {
+			data_read_channel(dev);
+		}
+
+		int num = data_pick_sensors(dev, data, count);
+		if (num > 0 || !count) {
+			return num;
+		}
+
+		// wait until we get complete events for an enabled sensor
+		int res = data_wait(dev);
+		if (res < 0) {
+			return res;
 		}
 	}
 }
@@ -668,6 +1047,8 @@ static int __common_close(struct hw_device_t *device)
 			dev->events_fd = -1;
 		}
 
+		channel_close(dev);
+
 		free(dev);
 	}
 
@@ -696,6 +1077,15 @@ static int __module_methods_open(const struct hw_module_t *module,
 			free(dev);
 			return res;
 		}
+		// channel records and the framework use CLOCK_MONOTONIC
+		int clk = CLOCK_MONOTONIC;
+		if (ioctl(dev->events_fd, EVIOCSCLOCKID, &clk)) {
+			LOGW("evdev clock not settable, converting from CLOCK_REALTIME");
+			dev->events_realtime = 1;
+		}
+		dev->chan_fd = -1;
+		dev->chan_bell = -1;
+		channel_open(dev);
 		
 		/* initialize the procs */
 		dev->device.common.tag = HARDWARE_DEVICE_TAG;
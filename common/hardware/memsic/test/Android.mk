@@ -97,3 +97,53 @@ LOCAL_SRC_FILES		:= ecs_ctrl_test.c
 LOCAL_MODULE := mecs_ctrl_test
 include $(BUILD_EXECUTABLE)
 
+
+# MEMSIC sensors test cases
+# case of replay a recorded acc/mag trace through the fusion path
+include $(CLEAR_VARS)
+LOCAL_PRELINK_MODULE	:= false
+LOCAL_MODULE_TAGS := eng
+LOCAL_SHARED_LIBRARIES	:= liblog libcutils
+LOCAL_STATIC_LIBRARIES	:= compasslib_h5_gcc_armv4t compasslib_h6_gcc_armv4t
+LOCAL_LDLIBS		+= -Idl
+LOCAL_CFLAGS		+= -DCOMPASS_ALGO_H5
+LOCAL_CFLAGS		+= -DNVM_PATH=\"/data/local/tmp/ecs_replay_nvm\"
+LOCAL_C_INCLUDES	+= $(LOCAL_PATH)/../adapter		\
+			   $(LOCAL_PATH)/../libs/H5_V1.2	\
+			   $(LOCAL_PATH)/../libs/H6_V1.0
+
+LOCAL_SRC_FILES		:= ecs_replay_test.c			\
+			   ../adapter/sensors_coordinate.c	\
+			   ../adapter/sensors_sample_adapter.c	\
+			   ../adapter/sensors_algo_adapter.c	\
+			   ../adapter/sensors_algo_ids_h5.c	\
+			   ../adapter/sensors_algo_ids_h6.c	\
+			   ../adapter/sensors_algo_ids_util.c
+
+LOCAL_MODULE := mecs_replay_test
+include $(BUILD_EXECUTABLE)
+
+# MEMSIC sensors test cases
+# case of replay a recorded acc/mag trace through the fusion path, H6 algorithm
+include $(CLEAR_VARS)
+LOCAL_PRELINK_MODULE	:= false
+LOCAL_MODULE_TAGS := eng
+LOCAL_SHARED_LIBRARIES	:= liblog libcutils
+LOCAL_STATIC_LIBRARIES	:= compasslib_h5_gcc_armv4t compasslib_h6_gcc_armv4t
+LOCAL_LDLIBS		+= -Idl
+LOCAL_CFLAGS		+= -DCOMPASS_ALGO_H6
+LOCAL_CFLAGS		+= -DNVM_PATH=\"/data/local/tmp/ecs_replay_h6_nvm\"
+LOCAL_C_INCLUDES	+= $(LOCAL_PATH)/../adapter		\
+			   $(LOCAL_PATH)/../libs/H5_V1.2	\
+			   $(LOCAL_PATH)/../libs/H6_V1.0
+
+LOCAL_SRC_FILES		:= ecs_replay_test.c			\
+			   ../adapter/sensors_coordinate.c	\
+			   ../adapter/sensors_sample_adapter.c	\
+			   ../adapter/sensors_algo_adapter.c	\
+			   ../adapter/sensors_algo_ids_h5.c	\
+			   ../adapter/sensors_algo_ids_h6.c	\
+			   ../adapter/sensors_algo_ids_util.c
+
+LOCAL_MODULE := mecs_replay_h6_test
+include $(BUILD_EXECUTABLE)
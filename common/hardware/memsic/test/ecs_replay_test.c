@@ -0,0 +1,391 @@
+/*****************************************************************************
+ *  Copyright Statement:
+ *  --------------------
+ *  This software is protected by Copyright and the information and source code
+ *  contained herein is confidential. The software including the source code
+ *  may not be copied and the information contained herein may not be used or
+ *  disclosed except with the written permission of MEMSIC Inc. (C) 2010
+ *****************************************************************************/
+
+/**
+ * @file
+ *
+ * @brief
+ * Replay a recorded acc/mag trace through the memsicd fusion path without
+ * the sensor chips, and report its cost and accuracy. <br>
+ * The acc and mag devices are stand-ins fed from the trace; everything from
+ * sensors_read_sample() on is the code memsicd runs, on the trace's clock.
+ * With -v every orientation is printed, so two builds can be diffed.
+ *
+ * Trace format, one record per line, '#' starts a comment:
+ *   acc <off x> <off y> <off z> <sens x> <sens y> <sens z> <install dir>
+ *   mag <off x> <off y> <off z> <sens x> <sens y> <sens z> <install dir>
+ *   <time ms> <acc x> <acc y> <acc z> <mag x> <mag y> <mag z> [heading]
+ * Raw values are sensor counts; heading is the true azimuth in degree.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include <sensors_data_struct.h>
+#include <sensors_acc_adapter.h>
+#include <sensors_mag_adapter.h>
+#include <sensors_sample_adapter.h>
+#include <sensors_algo_adapter.h>
+#include <sensors_algo_ids_util.h>
+#include <sensors_coordinate.h>
+
+#ifndef NVM_PATH
+#error "NVM_PATH must point away from the device's own ecs_nvm"
+#endif
+
+#define SENSOR_STATUS_ACCURACY_HIGH	3
+
+#define CONVERT_O			(360.0f / 65536.0f)
+
+/* one trace sample */
+struct replay_sample {
+	int t;
+	int acc[3];
+	int mag[3];
+	int has_heading;
+	float heading;
+};
+
+/* device parameters of the trace */
+struct replay_device {
+	int offset[3];
+	int sensit[3];
+	int dir;
+};
+
+static struct replay_device trace_acc = {
+	offset	: {0, 0, 0},
+	sensit	: {1024, 1024, 1024},
+	dir	: OBVERSE_X_AXIS_FORWARD,
+};
+static struct replay_device trace_mag = {
+	offset	: {0, 0, 0},
+	sensit	: {512, 512, 512},
+	dir	: OBVERSE_X_AXIS_FORWARD,
+};
+static struct replay_sample *cur;
+
+/* stand-in sensor devices, reading from the current trace sample */
+
+static int replay_init(void)
+{
+	return 0;
+}
+
+static int replay_open(void)
+{
+	return 0;
+}
+
+static int replay_close(int fd)
+{
+	return 0;
+}
+
+static int replay_acc_read_data(int fd, int *data)
+{
+	memcpy(data, cur->acc, sizeof(cur->acc));
+	return 0;
+}
+
+static int replay_acc_get_offset(int fd, int *offset_xyz)
+{
+	memcpy(offset_xyz, trace_acc.offset, sizeof(trace_acc.offset));
+	return 0;
+}
+
+static int replay_acc_set_new_offset(int fd, int *offset_xyz)
+{
+	return 0;
+}
+
+static int replay_acc_get_sensitivity(int fd, int *sensit_xyz)
+{
+	memcpy(sensit_xyz, trace_acc.sensit, sizeof(trace_acc.sensit));
+	return 0;
+}
+
+static int replay_acc_get_install_dir(void)
+{
+	return trace_acc.dir;
+}
+
+static int replay_mag_read_data(int fd, int *data)
+{
+	memcpy(data, cur->mag, sizeof(cur->mag));
+	return 0;
+}
+
+static int replay_mag_get_offset(int fd, int *offset_xyz)
+{
+	memcpy(offset_xyz, trace_mag.offset, sizeof(trace_mag.offset));
+	return 0;
+}
+
+static int replay_mag_get_sensitivity(int fd, int *sensit_xyz)
+{
+	memcpy(sensit_xyz, trace_mag.sensit, sizeof(trace_mag.sensit));
+	return 0;
+}
+
+static int replay_mag_get_install_dir(void)
+{
+	return trace_mag.dir;
+}
+
+static struct device_acc_t replay_acc = {
+	init		: replay_init,
+	open		: replay_open,
+	close		: replay_close,
+	read_data	: replay_acc_read_data,
+	get_offset	: replay_acc_get_offset,
+	set_new_offset	: replay_acc_set_new_offset,
+	get_sensitivity	: replay_acc_get_sensitivity,
+	get_install_dir	: replay_acc_get_install_dir,
+};
+
+static struct device_mag_t replay_mag = {
+	init		: replay_init,
+	open		: replay_open,
+	close		: replay_close,
+	read_data	: replay_mag_read_data,
+	get_offset	: replay_mag_get_offset,
+	get_sensitivity	: replay_mag_get_sensitivity,
+	get_install_dir	: replay_mag_get_install_dir,
+};
+
+struct device_acc_t *sensors_get_acc_device(void)
+{
+	return &replay_acc;
+}
+
+struct device_mag_t *sensors_get_mag_device(void)
+{
+	return &replay_mag;
+}
+
+/* the algorithm runs on the time of the trace */
+static int replay_get_milliseconds(void)
+{
+	return cur ? cur->t : 0;
+}
+
+static int load_device(const char *line, struct replay_device *d)
+{
+	return sscanf(line, "%*s %d %d %d %d %d %d %d",
+		&d->offset[0], &d->offset[1], &d->offset[2],
+		&d->sensit[0], &d->sensit[1], &d->sensit[2], &d->dir) == 7 ? 0 : -1;
+}
+
+static struct replay_sample *load_trace(const char *path, int *count)
+{
+	FILE *fp;
+	char line[256];
+	struct replay_sample *samples = NULL, *s;
+	int num = 0, size = 0, n, lineno = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("can't open %s (%s)\n", path, strerror(errno));
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		if (!strncmp(line, "acc ", 4) || !strncmp(line, "mag ", 4)) {
+			if (load_device(line, line[0] == 'a' ? &trace_acc : &trace_mag)) {
+				printf("%s:%d: bad device line\n", path, lineno);
+			}
+			continue;
+		}
+
+		if (num == size) {
+			size = size ? size * 2 : 1024;
+			s = realloc(samples, size * sizeof(*samples));
+			if (s == NULL) {
+				break;
+			}
+			samples = s;
+		}
+		s = &samples[num];
+		n = sscanf(line, "%d %d %d %d %d %d %d %f", &s->t,
+			&s->acc[0], &s->acc[1], &s->acc[2],
+			&s->mag[0], &s->mag[1], &s->mag[2], &s->heading);
+		if (n < 7) {
+			printf("%s:%d: bad sample line\n", path, lineno);
+			continue;
+		}
+		s->has_heading = (n == 8);
+		num++;
+	}
+	fclose(fp);
+
+	*count = num;
+	return samples;
+}
+
+static long long cpu_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* heading difference folded into [-180, 180) */
+static float heading_error(float a, float b)
+{
+	float e = fmodf(a - b, 360.0f);
+
+	if (e >= 180.0f) {
+		e -= 360.0f;
+	} else if (e < -180.0f) {
+		e += 360.0f;
+	}
+	return e;
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-v] <trace>\n", name);
+	printf("  -v  print every orientation (time azimuth pitch roll quality)\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct device_acc_t *dev_acc;
+	struct device_mag_t *dev_mag;
+	struct algo_t *algo;
+	struct replay_sample *samples;
+	int num, i, opt;
+	int verbose = 0;
+
+	float cal_acc[3][4], cal_mag[3][4];
+	struct SensorData_Raw raw;
+	struct SensorData_Real real_i;
+	struct SensorData_Orientation orien;
+	float mag_cald[3];
+
+	long long t0, cost, cost_sum = 0, cost_max = 0;
+	int converged = -1;
+	int err_num = 0;
+	float err, err_abs = 0, err_sq = 0, err_max = 0;
+	float azimuth;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	samples = load_trace(argv[optind], &num);
+	if (samples == NULL || num == 0) {
+		printf("no samples in %s\n", argv[optind]);
+		return -1;
+	}
+
+	// start from the default calibration every time
+	unlink(NVM_PATH);
+	ids_set_clock(replay_get_milliseconds);
+	cur = &samples[0];
+
+	dev_acc = sensors_get_acc_device();
+	dev_mag = sensors_get_mag_device();
+	algo = sensors_get_algorithm();
+
+	// same as ecompass_init() in memsicd
+	dev_acc->get_offset(0, raw.off_a);
+	dev_acc->get_sensitivity(0, raw.sens_a);
+	raw.dir_a = dev_acc->get_install_dir();
+	coordinate_raw_to_real_matrix(cal_acc, coordinate_real_to_ids, raw.off_a, raw.sens_a, raw.dir_a);
+	dev_mag->get_offset(0, raw.off_m);
+	dev_mag->get_sensitivity(0, raw.sens_m);
+	raw.dir_m = dev_mag->get_install_dir();
+	coordinate_raw_to_real_matrix(cal_mag, coordinate_real_to_ids, raw.off_m, raw.sens_m, raw.dir_m);
+
+	algo->init();
+	algo->open();
+
+	for (i = 0; i < num; i++) {
+		cur = &samples[i];
+
+		// ecompass_poll() in memsicd with all sensors enabled, minus
+		// the android coordinates nothing here looks at
+		t0 = cpu_ns();
+		if (sensors_read_sample(dev_acc, 0, dev_mag, 0, raw.acc, raw.mag, NULL)) {
+			continue;
+		}
+		coordinate_apply_matrix(real_i.acc, cal_acc, raw.acc);
+		coordinate_apply_matrix(real_i.mag, cal_mag, raw.mag);
+		sensors_algo_fuse(algo, &real_i, mag_cald, &orien);
+		cost = cpu_ns() - t0;
+
+		cost_sum += cost;
+		if (cost > cost_max) {
+			cost_max = cost;
+		}
+
+		azimuth = orien.azimuth * CONVERT_O;
+		if (verbose) {
+			printf("%d %d %d %d %d\n", cur->t,
+				orien.azimuth, orien.pitch, orien.roll, orien.quality);
+		}
+
+		if (converged < 0 && orien.quality >= SENSOR_STATUS_ACCURACY_HIGH) {
+			converged = i;
+		}
+		if (converged >= 0 && cur->has_heading) {
+			err = fabsf(heading_error(azimuth, cur->heading));
+			err_abs += err;
+			err_sq += err * err;
+			if (err > err_max) {
+				err_max = err;
+			}
+			err_num++;
+		}
+	}
+
+	algo->close();
+	unlink(NVM_PATH);
+
+	printf("samples: %d, %d ms\n", num, samples[num - 1].t - samples[0].t);
+	printf("cpu per sample: avg %lld us, max %lld us\n",
+		cost_sum / num / 1000, cost_max / 1000);
+	if (converged < 0) {
+		printf("calibration: not converged\n");
+	} else {
+		printf("calibration: converged after %d samples, %d ms\n",
+			converged + 1, samples[converged].t - samples[0].t);
+	}
+	if (err_num) {
+		printf("heading error after convergence: mean %.2f, rms %.2f, max %.2f degree (%d samples)\n",
+			err_abs / err_num, sqrtf(err_sq / err_num), err_max, err_num);
+	}
+
+	free(samples);
+
+	return 0;
+}
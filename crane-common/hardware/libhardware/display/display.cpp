@@ -32,8 +32,14 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <linux/netlink.h>
 
 #include <hardware/display.h>
+#include <display_ext.h>
 #include <drv_display_sun4i.h>
 #include <g2d_driver.h>
 #include <fb.h>
@@ -42,9 +48,150 @@
 #define MAX_CURSOR_SIZE     128
 #define MAX_CURSOR_MEMIDX   10
 
+#define DISPLAY_CURSOR_DIRTY_POS    0x01
+#define DISPLAY_CURSOR_DIRTY_FRAME  0x02
+
+//entries of display_state_t, the per screen ones are shifted by the screen number
+enum
+{
+    DISPLAY_STATE_HPD           = 0x0001,
+    DISPLAY_STATE_MAXMODE       = 0x0002,
+    DISPLAY_STATE_TVDAC         = 0x0004,
+    DISPLAY_STATE_3D            = 0x0008,
+    DISPLAY_STATE_OUTTYPE       = 0x0010,
+    DISPLAY_STATE_BRIGHT        = 0x0040,
+    DISPLAY_STATE_CONTRAST      = 0x0100,
+    DISPLAY_STATE_SATURATION    = 0x0400,
+    DISPLAY_STATE_HUE           = 0x1000,
+    DISPLAY_STATE_CURSOR        = 0x4000,
+};
+
+//what an output plugged in or out may change
+#define DISPLAY_STATE_HOTPLUG   (DISPLAY_STATE_HPD | DISPLAY_STATE_MAXMODE | DISPLAY_STATE_TVDAC | DISPLAY_STATE_3D \
+                                | DISPLAY_STATE_OUTTYPE | (DISPLAY_STATE_OUTTYPE << 1))
+
+//what the cache may keep: sink properties, which only a hotplug uevent changes.
+//output types and colour settings can be set by any process holding the display
+//device, this context would never hear about it, so those are read every time
+#define DISPLAY_STATE_CACHED    (DISPLAY_STATE_HPD | DISPLAY_STATE_MAXMODE | DISPLAY_STATE_TVDAC | DISPLAY_STATE_3D)
+
+//steps of a mode switch in the order they are applied, undone in reverse order on failure
+enum
+{
+    DISPLAY_TXN_CLOSE_OUT1      = 0x0001,
+    DISPLAY_TXN_CLOSE_OUT0      = 0x0002,
+    DISPLAY_TXN_RELEASE_FB0     = 0x0004,
+    DISPLAY_TXN_RELEASE_FB1     = 0x0008,
+    DISPLAY_TXN_CLOSE_LAYER0    = 0x0010,
+    DISPLAY_TXN_REQUEST_FB0     = 0x0020,
+    DISPLAY_TXN_REQUEST_FB1     = 0x0040,
+    DISPLAY_TXN_LAYER0          = 0x0080,
+    DISPLAY_TXN_SCNWIN1         = 0x0100,
+    DISPLAY_TXN_OPEN_OUT0       = 0x0200,
+    DISPLAY_TXN_OPEN_OUT1       = 0x0400,
+};
+
+#define DISPLAY_TXN_TEARDOWN    (DISPLAY_TXN_CLOSE_OUT1 | DISPLAY_TXN_CLOSE_OUT0 | DISPLAY_TXN_RELEASE_FB0 \
+                                | DISPLAY_TXN_RELEASE_FB1 | DISPLAY_TXN_CLOSE_LAYER0)
+#define DISPLAY_TXN_ENABLE      (DISPLAY_TXN_OPEN_OUT0 | DISPLAY_TXN_OPEN_OUT1)
+
 pthread_mutex_t             mode_lock;
 bool                        mutex_inited = false;
 
+struct display_fbinfo_t
+{
+    bool                        valid;
+    struct fb_fix_screeninfo    fix;
+    struct fb_var_screeninfo    var;
+};
+
+//screen0 -> screen1 copy in clone mode, done by a worker so the caller never waits for g2d
+struct display_mirror_t
+{
+    pthread_t                   thread;
+    pthread_mutex_t             lock;//also guards fbinfo
+    pthread_cond_t              cond;
+    bool                        running;
+    bool                        active;//the worker owns the flips of dst_fb
+    bool                        pending;
+    bool                        busy;//the worker blits and flips dst_fb without the lock
+    bool                        suspended;//a mode switch is rebuilding the fbs, requests are dropped
+    int                         src_fb;
+    int                         src_buf;
+    int                         dst_fb;
+    int                         busy_buf;//source buffer the running blit reads, -1 when idle
+    unsigned int                seq;//bumped by every request
+    unsigned int                done_seq;//last request put on screen
+    int                         dst_front;
+};
+
+//hardware cursor, window changes are written once per vsync by display_cursorthread
+struct display_cursor_t
+{
+    pthread_t                   thread;
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;
+    bool                        running;
+    bool                        shown;
+    int                         screen;
+    int                         dirty;//DISPLAY_CURSOR_DIRTY_*
+    int                         x;
+    int                         y;
+    int                         frame_size;
+    int                         frame;
+    int                         frame_count;//animated when > 1
+    int                         period_us;
+    int64_t                     next_frame_us;
+    unsigned long               vaddr;//mapped once per request
+    unsigned long               paddr;
+};
+
+//last values read from the driver, so polled getters stay out of the kernel
+struct display_state_t
+{
+    uint32_t                    generation;
+    uint32_t                    valid;//DISPLAY_STATE_* entries holding a driver value
+    int                         hdmi_hpd;
+    int                         hdmi_maxmode;
+    int                         tvdac;
+    int                         support_3d;
+    int                         out_type[MAX_DISPLAY_NUM];
+    int                         bright[MAX_DISPLAY_NUM];
+    int                         contrast[MAX_DISPLAY_NUM];
+    int                         saturation[MAX_DISPLAY_NUM];
+    int                         hue[MAX_DISPLAY_NUM];
+    __disp_rect_t               cursor[MAX_DISPLAY_NUM];
+};
+
+//what a mode switch changes in the context
+struct display_modestate_t
+{
+    int                         mode;
+    int                         pixel_format[MAX_DISPLAY_NUM];
+    int                         out_type[MAX_DISPLAY_NUM];
+    int                         out_format[MAX_DISPLAY_NUM];
+    int                         width[MAX_DISPLAY_NUM];
+    int                         height[MAX_DISPLAY_NUM];
+    int                         valid_width[MAX_DISPLAY_NUM];
+    int                         valid_height[MAX_DISPLAY_NUM];
+};
+
+struct display_modetxn_t
+{
+    int                         mode;
+    struct display_modepara_t   para;
+    struct display_modestate_t  target;
+    struct display_modestate_t  saved;
+    unsigned int                steps;//DISPLAY_TXN_* to apply
+    unsigned int                done;//DISPLAY_TXN_* applied so far
+    int                         layer_fb;//fb whose layer DISPLAY_TXN_LAYER0 places on screen0
+    int                         layer_mode;//-1 keeps the layer work mode
+    unsigned int                saved_fb_known;
+    __disp_fb_create_para_t     saved_fb_para[MAX_DISPLAY_NUM];
+    __disp_fb_create_para_t     fb_para[MAX_DISPLAY_NUM];
+    __disp_layer_info_t         old_layer_para;
+};
+
 struct display_context_t 
 {
     struct display_device_t     device;
@@ -66,6 +213,16 @@ struct display_context_t
     int                         lcd_height;
     int                         area_percent[2];
     int                         orientation;
+    struct display_fbinfo_t     fbinfo[MAX_DISPLAY_NUM];
+    struct display_mirror_t     mirror;
+    struct display_cursor_t     cursor;
+    struct display_state_t      state;
+    pthread_mutex_t             state_lock;
+    int                         uevent_fd;//-1 when hotplug is not watched, see display_ueventthread
+    int                         uevent_wake[2];
+    pthread_t                   uevent_thread;
+    unsigned int                fb_known;//fbs requested by the hal, fb_para tells how
+    __disp_fb_create_para_t     fb_para[MAX_DISPLAY_NUM];
 };
 
 struct tv_para_t
@@ -138,15 +295,45 @@ struct display_module_t HAL_MODULE_INFO_SYM =
     }
 };
 
-static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
-                          int dstfb_id,int dstfb_bufno)
+static int64_t display_gettimeus(void)
 {
-    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    
-	struct fb_fix_screeninfo    fix_src;
-    struct fb_fix_screeninfo    fix_dst;
-    struct fb_var_screeninfo    var_src;
-    struct fb_var_screeninfo    var_dst;
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct display_fbinfo_t *display_getfbinfo(struct display_context_t* ctx,int fb_id)
+{
+    struct display_fbinfo_t     *info = &ctx->fbinfo[fb_id];
+
+    if(!info->valid)
+    {
+        ioctl(ctx->mFD_fb[fb_id],FBIOGET_FSCREENINFO,&info->fix);
+        ioctl(ctx->mFD_fb[fb_id],FBIOGET_VSCREENINFO,&info->var);
+        info->valid = true;
+    }
+
+    return info;
+}
+
+static void display_invalidatefbinfo(struct display_context_t* ctx)
+{
+    int                         i;
+
+    for(i=0; i<MAX_DISPLAY_NUM; i++)
+    {
+        ctx->fbinfo[i].valid = false;
+    }
+}
+
+//fills in the copy of a whole fb buffer, it reads fbinfo: the worker holds mirror.lock
+static int display_setupblit(struct display_context_t* ctx,int srcfb_id,int srcfb_bufno,
+                             int dstfb_id,int dstfb_bufno,g2d_stretchblt *blit_out)
+{
+    struct fb_var_screeninfo    *var_src;
+    struct fb_var_screeninfo    *var_dst;
     unsigned int                src_width;
     unsigned int                src_height;
     unsigned int                dst_width;
@@ -155,23 +342,20 @@ static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bu
     unsigned int                addr_dst;
     unsigned int                size;
     g2d_stretchblt              blit_para;
-    int                         err;
 
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_FSCREENINFO,&fix_src);
-	ioctl(ctx->mFD_fb[srcfb_id],FBIOGET_VSCREENINFO,&var_src);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_FSCREENINFO,&fix_dst);
-	ioctl(ctx->mFD_fb[dstfb_id],FBIOGET_VSCREENINFO,&var_dst);
+    var_src = &display_getfbinfo(ctx, srcfb_id)->var;
+    var_dst = &display_getfbinfo(ctx, dstfb_id)->var;
 	
-	src_width   = var_src.xres;
-	src_height  = var_src.yres;
-    dst_width   = var_dst.xres;
-    dst_height  = var_dst.yres;
+	src_width   = var_src->xres;
+	src_height  = var_src->yres;
+    dst_width   = var_dst->xres;
+    dst_height  = var_dst->yres;
         
-	addr_src = fix_src.smem_start + ((var_src.xres * (srcfb_bufno * var_src.yres) * var_src.bits_per_pixel) >> 3);
-	addr_dst = fix_dst.smem_start + ((var_dst.xres * (dstfb_bufno * var_dst.yres) * var_dst.bits_per_pixel) >> 3);
-	size = (var_src.xres * var_src.yres * var_src.bits_per_pixel) >> 3;//in byte unit
+	addr_src = ctx->fbinfo[srcfb_id].fix.smem_start + ((var_src->xres * (srcfb_bufno * var_src->yres) * var_src->bits_per_pixel) >> 3);
+	addr_dst = ctx->fbinfo[dstfb_id].fix.smem_start + ((var_dst->xres * (dstfb_bufno * var_dst->yres) * var_dst->bits_per_pixel) >> 3);
+	size = (var_src->xres * var_src->yres * var_src->bits_per_pixel) >> 3;//in byte unit
 	
-	switch (var_src.bits_per_pixel) 
+	switch (var_src->bits_per_pixel) 
 	{			
     	case 16:
     		blit_para.src_image.format      = G2D_FMT_RGB565;
@@ -186,7 +370,7 @@ static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bu
     		break;
     		
     	default:
-    	    LOGE("invalid bits_per_pixel :%d\n", var_src.bits_per_pixel);
+    	    LOGE("invalid bits_per_pixel :%d\n", var_src->bits_per_pixel);
     		return -1;
 	}
 
@@ -218,7 +402,16 @@ static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bu
     
     blit_para.flag                 = G2D_BLT_NONE;
     
-    err = ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)&blit_para);				
+    *blit_out = blit_para;
+
+    return  0;
+}
+
+static int display_runblit(struct display_context_t* ctx,g2d_stretchblt *blit_para)
+{
+    int                         err;
+
+    err = ioctl(ctx->mFD_mp , G2D_CMD_STRETCHBLT ,(unsigned long)blit_para);				
     if(err < 0)		
     {    
         LOGE("copy fb failed!\n");
@@ -228,19 +421,288 @@ static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bu
 
     return  0;
 }
+
+static int display_blitfb(struct display_context_t* ctx,int srcfb_id,int srcfb_bufno,
+                          int dstfb_id,int dstfb_bufno)
+{
+    g2d_stretchblt              blit_para;
+
+    if(display_setupblit(ctx, srcfb_id, srcfb_bufno, dstfb_id, dstfb_bufno, &blit_para) != 0)
+    {
+        return -1;
+    }
+
+    return display_runblit(ctx, &blit_para);
+}
+      
+static void *display_mirrorthread(void *arg)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)arg;
+    uint32_t                    crtc = 0;
+
+    pthread_mutex_lock(&ctx->mirror.lock);
+    while(ctx->mirror.running)
+    {
+        int                         back;
+        int                         src_buf;
+        int                         dst_fb;
+        unsigned int                seq;
+        int                         ret;
+        g2d_stretchblt              blit_para;
+        struct fb_var_screeninfo    var;
+
+        if(!ctx->mirror.active || !ctx->mirror.pending)
+        {
+            pthread_cond_wait(&ctx->mirror.cond, &ctx->mirror.lock);
+            continue;
+        }
+
+        //start right after the source flip is latched, newer requests replace this one meanwhile
+        pthread_mutex_unlock(&ctx->mirror.lock);
+        ioctl(ctx->mFD_fb[ctx->mirror.src_fb], FBIO_WAITFORVSYNC, &crtc);
+        pthread_mutex_lock(&ctx->mirror.lock);
+
+        if(!ctx->mirror.active || !ctx->mirror.pending)
+        {
+            continue;
+        }
+        ctx->mirror.pending = false;
+
+        //a buffer number seen before may hold a new frame, only the request tells
+        if(ctx->mirror.seq == ctx->mirror.done_seq)
+        {
+            continue;
+        }
+
+        //draw into the hidden buffer of the destination and flip it ourselves.
+        //the request is copied out so copyfb and pandisplay don't wait for g2d,
+        //busy keeps setmode from releasing the fbs until the flip is done
+        back    = (ctx->mirror.dst_front == 0) ? 1 : 0;
+        src_buf = ctx->mirror.src_buf;
+        dst_fb  = ctx->mirror.dst_fb;
+        seq     = ctx->mirror.seq;
+        if(display_setupblit(ctx, ctx->mirror.src_fb, src_buf, dst_fb, back, &blit_para) != 0)
+        {
+            continue;
+        }
+        var = display_getfbinfo(ctx, dst_fb)->var;
+        var.yoffset = back * var.yres;
+        ctx->mirror.busy = true;
+        ctx->mirror.busy_buf = src_buf;
+        pthread_mutex_unlock(&ctx->mirror.lock);
+
+        ret = display_runblit(ctx, &blit_para);
+        if(ret == 0)
+        {
+            ioctl(ctx->mFD_fb[dst_fb],FBIOPAN_DISPLAY,&var);
+        }
+
+        pthread_mutex_lock(&ctx->mirror.lock);
+        ctx->mirror.busy = false;
+        ctx->mirror.busy_buf = -1;
+        pthread_cond_broadcast(&ctx->mirror.cond);
+        if(ret == 0 && ctx->mirror.active)
+        {
+            ctx->mirror.dst_front       = back;
+            ctx->mirror.done_seq        = seq;
+        }
+    }
+    pthread_mutex_unlock(&ctx->mirror.lock);
+
+    return NULL;
+}
+
+static int display_copyfb(struct display_device_t *dev,int srcfb_id,int srcfb_bufno,
+                          int dstfb_id,int dstfb_bufno)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
+
+    if(srcfb_id < 0 || srcfb_id >= MAX_DISPLAY_NUM || dstfb_id < 0 || dstfb_id >= MAX_DISPLAY_NUM
+       || srcfb_id == dstfb_id || !ctx->mFD_fb[srcfb_id] || !ctx->mFD_fb[dstfb_id])
+    {
+        LOGE("invalid fb copy %d -> %d\n", srcfb_id, dstfb_id);
+
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->mirror.lock);
+    if(ctx->mirror.suspended)
+    {
+        //screen1 gets screen0's content when its fb is requested again
+        pthread_mutex_unlock(&ctx->mirror.lock);
+
+        return 0;
+    }
+    if(!ctx->mirror.running)
+    {
+        pthread_mutex_unlock(&ctx->mirror.lock);
+        
+        return display_blitfb(ctx, srcfb_id, srcfb_bufno, dstfb_id, dstfb_bufno);
+    }
+
+    //the caller draws into the other buffers once this returns, so a blit
+    //still reading one of them has to finish first
+    while(ctx->mirror.busy && ctx->mirror.busy_buf != srcfb_bufno)
+    {
+        pthread_cond_wait(&ctx->mirror.cond, &ctx->mirror.lock);
+    }
+
+    //only the latest request matters, the destination buffer is picked by the worker
+    ctx->mirror.src_fb          = srcfb_id;
+    ctx->mirror.src_buf         = srcfb_bufno;
+    ctx->mirror.dst_fb          = dstfb_id;
+    ctx->mirror.seq++;
+    ctx->mirror.pending         = true;
+    ctx->mirror.active          = true;
+    pthread_cond_broadcast(&ctx->mirror.cond);
+    pthread_mutex_unlock(&ctx->mirror.lock);
+
+    return  0;
+}
       
 static int display_pandisplay(struct display_device_t *dev,int fb_id,int bufno)
 {
     struct 	display_context_t*  ctx = (struct display_context_t*)dev;
     struct fb_var_screeninfo    var;
-		
-	ioctl(ctx->mFD_fb[fb_id],FBIOGET_VSCREENINFO,&var);
+
+    pthread_mutex_lock(&ctx->mirror.lock);
+    if(ctx->mirror.active && fb_id == ctx->mirror.dst_fb)
+    {
+        //the mirror worker flips this screen itself
+        pthread_mutex_unlock(&ctx->mirror.lock);
+        
+        return 0;
+    }
+    var = display_getfbinfo(ctx, fb_id)->var;
+    pthread_mutex_unlock(&ctx->mirror.lock);
+
 	var.yoffset = bufno * var.yres;
 	ioctl(ctx->mFD_fb[fb_id],FBIOPAN_DISPLAY,&var);
 
     return 0;
 }
 
+static void display_statechanged(struct display_context_t* ctx,uint32_t entries)
+{
+    pthread_mutex_lock(&ctx->state_lock);
+    ctx->state.valid &= ~entries;
+    ctx->state.generation++;
+    pthread_mutex_unlock(&ctx->state_lock);
+}
+
+//answers from the state model, going to the driver only for entries not cached yet
+static int display_cachedioctl(struct display_context_t* ctx,uint32_t entry,int *value,int cmd,unsigned long *args)
+{
+    int                         ret;
+
+    pthread_mutex_lock(&ctx->state_lock);
+    if(!(ctx->state.valid & entry))
+    {
+        *value = ioctl(ctx->mFD_disp,cmd,args);
+        //without uevents a cached value could never be refreshed
+        if((entry & DISPLAY_STATE_CACHED) == entry && ctx->uevent_fd >= 0)
+        {
+            ctx->state.valid |= entry;
+        }
+    }
+    ret = *value;
+    pthread_mutex_unlock(&ctx->state_lock);
+
+    return ret;
+}
+
+static void *display_ueventthread(void *arg)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)arg;
+    struct pollfd               fds[2];
+    char                        buf[1024];
+    int                         len;
+
+    fds[0].fd       = ctx->uevent_fd;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = ctx->uevent_wake[0];
+    fds[1].events   = POLLIN;
+
+    while(1)
+    {
+        if(poll(fds, 2, -1) <= 0)
+        {
+            continue;
+        }
+        if(fds[1].revents)
+        {
+            break;
+        }
+
+        len = recv(ctx->uevent_fd, buf, sizeof(buf) - 1, 0);
+        if(len <= 0)
+        {
+            continue;
+        }
+        buf[len] = 0;
+
+        //"change@/devices/virtual/switch/hdmi", tv and vga report through switches too
+        if(strstr(buf, "/switch/"))
+        {
+            LOGV("####display hotplug:%s\n", buf);
+            display_statechanged(ctx, DISPLAY_STATE_HOTPLUG);
+        }
+    }
+
+    return NULL;
+}
+
+static int display_startuevent(struct display_context_t* ctx)
+{
+    struct sockaddr_nl          addr;
+    int                         size = 64 * 1024;
+
+    ctx->uevent_fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+    if(ctx->uevent_fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family  = AF_NETLINK;
+    addr.nl_pid     = 0;
+    addr.nl_groups  = 0xffffffff;
+    setsockopt(ctx->uevent_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+    if(bind(ctx->uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || pipe(ctx->uevent_wake) < 0)
+    {
+        goto err;
+    }
+
+    if(pthread_create(&ctx->uevent_thread, NULL, display_ueventthread, ctx) != 0)
+    {
+        close(ctx->uevent_wake[0]);
+        close(ctx->uevent_wake[1]);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    LOGW("display hotplug not watched, hotplug status is read on every call\n");
+    close(ctx->uevent_fd);
+    ctx->uevent_fd = -1;
+
+    return -1;
+}
+
+static void display_stopuevent(struct display_context_t* ctx)
+{
+    if(ctx->uevent_fd >= 0)
+    {
+        write(ctx->uevent_wake[1], "q", 1);
+        pthread_join(ctx->uevent_thread, NULL);
+        close(ctx->uevent_wake[0]);
+        close(ctx->uevent_wake[1]);
+        close(ctx->uevent_fd);
+        ctx->uevent_fd = -1;
+    }
+}
+
 static int display_gethdmistatus(struct display_device_t *dev)
 {
     struct display_context_t* ctx = (struct display_context_t*)dev;
@@ -253,14 +715,14 @@ static int display_gethdmistatus(struct display_device_t *dev)
         	
         	args[0] = 0;
         	
-            return ioctl(ctx->mFD_disp,DISP_CMD_HDMI_GET_HPD_STATUS,args);
+            return display_cachedioctl(ctx,DISPLAY_STATE_HPD,&ctx->state.hdmi_hpd,DISP_CMD_HDMI_GET_HPD_STATUS,args);
         }
     }
 
     return 0;    
 }
 
-static int display_gethdmimaxmode(struct display_device_t *dev)
+static int display_queryhdmimaxmode(struct display_device_t *dev)
 {
     struct display_context_t* ctx = (struct display_context_t*)dev;
     
@@ -312,6 +774,34 @@ static int display_gethdmimaxmode(struct display_device_t *dev)
     return DISPLAY_TVFORMAT_720P_60HZ;    
 }      
 
+static int display_gethdmimaxmode(struct display_device_t *dev)
+{
+    struct display_context_t* ctx = (struct display_context_t*)dev;
+    int                       ret;
+
+    pthread_mutex_lock(&ctx->state_lock);
+    if(ctx->state.valid & DISPLAY_STATE_MAXMODE)
+    {
+        ret = ctx->state.hdmi_maxmode;
+        pthread_mutex_unlock(&ctx->state_lock);
+
+        return ret;
+    }
+    pthread_mutex_unlock(&ctx->state_lock);
+
+    ret = display_queryhdmimaxmode(dev);
+
+    pthread_mutex_lock(&ctx->state_lock);
+    ctx->state.hdmi_maxmode = ret;
+    if(ctx->uevent_fd >= 0)
+    {
+        ctx->state.valid |= DISPLAY_STATE_MAXMODE;
+    }
+    pthread_mutex_unlock(&ctx->state_lock);
+
+    return ret;
+}
+
 
 static int display_setbacklightmode(struct display_device_t *dev,int mode)
 {
@@ -351,7 +841,7 @@ static int display_gettvdacstatus(struct display_device_t *dev)
         	unsigned long args[4];
         	
         	args[0] = 0;
-            status = ioctl(ctx->mFD_disp,DISP_CMD_TV_GET_INTERFACE,args);
+            status = display_cachedioctl(ctx,DISPLAY_STATE_TVDAC,&ctx->state.tvdac,DISP_CMD_TV_GET_INTERFACE,args);
             if(status == DISP_TV_YPBPR)
             {
                 return  DISPLAY_TVDAC_YPBPR;
@@ -560,6 +1050,7 @@ static int display_setbright(struct display_device_t *dev,int displayno,int brig
     		args[1] = bright;
     		
     		ioctl(ctx->mFD_disp,DISP_CMD_SET_BRIGHT,args);	
+    		display_statechanged(ctx, DISPLAY_STATE_BRIGHT << displayno);
     	}
     }
     
@@ -587,7 +1078,7 @@ static int display_getbright(struct display_device_t *dev,int displayno)
     		args[0] = displayno;
     		args[1] = 0;
     		
-    		return ioctl(ctx->mFD_disp,DISP_CMD_GET_BRIGHT,args);	
+    		return display_cachedioctl(ctx,DISPLAY_STATE_BRIGHT << displayno,&ctx->state.bright[displayno],DISP_CMD_GET_BRIGHT,args);
     	}
     }
     
@@ -631,6 +1122,7 @@ static int display_setcontrast(struct display_device_t *dev,int displayno,int co
     		args[1] = contrast;
     		
     		ioctl(ctx->mFD_disp,DISP_CMD_SET_CONTRAST,args);	
+    		display_statechanged(ctx, DISPLAY_STATE_CONTRAST << displayno);
     	}
     }
     
@@ -658,7 +1150,7 @@ static int display_getcontrast(struct display_device_t *dev,int displayno)
     		args[0] = displayno;
     		args[1] = 0;
     		
-    		return ioctl(ctx->mFD_disp,DISP_CMD_GET_CONTRAST,args);	
+    		return display_cachedioctl(ctx,DISPLAY_STATE_CONTRAST << displayno,&ctx->state.contrast[displayno],DISP_CMD_GET_CONTRAST,args);
     	}
     }
     
@@ -702,6 +1194,7 @@ static int display_setsaturation(struct display_device_t *dev,int displayno,int
     		args[1] = saturation;
     		
     		ioctl(ctx->mFD_disp,DISP_CMD_SET_SATURATION,args);	
+    		display_statechanged(ctx, DISPLAY_STATE_SATURATION << displayno);
     	}
     }
     
@@ -729,7 +1222,7 @@ static int display_getsaturation(struct display_device_t *dev,int displayno)
     		args[0] = displayno;
     		args[1] = 0;
     		
-    		return ioctl(ctx->mFD_disp,DISP_CMD_GET_SATURATION,args);	
+    		return display_cachedioctl(ctx,DISPLAY_STATE_SATURATION << displayno,&ctx->state.saturation[displayno],DISP_CMD_GET_SATURATION,args);
     	}
     }
     
@@ -773,6 +1266,7 @@ static int display_sethue(struct display_device_t *dev,int displayno,int hue)
     		args[1] = hue;
     		
     		ioctl(ctx->mFD_disp,DISP_CMD_SET_HUE,args);	
+    		display_statechanged(ctx, DISPLAY_STATE_HUE << displayno);
     	}
     }
     
@@ -800,13 +1294,175 @@ static int display_gethue(struct display_device_t *dev,int displayno)
     		args[0] = displayno;
     		args[1] = 0;
     		
-    		return ioctl(ctx->mFD_disp,DISP_CMD_GET_HUE,args);	
+    		return display_cachedioctl(ctx,DISPLAY_STATE_HUE << displayno,&ctx->state.hue[displayno],DISP_CMD_GET_HUE,args);
     	}
     }
     
     return  0;
 }
 
+//writes the pending cursor window changes, cursor.lock held
+static void display_cursorapply(struct display_context_t* ctx)
+{
+    struct display_cursor_t*    cursor = &ctx->cursor;
+    unsigned long               args[4];
+    __disp_rect_t               win;
+    int                         cols;
+
+    if(ctx->mFD_cursor == 0 || cursor->dirty == 0)
+    {
+        return;
+    }
+
+    if(cursor->dirty & DISPLAY_CURSOR_DIRTY_FRAME)
+    {
+        cols        = MAX_CURSOR_SIZE / cursor->frame_size;
+        win.x       = (cursor->frame % cols) * cursor->frame_size;
+        win.y       = (cursor->frame / cols) * cursor->frame_size;
+        win.width   = cursor->frame_size;
+        win.height  = cursor->frame_size;
+
+        args[0] = cursor->screen;
+        args[1] = (unsigned long)ctx->mFD_cursor;
+        args[2] = (unsigned long)&win;
+        args[3] = 0;
+        ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_SET_SOURCE_WINDOW, (void*)args);
+    }
+
+    win.x       = cursor->x;
+    win.y       = cursor->y;
+    win.width   = cursor->frame_size;
+    win.height  = cursor->frame_size;
+
+    args[0] = cursor->screen;
+    args[1] = (unsigned long)ctx->mFD_cursor;
+    args[2] = (unsigned long)&win;
+    args[3] = 0;
+    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_SET_SCREEN_WINDOW, (void*)args);
+
+    cursor->dirty = 0;
+}
+
+//mouse events come much faster than the panel refreshes, only the last position of a frame counts
+static void *display_cursorthread(void *arg)
+{
+    struct display_context_t*   ctx = (struct display_context_t*)arg;
+    struct display_cursor_t*    cursor = &ctx->cursor;
+    uint32_t                    crtc = 0;
+
+    pthread_mutex_lock(&cursor->lock);
+    while(cursor->running)
+    {
+        bool                        animating = cursor->shown && cursor->frame_count > 1;
+        int64_t                     now;
+
+        if(cursor->dirty == 0 && !animating)
+        {
+            pthread_cond_wait(&cursor->cond, &cursor->lock);
+            continue;
+        }
+
+        if(cursor->dirty == 0)
+        {
+            struct timespec             ts;
+            int64_t                     wait_us = cursor->next_frame_us - display_gettimeus();
+
+            if(wait_us > 0)
+            {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec  += (ts.tv_nsec / 1000 + wait_us) / 1000000;
+                ts.tv_nsec  = ((ts.tv_nsec / 1000 + wait_us) % 1000000) * 1000;
+                pthread_cond_timedwait(&cursor->cond, &cursor->lock, &ts);
+                continue;
+            }
+        }
+
+        pthread_mutex_unlock(&cursor->lock);
+        ioctl(ctx->mFD_fb[cursor->screen], FBIO_WAITFORVSYNC, &crtc);
+        pthread_mutex_lock(&cursor->lock);
+
+        now = display_gettimeus();
+        if(cursor->shown && cursor->frame_count > 1 && now >= cursor->next_frame_us)
+        {
+            cursor->frame           = (cursor->frame + 1) % cursor->frame_count;
+            cursor->next_frame_us   = now + cursor->period_us;
+            cursor->dirty          |= DISPLAY_CURSOR_DIRTY_FRAME;
+        }
+        display_cursorapply(ctx);
+    }
+    pthread_mutex_unlock(&cursor->lock);
+
+    return NULL;
+}
+
+static int display_setcursorpara(struct display_context_t* ctx,int displayno,int type,int value)
+{
+    struct display_cursor_t*    cursor = &ctx->cursor;
+    int                         ret = 0;
+
+    pthread_mutex_lock(&cursor->lock);
+    switch(type)
+    {
+        case DISPLAY_CURSOR_FRAMESIZE:
+            if(value <= 0 || value > MAX_CURSOR_SIZE || (MAX_CURSOR_SIZE % value) != 0)
+            {
+                ret = -1;
+                break;
+            }
+            cursor->frame_size  = value;
+            cursor->frame       = 0;
+            cursor->frame_count = 0;
+            cursor->dirty      |= DISPLAY_CURSOR_DIRTY_FRAME | DISPLAY_CURSOR_DIRTY_POS;
+            break;
+
+        case DISPLAY_CURSOR_FRAME:
+            if(value < 0 || value >= (MAX_CURSOR_SIZE / cursor->frame_size) * (MAX_CURSOR_SIZE / cursor->frame_size))
+            {
+                ret = -1;
+                break;
+            }
+            cursor->frame       = value;
+            cursor->dirty      |= DISPLAY_CURSOR_DIRTY_FRAME;
+            break;
+
+        case DISPLAY_CURSOR_ANIMATE:
+            if((value >> 16) > (MAX_CURSOR_SIZE / cursor->frame_size) * (MAX_CURSOR_SIZE / cursor->frame_size))
+            {
+                ret = -1;
+                break;
+            }
+            cursor->frame_count     = value >> 16;
+            cursor->period_us       = (value & 0xffff) * 1000;
+            if(cursor->period_us == 0)
+            {
+                cursor->frame_count = 0;
+            }
+            cursor->frame           = 0;
+            cursor->next_frame_us   = display_gettimeus() + cursor->period_us;
+            cursor->dirty          |= DISPLAY_CURSOR_DIRTY_FRAME;
+            break;
+
+        default:
+            ret = -1;
+            break;
+    }
+
+    if(ret == 0)
+    {
+        if(cursor->running)
+        {
+            pthread_cond_signal(&cursor->cond);
+        }
+        else
+        {
+            display_cursorapply(ctx);
+        }
+    }
+    pthread_mutex_unlock(&cursor->lock);
+
+    return ret;
+}
+
 static int display_hwcursorrequest(struct display_device_t *dev,int displayno)
 {
     struct display_context_t*   ctx = (struct display_context_t*)dev;
@@ -882,6 +1538,15 @@ static int display_hwcursorrequest(struct display_device_t *dev,int displayno)
                 return  -1;
             }
 
+            pthread_mutex_lock(&ctx->cursor.lock);
+            ctx->cursor.screen      = displayno;
+            ctx->cursor.shown       = false;
+            ctx->cursor.dirty       = 0;
+            ctx->cursor.frame_size  = MAX_CURSOR_SIZE;
+            ctx->cursor.frame       = 0;
+            ctx->cursor.frame_count = 0;
+            pthread_mutex_unlock(&ctx->cursor.lock);
+
 	        return 0;
         }
     }
@@ -903,11 +1568,23 @@ static int display_hwcursorrelease(struct display_device_t *dev,int displayno)
 
         if(ctx->mFD_disp)
         {
+            pthread_mutex_lock(&ctx->cursor.lock);
+            if(ctx->cursor.vaddr)
+            {
+                munmap((void*)ctx->cursor.vaddr, MAX_CURSOR_SIZE * MAX_CURSOR_SIZE * 4);
+            }
+            ctx->cursor.vaddr   = 0;
+            ctx->cursor.paddr   = 0;
+            ctx->cursor.shown   = false;
+            ctx->cursor.dirty   = 0;
+
 		    args[0] = displayno;
             args[1] = (unsigned long)ctx->mFD_cursor;
             args[2] = 0;
             args[3] = 0;
 		    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_RELEASE, (void*)args);
+            ctx->mFD_cursor = 0;
+            pthread_mutex_unlock(&ctx->cursor.lock);
             
             args[0] = MAX_CURSOR_MEMIDX + displayno;
             args[1] = MAX_CURSOR_SIZE * MAX_CURSOR_SIZE * 4;
@@ -943,11 +1620,23 @@ static int display_hwcursorshow(struct display_device_t *dev,int displayno)
         if(ctx->mFD_disp)
         {
             LOGV("display_hwcursorshow3!displayno = %d,ctx->mFD_cursor = %x\n",displayno,ctx->mFD_cursor);
-		    args[0] = displayno;
-            args[1] = (unsigned long)ctx->mFD_cursor;
-            args[2] = 0;
-            args[3] = 0;
-		    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_OPEN, (void*)args);
+            pthread_mutex_lock(&ctx->cursor.lock);
+            if(!ctx->cursor.shown)
+            {
+                //appear at the latest position rather than where the last vsync left it
+                display_cursorapply(ctx);
+
+		        args[0] = displayno;
+                args[1] = (unsigned long)ctx->mFD_cursor;
+                args[2] = 0;
+                args[3] = 0;
+		        ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_OPEN, (void*)args);
+
+                ctx->cursor.shown           = true;
+                ctx->cursor.next_frame_us   = display_gettimeus() + ctx->cursor.period_us;
+                pthread_cond_signal(&ctx->cursor.cond);
+            }
+            pthread_mutex_unlock(&ctx->cursor.lock);
 
 	        return 0;
         }
@@ -970,11 +1659,18 @@ static int display_hwcursorhide(struct display_device_t *dev,int displayno)
 
         if(ctx->mFD_disp)
         {
-		    args[0] = displayno;
-            args[1] = (unsigned long)ctx->mFD_cursor;
-            args[2] = 0;
-            args[3] = 0;
-		    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_CLOSE, (void*)args);
+            pthread_mutex_lock(&ctx->cursor.lock);
+            if(ctx->cursor.shown)
+            {
+		        args[0] = displayno;
+                args[1] = (unsigned long)ctx->mFD_cursor;
+                args[2] = 0;
+                args[3] = 0;
+		        ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_CLOSE, (void*)args);
+
+                ctx->cursor.shown = false;
+            }
+            pthread_mutex_unlock(&ctx->cursor.lock);
 
 	        return 0;
         }
@@ -999,16 +1695,28 @@ static int display_sethwcursorpos(struct display_device_t *dev,int displayno,int
         if(ctx->mFD_disp)
         {
             LOGV("display_sethwcursorpos posx = %d,posy = %d\n",posx,posy);
+            pthread_mutex_lock(&ctx->cursor.lock);
+            ctx->cursor.x       = posx;
+            ctx->cursor.y       = posy;
+            ctx->cursor.dirty  |= DISPLAY_CURSOR_DIRTY_POS;
+            if(ctx->cursor.running)
+            {
+                pthread_cond_signal(&ctx->cursor.cond);
+            }
+            else
+            {
+                display_cursorapply(ctx);
+            }
             scnwin.x        = posx;
 	        scnwin.y        = posy;
-	        scnwin.width    = MAX_CURSOR_SIZE;
-	        scnwin.height   = MAX_CURSOR_SIZE;
-            
-		    args[0] = displayno;
-            args[1] = (unsigned long)ctx->mFD_cursor;
-            args[2] = (unsigned long)&scnwin;
-            args[3] = 0;
-		    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_SET_SCREEN_WINDOW, (void*)args);
+	        scnwin.width    = ctx->cursor.frame_size;
+	        scnwin.height   = ctx->cursor.frame_size;
+            pthread_mutex_unlock(&ctx->cursor.lock);
+
+            pthread_mutex_lock(&ctx->state_lock);
+            ctx->state.cursor[displayno] = scnwin;
+            ctx->state.valid |= (DISPLAY_STATE_CURSOR << displayno);
+            pthread_mutex_unlock(&ctx->state_lock);
 
 	        return 0;
         }
@@ -1036,7 +1744,16 @@ static int display_gethwcursorposx(struct display_device_t *dev,int displayno)
             args[1] = (unsigned long)ctx->mFD_cursor;
             args[2] = (unsigned long)&scnwin;
             args[3] = 0;
-		    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_GET_SCREEN_WINDOW, (void*)args);
+
+            pthread_mutex_lock(&ctx->state_lock);
+            if(!(ctx->state.valid & (DISPLAY_STATE_CURSOR << displayno)))
+            {
+		        ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_GET_SCREEN_WINDOW, (void*)args);
+		        ctx->state.cursor[displayno] = scnwin;
+		        ctx->state.valid |= (DISPLAY_STATE_CURSOR << displayno);
+            }
+            scnwin = ctx->state.cursor[displayno];
+            pthread_mutex_unlock(&ctx->state_lock);
 
 	        return scnwin.x;
         }
@@ -1064,7 +1781,16 @@ static int display_gethwcursorposy(struct display_device_t *dev,int displayno)
             args[1] = (unsigned long)ctx->mFD_cursor;
             args[2] = (unsigned long)&scnwin;
             args[3] = 0;
-		    ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_GET_SCREEN_WINDOW, (void*)args);
+
+            pthread_mutex_lock(&ctx->state_lock);
+            if(!(ctx->state.valid & (DISPLAY_STATE_CURSOR << displayno)))
+            {
+		        ioctl(ctx->mFD_disp, DISP_CMD_SPRITE_BLOCK_GET_SCREEN_WINDOW, (void*)args);
+		        ctx->state.cursor[displayno] = scnwin;
+		        ctx->state.valid |= (DISPLAY_STATE_CURSOR << displayno);
+            }
+            scnwin = ctx->state.cursor[displayno];
+            pthread_mutex_unlock(&ctx->state_lock);
 
 	        return scnwin.y;
         }
@@ -1088,10 +1814,21 @@ static int display_hwcursorgetvaddr(struct display_device_t *dev,int displayno)
 
         if(ctx->mFD_disp)
         {
-            args[0] = MAX_CURSOR_MEMIDX + displayno;
-            ioctl(ctx->mFD_disp,DISP_CMD_MEM_SELIDX,(unsigned long)args);
-            vaddr = (unsigned long)mmap(NULL, MAX_CURSOR_SIZE * MAX_CURSOR_SIZE * 4, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->mFD_disp, 0L);
-            LOGV("sprite vaddr:0x%x\n",vaddr);
+            //cursor images stay in this mapping, callers draw their frames once and reuse them
+            pthread_mutex_lock(&ctx->cursor.lock);
+            if(ctx->cursor.vaddr == 0)
+            {
+                args[0] = MAX_CURSOR_MEMIDX + displayno;
+                ioctl(ctx->mFD_disp,DISP_CMD_MEM_SELIDX,(unsigned long)args);
+                vaddr = (unsigned long)mmap(NULL, MAX_CURSOR_SIZE * MAX_CURSOR_SIZE * 4, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->mFD_disp, 0L);
+                if(vaddr != (unsigned long)MAP_FAILED)
+                {
+                    ctx->cursor.vaddr = vaddr;
+                }
+                LOGV("sprite vaddr:0x%x\n",vaddr);
+            }
+            vaddr = ctx->cursor.vaddr;
+            pthread_mutex_unlock(&ctx->cursor.lock);
             
 	        return vaddr;
         }
@@ -1115,12 +1852,18 @@ static int display_hwcursorgetpaddr(struct display_device_t *dev,int displayno)
 
         if(ctx->mFD_disp)
         {
-            args[0] = MAX_CURSOR_MEMIDX + displayno;
-            ioctl(ctx->mFD_disp,DISP_CMD_MEM_SELIDX,(unsigned long)args);
+            pthread_mutex_lock(&ctx->cursor.lock);
+            if(ctx->cursor.paddr == 0)
+            {
+                args[0] = MAX_CURSOR_MEMIDX + displayno;
+                ioctl(ctx->mFD_disp,DISP_CMD_MEM_SELIDX,(unsigned long)args);
             
-            args[0] = MAX_CURSOR_MEMIDX + displayno;
-            paddr = ioctl(ctx->mFD_disp,DISP_CMD_MEM_GETADR,(unsigned long)args);
-            LOGV("sprite paddr:0x%x\n",paddr);
+                args[0] = MAX_CURSOR_MEMIDX + displayno;
+                ctx->cursor.paddr = ioctl(ctx->mFD_disp,DISP_CMD_MEM_GETADR,(unsigned long)args);
+                LOGV("sprite paddr:0x%x\n",ctx->cursor.paddr);
+            }
+            paddr = ctx->cursor.paddr;
+            pthread_mutex_unlock(&ctx->cursor.lock);
 
 	        return paddr;
         }
@@ -1142,7 +1885,7 @@ static int display_issupport3dmode(struct display_device_t *dev)
         	args[0] = 0;
         	args[1] = DISP_TV_MOD_1080P_24HZ_3D_FP;
 
-            if(ioctl(ctx->mFD_disp,DISP_CMD_HDMI_SUPPORT_MODE,args))
+            if(display_cachedioctl(ctx,DISPLAY_STATE_3D,&ctx->state.support_3d,DISP_CMD_HDMI_SUPPORT_MODE,args))
             {
                 return 1;
             }
@@ -1296,7 +2039,7 @@ static int display_open_output(struct display_device_t *dev, int screen, int out
         ctx->lcd_width = ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_WIDTH,arg);
         ctx->lcd_height = ioctl(ctx->mFD_disp,DISP_CMD_SCN_GET_HEIGHT,arg);
     }
-    return 0;
+    return (ret < 0) ? -1 : 0;
 }
 
 
@@ -1335,7 +2078,15 @@ static int display_close_output(struct display_device_t *dev, int screen)
 
 static int display_setparameter(struct display_device_t *dev, int displayno, int type,int format)
 {
-    return  0;
+    struct 	display_context_t* ctx = (struct display_context_t*)dev;
+
+    switch(type)
+    {
+        case   DISPLAY_CURSOR_FRAMESIZE:
+        case   DISPLAY_CURSOR_FRAME:
+        case   DISPLAY_CURSOR_ANIMATE:          return display_setcursorpara(ctx, displayno, type, format);
+        default:                                return 0;
+    }
 }
 
 static int display_getparameter(struct display_device_t *dev, int displayno, int param)
@@ -1362,6 +2113,7 @@ static int display_getparameter(struct display_device_t *dev, int displayno, int
         case   DISPLAY_OUTPUT_TYPE:             return  ctx->out_type[displayno];
         case   DISPLAY_OUTPUT_ISOPEN :          return 0;
         case   DISPLAY_OUTPUT_HOTPLUG:          return 0;
+        case   DISPLAY_STATE_GENERATION:        return ctx->state.generation;
         default:
             LOGE("Invalid Display Parameter!\n");
 
@@ -1452,391 +2204,562 @@ static int display_setorientation(struct display_device_t *dev,int orientation)
     return 0;
 }
 
-static int display_setmode(struct display_device_t *dev,int mode,struct display_modepara_t *para)
+static void display_savemodestate(struct display_context_t* ctx,struct display_modestate_t *state)
 {
-    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
-    int							ret = 0;
-    unsigned long 				arg[4];
-    __disp_fb_create_para_t 	fb_para;
-    int i = 0;
+    int                         i;
 
-    LOGD("####display_setmode:%d,screen0_type:%d,screen0_format:%d,screen1_type:%d,screen1:format:%d\n", 
-        mode,para->d0type,para->d0format,para->d1type,para->d1format);
+    state->mode = ctx->mode;
+    for(i = 0; i < MAX_DISPLAY_NUM; i++)
+    {
+        state->pixel_format[i]  = ctx->pixel_format[i];
+        state->out_type[i]      = ctx->out_type[i];
+        state->out_format[i]    = ctx->out_format[i];
+        state->width[i]         = ctx->width[i];
+        state->height[i]        = ctx->height[i];
+        state->valid_width[i]   = ctx->valid_width[i];
+        state->valid_height[i]  = ctx->valid_height[i];
+    }
+}
+
+static void display_restoremodestate(struct display_context_t* ctx,struct display_modestate_t *state)
+{
+    int                         i;
 
-    if(mode == DISPLAY_MODE_DUALSAME)
+    ctx->mode = state->mode;
+    for(i = 0; i < MAX_DISPLAY_NUM; i++)
     {
-        unsigned int layer_hdl;
-        __disp_rect_t scn_win;
+        ctx->pixel_format[i]    = state->pixel_format[i];
+        ctx->out_type[i]        = state->out_type[i];
+        ctx->out_format[i]      = state->out_format[i];
+        ctx->width[i]           = state->width[i];
+        ctx->height[i]          = state->height[i];
+        ctx->valid_width[i]     = state->valid_width[i];
+        ctx->valid_height[i]    = state->valid_height[i];
+    }
+}
+
+static void display_calcgeometry(struct display_context_t* ctx,struct display_modestate_t *state,int screen,int type,int format)
+{
+    state->width[screen]        = display_getwidth(ctx,screen,type,format);
+    state->height[screen]       = display_getheight(ctx,screen,type,format);
+    state->valid_width[screen]  = (ctx->area_percent[screen] * display_getvalidwidth(ctx,screen,type,format)) / 100;
+    state->valid_height[screen] = (ctx->area_percent[screen] * display_getvalidheight(ctx,screen,type,format)) / 100;
+}
+
+//combinations the two display pipes cannot drive at the same time
+static int display_checkmode(struct display_context_t* ctx,int mode,struct display_modepara_t *para)
+{
+    if(mode != DISPLAY_MODE_DUALSAME && mode != DISPLAY_MODE_DUALSAME_TWO_VIDEO)
+    {
+        return 0;
+    }
 
-        if(ctx->out_type[0] == DISPLAY_DEVICE_HDMI && para->d1type == DISPLAY_DEVICE_HDMI)
+    if(ctx->out_type[0] == DISPLAY_DEVICE_HDMI && para->d1type == DISPLAY_DEVICE_HDMI)
+    {
+        return -1;
+    }
+    if(ctx->out_type[0] == DISPLAY_DEVICE_TV && para->d1type == DISPLAY_DEVICE_TV)
+    {
+        if((ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC) && 
+            (ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC))
         {
             return -1;
         }
-        if(ctx->out_type[0] == DISPLAY_DEVICE_TV && para->d1type == DISPLAY_DEVICE_TV)
-        {
-            if((ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC) && 
-                (ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC))
-            {
-                return -1;
-            }
-        }
-        if(ctx->out_type[0] == DISPLAY_DEVICE_VGA && para->d1type == DISPLAY_DEVICE_TV)
-        {
-            if(para->d1format != DISPLAY_TVFORMAT_PAL &&  para->d1format != DISPLAY_TVFORMAT_NTSC)
-            {   
-                return -1;
-            }
+    }
+    if(ctx->out_type[0] == DISPLAY_DEVICE_VGA && para->d1type == DISPLAY_DEVICE_TV)
+    {
+        if(para->d1format != DISPLAY_TVFORMAT_PAL &&  para->d1format != DISPLAY_TVFORMAT_NTSC)
+        {   
+            return -1;
         }
-        if(ctx->out_type[0] == DISPLAY_DEVICE_TV && para->d1type == DISPLAY_DEVICE_VGA)
+    }
+    if(ctx->out_type[0] == DISPLAY_DEVICE_TV && para->d1type == DISPLAY_DEVICE_VGA)
+    {
+        if(ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC)
         {
-            if(ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC)
-            {
-                return -1;
-            }
+            return -1;
         }
-        
+    }
 
-        if(ctx->mode != DISPLAY_MODE_SINGLE)
-        {
-            display_close_output(dev, 1);
-            
-            arg[0] = 1;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
-        }
-        
-        ctx->width[0] = display_getwidth(ctx,0,para->d0type,para->d0format);
-        ctx->height[0] = display_getheight(ctx,0,para->d0type,para->d0format);
-        ctx->valid_width[0]    = display_getvalidwidth(ctx,0,para->d0type,para->d0format);
-        ctx->valid_height[0]   = display_getvalidheight(ctx,0,para->d0type,para->d0format);
-        ctx->width[1] = display_getwidth(ctx,1,para->d1type,para->d1format);
-        ctx->height[1] = display_getheight(ctx,1,para->d1type,para->d1format);
-        ctx->valid_width[1]    = display_getvalidwidth(ctx,1,para->d1type,para->d1format);
-        ctx->valid_height[1]   = display_getvalidheight(ctx,1,para->d1type,para->d1format);
-        ctx->valid_width[0] = (ctx->area_percent[0] * ctx->valid_width[0]) / 100;
-        ctx->valid_height[0] = (ctx->area_percent[0] * ctx->valid_height[0]) / 100;
-        ctx->valid_width[1] = (ctx->area_percent[1] * ctx->valid_width[1]) / 100;
-        ctx->valid_height[1] = (ctx->area_percent[1] * ctx->valid_height[1]) / 100;
-
-        fb_para.fb_mode = FB_MODE_SCREEN1;
-        fb_para.mode = DISP_LAYER_WORK_MODE_SCALER;
-        fb_para.buffer_num = 3;
-        fb_para.width = ctx->width[0];
-        fb_para.height = ctx->height[0];
-        fb_para.output_width = ctx->valid_width[1];
-        fb_para.output_height = ctx->valid_height[1];
-        arg[0]                      = 1;
-        arg[1]                      = (unsigned long)&fb_para;
-        ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_REQUEST,(unsigned long)arg);
-
-        display_copyfb(dev,0,0,1,0);
-
-        ioctl(ctx->mFD_fb[1], FBIOGET_LAYER_HDL_1, &layer_hdl);
-        
-        scn_win.x = (ctx->width[1] - ctx->valid_width[1])/2;
-        scn_win.width = ctx->valid_width[1];
-        scn_win.y = (ctx->height[1] - ctx->valid_height[1])/2;
-        scn_win.height = ctx->valid_height[1];
-        arg[0] = 1;
-        arg[1] = layer_hdl;
-        arg[2] = (unsigned long)&scn_win;
-        ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_SCN_WINDOW,(unsigned long)arg);
+    return 0;
+}
 
-        display_open_output(dev, 1, para->d1type, para->d1format);
+static void display_setfbpara(__disp_fb_create_para_t *fb_para,__fb_mode_t fb_mode,__disp_layer_work_mode_t mode,
+                              int buffer_num,int width,int height,int output_width,int output_height)
+{
+    memset(fb_para, 0, sizeof(*fb_para));
+    fb_para->fb_mode        = fb_mode;
+    fb_para->mode           = mode;
+    fb_para->buffer_num     = buffer_num;
+    fb_para->width          = width;
+    fb_para->height         = height;
+    fb_para->output_width   = output_width;
+    fb_para->output_height  = output_height;
+}
+
+//the fb a mode requests for screen with the geometry in state, -1 when the mode has none there
+static int display_modefbpara(int mode,struct display_modestate_t *state,int screen,__disp_fb_create_para_t *fb_para)
+{
+    if(screen == 0)
+    {
+        //SINGLE_FB_VAR's fb0 is also what the kernel sets up at boot
+        display_setfbpara(fb_para, FB_MODE_SCREEN0, DISP_LAYER_WORK_MODE_NORMAL, 2,
+                          state->valid_width[0], state->valid_height[0], state->valid_width[0], state->valid_height[0]);
+    }
+    else if(mode == DISPLAY_MODE_DUALSAME)
+    {
+        display_setfbpara(fb_para, FB_MODE_SCREEN1, DISP_LAYER_WORK_MODE_SCALER, 3,
+                          state->width[0], state->height[0], state->valid_width[1], state->valid_height[1]);
     }
     else if(mode == DISPLAY_MODE_DUALSAME_TWO_VIDEO)
     {
-        unsigned int layer_hdl;
-        __disp_rect_t scn_win;
+        display_setfbpara(fb_para, FB_MODE_SCREEN1, DISP_LAYER_WORK_MODE_NORMAL, 3,
+                          state->valid_width[1], state->valid_height[1], state->valid_width[1], state->valid_height[1]);
+    }
+    else if(mode == DISPLAY_MODE_SINGLE_VAR_BE)
+    {
+        //the ui lives in fb1 which the back end scales onto screen0
+        display_setfbpara(fb_para, FB_MODE_SCREEN0, DISP_LAYER_WORK_MODE_NORMAL, 3,
+                          state->valid_width[0], state->valid_height[0], state->valid_width[0], state->valid_height[0]);
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+//fbinfo describes the fbs, the mirror worker reads it under mirror.lock
+static int display_fbcmd(struct display_context_t* ctx,int cmd,int screen,__disp_fb_create_para_t *fb_para)
+{
+    unsigned long               arg[4];
+    int                         ret;
 
-        if(ctx->out_type[0] == DISPLAY_DEVICE_HDMI && para->d1type == DISPLAY_DEVICE_HDMI)
+    arg[0] = screen;
+    arg[1] = (unsigned long)fb_para;
+    pthread_mutex_lock(&ctx->mirror.lock);
+    ret = ioctl(ctx->mFD_disp,cmd,(unsigned long)arg);
+    display_invalidatefbinfo(ctx);
+    if(ret >= 0 && cmd == DISP_CMD_FB_REQUEST && screen == 1 && fb_para->fb_mode == FB_MODE_SCREEN1)
+    {
+        //fill screen1 with screen0's content before its output comes up
+        display_blitfb(ctx,0,0,1,0);
+    }
+    pthread_mutex_unlock(&ctx->mirror.lock);
+
+    return ret;
+}
+
+//works out the target state and the steps leading there from the current one,
+//fails when an fb it releases could not be requested back on rollback
+static int display_planmode(struct display_context_t* ctx,struct display_modetxn_t *txn)
+{
+    struct display_modestate_t  *target = &txn->target;
+    struct display_modestate_t  *saved = &txn->saved;
+    struct display_modepara_t   *para = &txn->para;
+    bool                        screen0_changed;
+    int                         screen;
+
+    display_savemodestate(ctx, saved);
+    memcpy(target, saved, sizeof(*target));
+    memcpy(txn->saved_fb_para, ctx->fb_para, sizeof(txn->saved_fb_para));
+    txn->saved_fb_known = ctx->fb_known;
+    txn->steps          = 0;
+    txn->done           = 0;
+    txn->layer_fb       = 0;
+    txn->layer_mode     = -1;
+
+    target->mode            = txn->mode;
+    target->pixel_format[0] = para->d0pixelformat;
+    target->out_type[0]     = para->d0type;
+    target->out_format[0]   = para->d0format;
+    target->pixel_format[1] = para->d1pixelformat;
+    target->out_type[1]     = para->d1type;
+    target->out_format[1]   = para->d1format;
+
+    screen0_changed = (para->d0type != saved->out_type[0]) || (para->d0format != saved->out_format[0]);
+
+    if(txn->mode == DISPLAY_MODE_DUALSAME || txn->mode == DISPLAY_MODE_DUALSAME_TWO_VIDEO)
+    {
+        display_calcgeometry(ctx, target, 0, para->d0type, para->d0format);
+        display_calcgeometry(ctx, target, 1, para->d1type, para->d1format);
+
+        if(saved->mode != DISPLAY_MODE_SINGLE)
         {
-            return -1;
+            txn->steps |= DISPLAY_TXN_CLOSE_OUT1 | DISPLAY_TXN_RELEASE_FB1;
         }
-        if(ctx->out_type[0] == DISPLAY_DEVICE_TV && para->d1type == DISPLAY_DEVICE_TV)
+        txn->steps |= DISPLAY_TXN_REQUEST_FB1 | DISPLAY_TXN_SCNWIN1 | DISPLAY_TXN_OPEN_OUT1;
+        display_modefbpara(txn->mode, target, 1, &txn->fb_para[1]);
+    }
+    else if(txn->mode == DISPLAY_MODE_SINGLE)
+    {
+        if(saved->mode != DISPLAY_MODE_SINGLE)
         {
-            if((ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC) && 
-                (ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC))
-            {
-                return -1;
-            }
+            txn->steps |= DISPLAY_TXN_CLOSE_OUT1 | DISPLAY_TXN_RELEASE_FB1;
         }
-        if(ctx->out_type[0] == DISPLAY_DEVICE_VGA && para->d1type == DISPLAY_DEVICE_TV)
+    }
+    else if(screen0_changed)
+    {
+        display_calcgeometry(ctx, target, 0, para->d0type, para->d0format);
+
+        txn->steps |= DISPLAY_TXN_CLOSE_OUT0 | DISPLAY_TXN_LAYER0 | DISPLAY_TXN_OPEN_OUT0;
+
+        if(txn->mode == DISPLAY_MODE_SINGLE_VAR_FE)
         {
-            if(para->d1format != DISPLAY_TVFORMAT_PAL &&  para->d1format != DISPLAY_TVFORMAT_NTSC)
-            {   
-                return -1;
-            }
+            txn->layer_mode = DISP_LAYER_WORK_MODE_SCALER;
         }
-        if(ctx->out_type[0] == DISPLAY_DEVICE_TV && para->d1type == DISPLAY_DEVICE_VGA)
+        else if(txn->mode == DISPLAY_MODE_SINGLE_VAR_BE)
         {
-            if(ctx->out_format[0] != DISPLAY_TVFORMAT_PAL &&  ctx->out_format[0] != DISPLAY_TVFORMAT_NTSC)
+            //the ui moves to fb1 which the back end scales onto screen0
+            if(saved->mode == DISPLAY_MODE_SINGLE_VAR_BE)
             {
-                return -1;
+                txn->steps |= DISPLAY_TXN_RELEASE_FB1;
             }
+            else
+            {
+                txn->steps |= DISPLAY_TXN_CLOSE_LAYER0;
+            }
+            txn->steps |= DISPLAY_TXN_REQUEST_FB1;
+            txn->layer_fb = 1;
+            display_modefbpara(txn->mode, target, 1, &txn->fb_para[1]);
         }
-
-        if(ctx->mode != DISPLAY_MODE_SINGLE)
+        else if(txn->mode == DISPLAY_MODE_SINGLE_FB_VAR)
         {
-            display_close_output(dev, 1);
-            
-            arg[0] = 1;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
-        }
-
-        ctx->width[0] = display_getwidth(ctx,0,para->d0type,para->d0format);
-        ctx->height[0] = display_getheight(ctx,0,para->d0type,para->d0format);
-        ctx->valid_width[0]    = display_getvalidwidth(ctx,0,para->d0type,para->d0format);
-        ctx->valid_height[0]   = display_getvalidheight(ctx,0,para->d0type,para->d0format);
-        ctx->width[1] = display_getwidth(ctx,1,para->d1type,para->d1format);
-        ctx->height[1] = display_getheight(ctx,1,para->d1type,para->d1format);
-        ctx->valid_width[1]    = display_getvalidwidth(ctx,1,para->d1type,para->d1format);
-        ctx->valid_height[1]   = display_getvalidheight(ctx,1,para->d1type,para->d1format);
-        ctx->valid_width[0] = (ctx->area_percent[0] * ctx->valid_width[0]) / 100;
-        ctx->valid_height[0] = (ctx->area_percent[0] * ctx->valid_height[0]) / 100;
-        ctx->valid_width[1] = (ctx->area_percent[1] * ctx->valid_width[1]) / 100;
-        ctx->valid_height[1] = (ctx->area_percent[1] * ctx->valid_height[1]) / 100;
-
-        fb_para.fb_mode = FB_MODE_SCREEN1;
-        fb_para.mode = DISP_LAYER_WORK_MODE_NORMAL;
-        fb_para.buffer_num = 3;
-        fb_para.width = ctx->valid_width[1];
-        fb_para.height = ctx->valid_height[1];
-        fb_para.output_width = ctx->valid_width[1];
-        fb_para.output_height = ctx->valid_height[1];
-        arg[0]                      = 1;
-        arg[1]                      = (unsigned long)&fb_para;
-        ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_REQUEST,(unsigned long)arg);
-        
-        display_copyfb(dev,0,0,1,0);
-
-        ioctl(ctx->mFD_fb[1], FBIOGET_LAYER_HDL_1, &layer_hdl);
-
-        scn_win.x = (ctx->width[1] - ctx->valid_width[1])/2;
-        scn_win.width = ctx->valid_width[1];
-        scn_win.y = (ctx->height[1] - ctx->valid_height[1])/2;
-        scn_win.height = ctx->valid_height[1];
-        arg[0] = 1;
-        arg[1] = layer_hdl;
-        arg[2] = (unsigned long)&scn_win;
-        ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_SCN_WINDOW,(unsigned long)arg);
-
-        display_open_output(dev, 1, para->d1type, para->d1format);
+            txn->steps |= DISPLAY_TXN_RELEASE_FB0 | DISPLAY_TXN_REQUEST_FB0;
+            display_modefbpara(txn->mode, target, 0, &txn->fb_para[0]);
+        }
     }
-    else if(mode == DISPLAY_MODE_SINGLE)
+
+    //fbs requested before this hal was loaded are rebuilt from the mode that owns them
+    for(screen = 0; screen < MAX_DISPLAY_NUM; screen++)
     {
-        if(ctx->mode != DISPLAY_MODE_SINGLE)
+        if(!(txn->steps & ((screen == 0) ? DISPLAY_TXN_RELEASE_FB0 : DISPLAY_TXN_RELEASE_FB1))
+            || (txn->saved_fb_known & (1 << screen)))
         {
-            display_close_output(dev, 1);
-            
-            arg[0] = 1;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
+            continue;
         }
-    }    
-    else if(mode == DISPLAY_MODE_SINGLE_VAR_FE)
-    {
-        if((para->d0type != ctx->out_type[0]) || (para->d0format != ctx->out_format[0]))
+        if(display_modefbpara(saved->mode, saved, screen, &txn->saved_fb_para[screen]) < 0)
         {
-            unsigned int layer_hdl;
-            __disp_layer_info_t layer_para;
-        
-            display_close_output(dev, 0);
-       
-            ctx->width[0] = display_getwidth(ctx,0,para->d0type,para->d0format);
-            ctx->height[0] = display_getheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0]    = display_getvalidwidth(ctx,0,para->d0type,para->d0format);
-            ctx->valid_height[0]   = display_getvalidheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0] = (ctx->area_percent[0] * ctx->valid_width[0]) / 100;
-            ctx->valid_height[0] = (ctx->area_percent[0] * ctx->valid_height[0]) / 100;
+            LOGE("####display_setmode cannot restore fb%d of mode:%d, not switching\n", screen, saved->mode);
+            return -1;
+        }
+        txn->saved_fb_known |= (1 << screen);
+    }
 
+    return 0;
+}
+
+static int display_runstep(struct display_context_t* ctx,struct display_modetxn_t *txn,unsigned int step)
+{
+    struct display_device_t     *dev = &ctx->device;
+    struct display_modestate_t  *target = &txn->target;
+    unsigned long               arg[4];
+    unsigned int                layer_hdl;
+    __disp_layer_info_t         layer_para;
+    __disp_rect_t               scn_win;
+    int                         screen;
+    int                         ret = 0;
+
+    switch(step)
+    {
+        case DISPLAY_TXN_CLOSE_OUT0:
+        case DISPLAY_TXN_CLOSE_OUT1:
+            display_close_output(dev, (step == DISPLAY_TXN_CLOSE_OUT0) ? 0 : 1);
+            break;
+
+        case DISPLAY_TXN_RELEASE_FB0:
+        case DISPLAY_TXN_RELEASE_FB1:
+            screen = (step == DISPLAY_TXN_RELEASE_FB0) ? 0 : 1;
+            display_fbcmd(ctx, DISP_CMD_FB_RELEASE, screen, NULL);
+            ctx->fb_known &= ~(1 << screen);
+            break;
+
+        case DISPLAY_TXN_CLOSE_LAYER0:
             ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &layer_hdl);
-        
             arg[0] = 0;
             arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_GET_PARA,(unsigned long)arg);
-            
-            layer_para.mode = DISP_LAYER_WORK_MODE_SCALER;
-            layer_para.scn_win.x = (ctx->width[0] - ctx->valid_width[0])/2;
-            layer_para.scn_win.width = ctx->valid_width[0];
-            layer_para.scn_win.y = (ctx->height[0] - ctx->valid_height[0])/2;
-            layer_para.scn_win.height = ctx->valid_height[0];
-            
-            arg[0] = 0;
-            arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_PARA,(unsigned long)arg);
+            ioctl(ctx->mFD_disp,DISP_CMD_LAYER_CLOSE,(unsigned long)arg);
+            break;
 
-            display_open_output(dev, 0,para->d0type,para->d0format);
-        }
-    }
-    else if(mode == DISPLAY_MODE_SINGLE_VAR_BE)
-    {
-        if((para->d0type != ctx->out_type[0]) || (para->d0format != ctx->out_format[0]))
-        {
-            unsigned int layer_hdl;
-            __disp_layer_info_t layer_para;
-            
-            display_close_output(dev, 0);
-        
-            ctx->width[0] = display_getwidth(ctx,0,para->d0type,para->d0format);
-            ctx->height[0] = display_getheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0]    = display_getvalidwidth(ctx,0,para->d0type,para->d0format);
-            ctx->valid_height[0]   = display_getvalidheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0] = (ctx->area_percent[0] * ctx->valid_width[0]) / 100;
-            ctx->valid_height[0] = (ctx->area_percent[0] * ctx->valid_height[0]) / 100;
-
-            if(ctx->mode == DISPLAY_MODE_SINGLE_VAR_BE)
+        case DISPLAY_TXN_REQUEST_FB0:
+        case DISPLAY_TXN_REQUEST_FB1:
+            screen = (step == DISPLAY_TXN_REQUEST_FB0) ? 0 : 1;
+            ret = display_fbcmd(ctx, DISP_CMD_FB_REQUEST, screen, &txn->fb_para[screen]);
+            if(ret < 0)
             {
-                arg[0] = 1;
-                ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
+                break;
             }
-            else
-            {
-                ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &layer_hdl);
+            ctx->fb_para[screen] = txn->fb_para[screen];
+            ctx->fb_known |= (1 << screen);
+            break;
 
-                arg[0] = 0;
-                arg[1] = layer_hdl;
-                ioctl(ctx->mFD_disp,DISP_CMD_LAYER_CLOSE,(unsigned long)arg);
-            }
+        case DISPLAY_TXN_LAYER0:
+            ioctl(ctx->mFD_fb[txn->layer_fb], FBIOGET_LAYER_HDL_0, &layer_hdl);
 
-            fb_para.fb_mode = FB_MODE_SCREEN0;
-            fb_para.mode = DISP_LAYER_WORK_MODE_NORMAL;
-            fb_para.buffer_num = 3;
-            fb_para.width = ctx->valid_width[0];
-            fb_para.height = ctx->valid_height[0];
-            fb_para.output_width = ctx->valid_width[0];
-            fb_para.output_height = ctx->valid_height[0];
-            arg[0]                      = 1;
-            arg[1]                      = (unsigned long)&fb_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_REQUEST,(unsigned long)arg);
-
-            ioctl(ctx->mFD_fb[1], FBIOGET_LAYER_HDL_0, &layer_hdl);
-            
             arg[0] = 0;
             arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
+            arg[2] = (unsigned long)&txn->old_layer_para;
             ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_GET_PARA,(unsigned long)arg);
-            
-            layer_para.scn_win.x = (ctx->width[0] - ctx->valid_width[0])/2;
-            layer_para.scn_win.width = ctx->valid_width[0];
-            layer_para.scn_win.y = (ctx->height[0] - ctx->valid_height[0])/2;
-            layer_para.scn_win.height = ctx->valid_height[0];
-            
+            if(ret < 0)
+            {
+                break;
+            }
+
+            layer_para = txn->old_layer_para;
+            if(txn->layer_mode >= 0)
+            {
+                layer_para.mode = (__disp_layer_work_mode_t)txn->layer_mode;
+            }
+            layer_para.scn_win.x = (target->width[0] - target->valid_width[0])/2;
+            layer_para.scn_win.width = target->valid_width[0];
+            layer_para.scn_win.y = (target->height[0] - target->valid_height[0])/2;
+            layer_para.scn_win.height = target->valid_height[0];
+
             arg[0] = 0;
             arg[1] = layer_hdl;
             arg[2] = (unsigned long)&layer_para;
             ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_PARA,(unsigned long)arg);
+            break;
+
+        case DISPLAY_TXN_SCNWIN1:
+            ioctl(ctx->mFD_fb[1], FBIOGET_LAYER_HDL_1, &layer_hdl);
+
+            scn_win.x = (target->width[1] - target->valid_width[1])/2;
+            scn_win.width = target->valid_width[1];
+            scn_win.y = (target->height[1] - target->valid_height[1])/2;
+            scn_win.height = target->valid_height[1];
+            arg[0] = 1;
+            arg[1] = layer_hdl;
+            arg[2] = (unsigned long)&scn_win;
+            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_SCN_WINDOW,(unsigned long)arg);
+            break;
 
-            display_open_output(dev, 0,para->d0type,para->d0format);
+        case DISPLAY_TXN_OPEN_OUT0:
+        case DISPLAY_TXN_OPEN_OUT1:
+            screen = (step == DISPLAY_TXN_OPEN_OUT0) ? 0 : 1;
+            ret = display_open_output(dev, screen, target->out_type[screen], target->out_format[screen]);
+            break;
+    }
+
+    return (ret < 0) ? -1 : 0;
+}
+
+static int display_runsteps(struct display_context_t* ctx,struct display_modetxn_t *txn,unsigned int mask)
+{
+    unsigned int                step;
+
+    for(step = 1; step <= DISPLAY_TXN_OPEN_OUT1; step <<= 1)
+    {
+        if(!(txn->steps & mask & step))
+        {
+            continue;
+        }
+        if(display_runstep(ctx, txn, step) < 0)
+        {
+            LOGE("####display_setmode step 0x%x failed, mode:%d\n", step, txn->mode);
+            return -1;
         }
+        txn->done |= step;
     }
-    else if(mode == DISPLAY_MODE_SINGLE_FB_VAR)
+
+    return 0;
+}
+
+//puts back what the applied steps changed, newest first
+static void display_undomode(struct display_context_t* ctx,struct display_modetxn_t *txn)
+{
+    struct display_device_t     *dev = &ctx->device;
+    struct display_modestate_t  *saved = &txn->saved;
+    __disp_fb_create_para_t     fb_para;
+    unsigned long               arg[4];
+    unsigned int                layer_hdl;
+    unsigned int                step;
+    int                         screen;
+
+    for(step = DISPLAY_TXN_OPEN_OUT1; step != 0; step >>= 1)
     {
-        if((para->d0type != ctx->out_type[0]) || (para->d0format != ctx->out_format[0]))
+        if(!(txn->done & step))
         {
-            unsigned int layer_hdl;
-            __disp_layer_info_t layer_para;
+            continue;
+        }
 
-            arg[0] = 0;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_RELEASE,(unsigned long)arg);
+        switch(step)
+        {
+            case DISPLAY_TXN_OPEN_OUT0:
+            case DISPLAY_TXN_OPEN_OUT1:
+                display_close_output(dev, (step == DISPLAY_TXN_OPEN_OUT0) ? 0 : 1);
+                break;
 
-            display_close_output(dev, 0);
-        
-            ctx->width[0] = display_getwidth(ctx,0,para->d0type,para->d0format);
-            ctx->height[0] = display_getheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0]    = display_getvalidwidth(ctx,0,para->d0type,para->d0format);
-            ctx->valid_height[0]   = display_getvalidheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0] = (ctx->area_percent[0] * ctx->valid_width[0]) / 100;
-            ctx->valid_height[0] = (ctx->area_percent[0] * ctx->valid_height[0]) / 100;
-
-            fb_para.fb_mode = FB_MODE_SCREEN0;
-            fb_para.mode = DISP_LAYER_WORK_MODE_NORMAL;
-            fb_para.buffer_num = 2;
-            fb_para.width = ctx->valid_width[0];
-            fb_para.height = ctx->valid_height[0];
-            fb_para.output_width = ctx->valid_width[0];
-            fb_para.output_height = ctx->valid_height[0];
-            arg[0]                      = 0;
-            arg[1]                      = (unsigned long)&fb_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_FB_REQUEST,(unsigned long)arg);
+            case DISPLAY_TXN_LAYER0:
+                //a layer of a newly requested fb goes away with the fb
+                if(!(txn->done & (DISPLAY_TXN_REQUEST_FB0 | DISPLAY_TXN_REQUEST_FB1)))
+                {
+                    ioctl(ctx->mFD_fb[txn->layer_fb], FBIOGET_LAYER_HDL_0, &layer_hdl);
+                    arg[0] = 0;
+                    arg[1] = layer_hdl;
+                    arg[2] = (unsigned long)&txn->old_layer_para;
+                    ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_PARA,(unsigned long)arg);
+                }
+                break;
 
-            ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &layer_hdl);
-            
-            arg[0] = 0;
-            arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_GET_PARA,(unsigned long)arg);
-            
-            layer_para.scn_win.x = (ctx->width[0] - ctx->valid_width[0])/2;
-            layer_para.scn_win.width = ctx->valid_width[0];
-            layer_para.scn_win.y = (ctx->height[0] - ctx->valid_height[0])/2;
-            layer_para.scn_win.height = ctx->valid_height[0];
-            
-            arg[0] = 0;
-            arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_PARA,(unsigned long)arg);
+            case DISPLAY_TXN_REQUEST_FB0:
+            case DISPLAY_TXN_REQUEST_FB1:
+                screen = (step == DISPLAY_TXN_REQUEST_FB0) ? 0 : 1;
+                display_fbcmd(ctx, DISP_CMD_FB_RELEASE, screen, NULL);
+                ctx->fb_known &= ~(1 << screen);
+                break;
+
+            case DISPLAY_TXN_CLOSE_LAYER0:
+                ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &layer_hdl);
+                arg[0] = 0;
+                arg[1] = layer_hdl;
+                ioctl(ctx->mFD_disp,DISP_CMD_LAYER_OPEN,(unsigned long)arg);
+                break;
+
+            case DISPLAY_TXN_RELEASE_FB0:
+            case DISPLAY_TXN_RELEASE_FB1:
+                //display_planmode made sure the parameters are known
+                screen = (step == DISPLAY_TXN_RELEASE_FB0) ? 0 : 1;
+                fb_para = txn->saved_fb_para[screen];
+                if(display_fbcmd(ctx, DISP_CMD_FB_REQUEST, screen, &fb_para) >= 0)
+                {
+                    ctx->fb_para[screen] = fb_para;
+                    ctx->fb_known |= (1 << screen);
+                }
+                else
+                {
+                    LOGE("####display_setmode cannot request fb%d back\n", screen);
+                }
+                break;
 
-            display_open_output(dev, 0,para->d0type,para->d0format);
+            case DISPLAY_TXN_CLOSE_OUT0:
+            case DISPLAY_TXN_CLOSE_OUT1:
+                screen = (step == DISPLAY_TXN_CLOSE_OUT0) ? 0 : 1;
+                display_open_output(dev, screen, saved->out_type[screen], saved->out_format[screen]);
+                break;
         }
     }
-    else if(mode == DISPLAY_MODE_SINGLE_VAR_GPU)
+
+    display_restoremodestate(ctx, saved);
+    txn->done = 0;
+}
+
+//a mode switch runs as one transaction: plan the steps from the state difference,
+//tear down, configure and only then enable outputs, so the panel stays blank for
+//as short as possible, and undo everything applied if a step fails
+static int display_applymode(struct display_device_t *dev,int mode,struct display_modepara_t *para)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
+    struct display_modetxn_t    txn;
+    int64_t                     start;
+    int64_t                     t0;
+    int64_t                     t1;
+    int                         ret = 1;
+
+    LOGD("####display_setmode:%d,screen0_type:%d,screen0_format:%d,screen1_type:%d,screen1:format:%d\n", 
+        mode,para->d0type,para->d0format,para->d1type,para->d1format);
+
+    start = display_gettimeus();
+
+    if(display_checkmode(ctx, mode, para) < 0)
     {
-        if((para->d0type != ctx->out_type[0]) || (para->d0format != ctx->out_format[0]))
-        {
-            unsigned int layer_hdl;
-            __disp_layer_info_t layer_para;
-            
-            display_close_output(dev, 0);
-        
-            ctx->width[0] = display_getwidth(ctx,0,para->d0type,para->d0format);
-            ctx->height[0] = display_getheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0]    = display_getvalidwidth(ctx,0,para->d0type,para->d0format);
-            ctx->valid_height[0]   = display_getvalidheight(ctx,0,para->d0type,para->d0format);
-            ctx->valid_width[0] = (ctx->area_percent[0] * ctx->valid_width[0]) / 100;
-            ctx->valid_height[0] = (ctx->area_percent[0] * ctx->valid_height[0]) / 100;
-           
-            ioctl(ctx->mFD_fb[0], FBIOGET_LAYER_HDL_0, &layer_hdl);
-            
-            arg[0] = 0;
-            arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_GET_PARA,(unsigned long)arg);
-            
-            layer_para.scn_win.x = (ctx->width[0] - ctx->valid_width[0])/2;
-            layer_para.scn_win.y = (ctx->height[0] - ctx->valid_height[0])/2;
-            layer_para.scn_win.width = ctx->valid_width[0];
-            layer_para.scn_win.height = ctx->valid_height[0];
-            
-            arg[0] = 0;
-            arg[1] = layer_hdl;
-            arg[2] = (unsigned long)&layer_para;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_LAYER_SET_PARA,(unsigned long)arg);
+        return -1;
+    }
 
-            ctx->mode = mode;
-            ctx->out_type[0] = para->d0type;
-            ctx->out_format[0] = para->d0format;
-            ctx->pixel_format [0] = para->d0pixelformat;
-            ctx->out_type[1] = para->d1type;
-            ctx->out_format[1] = para->d1format;
-            ctx->pixel_format [1] = para->d1pixelformat;
-            display_setorientation(dev,ctx->orientation);
+    txn.mode = mode;
+    txn.para = *para;
+    if(display_planmode(ctx, &txn) < 0)
+    {
+        return -1;
+    }
 
-            display_open_output(dev, 0,para->d0type,para->d0format);
-        }
+    if(mode == ctx->mode && memcmp(&txn.target, &txn.saved, sizeof(txn.target)) == 0)
+    {
+        LOGD("####display_setmode:%d unchanged\n", mode);
+        return 1;
     }
-    
-    ctx->mode = mode;
-    ctx->out_type[0] = para->d0type;
-    ctx->out_format[0] = para->d0format;
-    ctx->pixel_format [0] = para->d0pixelformat;
-    ctx->out_type[1] = para->d1type;
-    ctx->out_format[1] = para->d1format;
-    ctx->pixel_format [1] = para->d1pixelformat;
 
-    return  1;
+    t0 = display_gettimeus();
+    LOGD("####display_setmode plan:%lldus, steps:0x%x\n", (long long)(t0 - start), txn.steps);
+
+    if(display_runsteps(ctx, &txn, DISPLAY_TXN_TEARDOWN) < 0)
+    {
+        goto rollback;
+    }
+    t1 = display_gettimeus();
+    LOGD("####display_setmode teardown:%lldus\n", (long long)(t1 - t0));
+
+    //fb requests and layer windows work on the new geometry
+    memcpy(ctx->width, txn.target.width, sizeof(ctx->width));
+    memcpy(ctx->height, txn.target.height, sizeof(ctx->height));
+    memcpy(ctx->valid_width, txn.target.valid_width, sizeof(ctx->valid_width));
+    memcpy(ctx->valid_height, txn.target.valid_height, sizeof(ctx->valid_height));
+
+    t0 = t1;
+    if(display_runsteps(ctx, &txn, ~(DISPLAY_TXN_TEARDOWN | DISPLAY_TXN_ENABLE)) < 0)
+    {
+        goto rollback;
+    }
+    t1 = display_gettimeus();
+    LOGD("####display_setmode configure:%lldus\n", (long long)(t1 - t0));
+
+    display_restoremodestate(ctx, &txn.target);
+    if(mode == DISPLAY_MODE_SINGLE_VAR_GPU && (txn.steps & DISPLAY_TXN_LAYER0))
+    {
+        display_setorientation(dev,ctx->orientation);
+    }
+
+    t0 = t1;
+    if(display_runsteps(ctx, &txn, DISPLAY_TXN_ENABLE) < 0)
+    {
+        goto rollback;
+    }
+    t1 = display_gettimeus();
+    LOGD("####display_setmode enable:%lldus, total:%lldus\n", (long long)(t1 - t0), (long long)(t1 - start));
+
+    return ret;
+
+rollback:
+    t0 = display_gettimeus();
+    display_undomode(ctx, &txn);
+    t1 = display_gettimeus();
+    LOGE("####display_setmode:%d failed, rolled back to mode:%d in %lldus\n", mode, ctx->mode, (long long)(t1 - t0));
+
+    return -1;
 }
       
+static int display_setmode(struct display_device_t *dev,int mode,struct display_modepara_t *para)
+{
+    struct 	display_context_t*  ctx = (struct display_context_t*)dev;
+    int							ret;
+
+    //fbs get released and requested here, keep the mirror worker away from them meanwhile.
+    //the lock itself is only taken around each fb swap, see display_fbcmd
+    pthread_mutex_lock(&ctx->mirror.lock);
+    ctx->mirror.suspended = true;
+    ctx->mirror.active = false;
+    ctx->mirror.pending = false;
+    while(ctx->mirror.busy)
+    {
+        pthread_cond_wait(&ctx->mirror.cond, &ctx->mirror.lock);
+    }
+    ctx->mirror.dst_front = 0;
+    pthread_mutex_unlock(&ctx->mirror.lock);
+
+    ret = display_applymode(dev, mode, para);
+
+    pthread_mutex_lock(&ctx->mirror.lock);
+    ctx->mirror.suspended = false;
+    display_invalidatefbinfo(ctx);
+    pthread_mutex_unlock(&ctx->mirror.lock);
+
+    //outputs and per screen settings may all have changed, only the cursor stays
+    display_statechanged(ctx, ~(DISPLAY_STATE_CURSOR | (DISPLAY_STATE_CURSOR << 1)));
+
+    return ret;
+}
+
 static int display_getmode(struct display_device_t *dev)
 {   
     struct display_context_t* ctx = (struct display_context_t*)dev;
@@ -1879,7 +2802,7 @@ static int display_getoutputtype(struct display_device_t *dev,int displayno)
             unsigned long args[4];
 
             args[0] = displayno;
-            ret = ioctl(ctx->mFD_disp,DISP_CMD_GET_OUTPUT_TYPE,args);
+            ret = display_cachedioctl(ctx,DISPLAY_STATE_OUTTYPE << displayno,&ctx->state.out_type[displayno],DISP_CMD_GET_OUTPUT_TYPE,args);
             if(ret == DISP_OUTPUT_TYPE_LCD)
             {
                 return  DISPLAY_DEVICE_LCD;
@@ -2022,6 +2945,26 @@ static int close_display(struct hw_device_t *dev)
     struct display_context_t* ctx = (struct display_context_t*)dev;
     if (ctx) 
     {
+        display_stopuevent(ctx);
+
+        if(ctx->cursor.running)
+        {
+            pthread_mutex_lock(&ctx->cursor.lock);
+            ctx->cursor.running = false;
+            pthread_cond_signal(&ctx->cursor.cond);
+            pthread_mutex_unlock(&ctx->cursor.lock);
+            pthread_join(ctx->cursor.thread, NULL);
+        }
+
+        if(ctx->mirror.running)
+        {
+            pthread_mutex_lock(&ctx->mirror.lock);
+            ctx->mirror.running = false;
+            pthread_cond_signal(&ctx->mirror.cond);
+            pthread_mutex_unlock(&ctx->mirror.lock);
+            pthread_join(ctx->mirror.thread, NULL);
+        }
+
         if(ctx->mFD_disp)
         {
             close(ctx->mFD_disp);
@@ -2134,7 +3077,34 @@ static int open_display(const struct hw_module_t* module, const char* name,
     ctx->area_percent[0] = 100;
     ctx->area_percent[1] = 100;
 
+    pthread_mutex_init(&ctx->mirror.lock, NULL);
+    pthread_cond_init(&ctx->mirror.cond, NULL);
+    ctx->mirror.busy_buf = -1;
+    pthread_mutex_init(&ctx->state_lock, NULL);
+    ctx->uevent_fd = -1;
+    pthread_mutex_init(&ctx->cursor.lock, NULL);
+    pthread_cond_init(&ctx->cursor.cond, NULL);
+    ctx->cursor.frame_size = MAX_CURSOR_SIZE;
+
     display_init(ctx);
+    display_startuevent(ctx);
+
+    if(status == 0)
+    {
+        ctx->mirror.running = true;
+        if(pthread_create(&ctx->mirror.thread, NULL, display_mirrorthread, ctx) != 0)
+        {
+            LOGE("Error creating mirror thread, copying fb synchronously\n");
+            ctx->mirror.running = false;
+        }
+
+        ctx->cursor.running = true;
+        if(pthread_create(&ctx->cursor.thread, NULL, display_cursorthread, ctx) != 0)
+        {
+            LOGE("Error creating cursor thread, moving the cursor synchronously\n");
+            ctx->cursor.running = false;
+        }
+    }
 
     if (status == 0) 
     {
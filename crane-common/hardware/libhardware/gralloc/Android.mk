@@ -24,6 +24,7 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
 
 LOCAL_SRC_FILES := 	\
 	gralloc.cpp 	\
@@ -32,5 +33,8 @@ LOCAL_SRC_FILES := 	\
 	
 LOCAL_MODULE := gralloc.sun4i
 LOCAL_CFLAGS:= -DLOG_TAG=\"gralloc\"
+ifneq ($(BOARD_FB_NUM_BUFFERS),)
+LOCAL_CFLAGS += -DNUM_BUFFERS=$(BOARD_FB_NUM_BUFFERS)
+endif
 
 include $(BUILD_SHARED_LIBRARY)
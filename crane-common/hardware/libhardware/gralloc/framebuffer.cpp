@@ -37,13 +37,18 @@
 #include <linux/fb.h>
 #endif
 
+#include <g2d_driver.h>
+
 #include "gralloc_priv.h"
 #include "gr.h"
 
 /*****************************************************************************/
 
-// numbers of buffers for page flipping
+// numbers of buffers for page flipping. ICS surfaceflinger's window
+// only takes 2; boards whose window rotates 3 set BOARD_FB_NUM_BUFFERS
+#ifndef NUM_BUFFERS
 #define NUM_BUFFERS 2
+#endif
 
 
 enum {
@@ -53,6 +58,9 @@ enum {
 
 struct fb_context_t {
     framebuffer_device_t  device;
+    int g2d_fd;
+    // area set by setUpdateRect for the next post, empty means full screen
+    int dirty_l, dirty_t, dirty_r, dirty_b;
 };
 
 /*****************************************************************************/
@@ -74,11 +82,52 @@ static int fb_setUpdateRect(struct framebuffer_device_t* dev,
         return -EINVAL;
         
     fb_context_t* ctx = (fb_context_t*)dev;
-    private_module_t* m = reinterpret_cast<private_module_t*>(
-            dev->common.module);
-    m->info.reserved[0] = 0x54445055; // "UPDT";
-    m->info.reserved[1] = (uint16_t)l | ((uint32_t)t << 16);
-    m->info.reserved[2] = (uint16_t)(l+w) | ((uint32_t)(t+h) << 16);
+    ctx->dirty_l = l;
+    ctx->dirty_t = t;
+    ctx->dirty_r = l + w;
+    ctx->dirty_b = t + h;
+    return 0;
+}
+
+static int fb_blit_g2d(fb_context_t* ctx, private_module_t* m,
+        private_handle_t const* hnd, int l, int t, int w, int h)
+{
+    g2d_blt blit;
+    g2d_data_fmt format;
+
+    switch (m->info.bits_per_pixel) {
+        case 16:
+            format = G2D_FMT_RGB565;
+            break;
+        case 32:
+            format = G2D_FMT_ARGB_AYUV8888;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    // the posted buffer has the same geometry as the front buffer,
+    // so this is a plain copy of the dirty area at the same position
+    memset(&blit, 0, sizeof(blit));
+    blit.flag = G2D_BLT_NONE;
+    blit.src_image.addr[0] = hnd->phys;
+    blit.src_image.w = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
+    blit.src_image.h = m->info.yres;
+    blit.src_image.format = format;
+    blit.src_image.pixel_seq = G2D_SEQ_NORMAL;
+    blit.src_rect.x = l;
+    blit.src_rect.y = t;
+    blit.src_rect.w = w;
+    blit.src_rect.h = h;
+    blit.dst_image = blit.src_image;
+    blit.dst_image.addr[0] = m->finfo.smem_start;
+    blit.dst_x = l;
+    blit.dst_y = t;
+
+    if (ioctl(ctx->g2d_fd, G2D_CMD_BITBLT, (unsigned long)&blit) < 0) {
+        LOGE("G2D_CMD_BITBLT failed (%s)", strerror(errno));
+        return -errno;
+    }
     return 0;
 }
 
@@ -93,7 +142,32 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
     private_module_t* m = reinterpret_cast<private_module_t*>(
             dev->common.module);
 
-    if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) {
+    if ((hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) &&
+            m->panAsync) {
+        const size_t bufferSize = m->finfo.line_length * m->info.yres;
+        const int index = (hnd->base - m->framebuffer->base) / bufferSize;
+
+        pthread_mutex_lock(&m->lock);
+        m->busyMask |= 1LU << index;
+        // keep a single flip queued: if surfaceflinger gets a frame
+        // ahead, it waits here for the pan thread to catch up
+        while (m->panQueued >= 0)
+            pthread_cond_wait(&m->panCond, &m->lock);
+        m->panQueued = index;
+        pthread_cond_broadcast(&m->panCond);
+        // the next dequeue hands out the least recently posted buffer;
+        // it may only be drawn into once it is off the screen. count the
+        // buffers the window really rotates, not the ones the driver has:
+        // with two of them this waits for the flip, as a synchronous pan
+        int rotated = __builtin_popcount(m->bufferMask);
+        if (rotated < 2)
+            rotated = 2;
+        while (__builtin_popcount(m->busyMask) > rotated - 1)
+            pthread_cond_wait(&m->panCond, &m->lock);
+        pthread_mutex_unlock(&m->lock);
+        m->currentBuffer = buffer;
+
+    } else if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) {
         const size_t offset = hnd->base - m->framebuffer->base;
         m->info.activate = FB_ACTIVATE_VBL;
         m->info.yoffset = offset / m->finfo.line_length;
@@ -105,23 +179,52 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
         m->currentBuffer = buffer;
         
     } else {
-        // If we can't do the page_flip, just copy the buffer to the front 
-        // FIXME: use copybit HAL instead of memcpy
-        
+        // If we can't do the page_flip, copy the updated area of the
+        // buffer to the front, with the g2d engine when it can reach
+        // the buffer and with the cpu otherwise.
+        int l = 0, t = 0;
+        int r = m->info.xres, b = m->info.yres;
+        if (ctx->dirty_r > ctx->dirty_l && ctx->dirty_b > ctx->dirty_t) {
+            if (ctx->dirty_l > l) l = ctx->dirty_l;
+            if (ctx->dirty_t > t) t = ctx->dirty_t;
+            if (ctx->dirty_r < r) r = ctx->dirty_r;
+            if (ctx->dirty_b < b) b = ctx->dirty_b;
+        }
+        ctx->dirty_l = ctx->dirty_t = ctx->dirty_r = ctx->dirty_b = 0;
+        if (r <= l || b <= t)
+            return 0;
+
+        if ((hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) &&
+                hnd->phys && ctx->g2d_fd >= 0 &&
+                fb_blit_g2d(ctx, m, hnd, l, t, r - l, b - t) == 0)
+            return 0;
+
         void* fb_vaddr;
         void* buffer_vaddr;
         
         m->base.lock(&m->base, m->framebuffer, 
                 GRALLOC_USAGE_SW_WRITE_RARELY, 
-                0, 0, m->info.xres, m->info.yres,
+                l, t, r - l, b - t,
                 &fb_vaddr);
 
         m->base.lock(&m->base, buffer, 
                 GRALLOC_USAGE_SW_READ_RARELY, 
-                0, 0, m->info.xres, m->info.yres,
+                l, t, r - l, b - t,
                 &buffer_vaddr);
 
-        memcpy(fb_vaddr, buffer_vaddr, m->finfo.line_length * m->info.yres);
+        const size_t line = m->finfo.line_length;
+        const size_t bpp = m->info.bits_per_pixel >> 3;
+        const size_t first = t * line + l * bpp;
+        if (l == 0 && r == int(m->info.xres)) {
+            memcpy((char*)fb_vaddr + first, (char*)buffer_vaddr + first,
+                    line * (b - t));
+        } else {
+            for (int y = t; y < b; y++) {
+                const size_t offset = first + (y - t) * line;
+                memcpy((char*)fb_vaddr + offset, (char*)buffer_vaddr + offset,
+                        (r - l) * bpp);
+            }
+        }
         
         m->base.unlock(&m->base, buffer); 
         m->base.unlock(&m->base, m->framebuffer); 
@@ -132,6 +235,52 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
 
 /*****************************************************************************/
 
+static void* fb_pan_thread(void* arg)
+{
+    private_module_t* m = (private_module_t*)arg;
+
+    pthread_mutex_lock(&m->lock);
+    for (;;) {
+        while (m->panQueued < 0)
+            pthread_cond_wait(&m->panCond, &m->lock);
+
+        const int index = m->panQueued;
+        struct fb_var_screeninfo info = m->info;
+        pthread_mutex_unlock(&m->lock);
+
+        // blocks until the vblank that latches the new buffer
+        info.activate = FB_ACTIVATE_VBL;
+        info.yoffset = index * info.yres;
+        if (ioctl(m->framebuffer->fd, FBIOPUT_VSCREENINFO, &info) == -1) {
+            LOGE("FBIOPUT_VSCREENINFO failed (%s)", strerror(errno));
+        }
+
+        pthread_mutex_lock(&m->lock);
+        m->info.yoffset = info.yoffset;
+        // the buffer shown until now is released for drawing
+        if (m->panCurrent >= 0 && m->panCurrent != index)
+            m->busyMask &= ~(1LU << m->panCurrent);
+        m->panCurrent = index;
+        m->panQueued = -1;
+        pthread_cond_broadcast(&m->panCond);
+    }
+    return NULL;
+}
+
+void fb_wait_released(struct private_module_t* m, private_handle_t const* hnd)
+{
+    if (!m->panAsync)
+        return;
+
+    const size_t bufferSize = m->finfo.line_length * m->info.yres;
+    const int index = (hnd->base - m->framebuffer->base) / bufferSize;
+
+    pthread_mutex_lock(&m->lock);
+    while (m->busyMask & (1LU << index))
+        pthread_cond_wait(&m->panCond, &m->lock);
+    pthread_mutex_unlock(&m->lock);
+}
+
 int mapFrameBufferLocked(struct private_module_t* module)
 {
     // already initialized...
@@ -172,13 +321,19 @@ int mapFrameBufferLocked(struct private_module_t* module)
     info.activate = FB_ACTIVATE_NOW;
 
     /*
-     * Request NUM_BUFFERS screens (at lest 2 for page flipping)
+     * Request NUM_BUFFERS screens (at lest 2 for page flipping),
+     * fewer if the driver can't provide them
      */
-    info.yres_virtual = info.yres * NUM_BUFFERS;
-
-
     uint32_t flags = PAGE_FLIP;
-    if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1) {
+    int numBuffers;
+    for (numBuffers = NUM_BUFFERS; numBuffers >= 2; numBuffers--) {
+        info.yres_virtual = info.yres * numBuffers;
+        if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) != -1 &&
+                info.yres_virtual >= info.yres * numBuffers)
+            break;
+        LOGW("%d buffers not supported by the framebuffer", numBuffers);
+    }
+    if (numBuffers < 2) {
         info.yres_virtual = info.yres;
         flags &= ~PAGE_FLIP;
         LOGW("FBIOPUT_VSCREENINFO failed, page flipping not supported");
@@ -285,9 +440,35 @@ int mapFrameBufferLocked(struct private_module_t* module)
     }
     module->framebuffer->base = intptr_t(vaddr);
     memset(vaddr, 0, fbSize);
+
+    module->panQueued = -1;
+    module->panCurrent = 0;
+    module->busyMask = 0;
+    module->panAsync = false;
+    pthread_cond_init(&module->panCond, NULL);
     return 0;
 }
 
+/*
+ * Once a third framebuffer is handed out, flip from a thread so that
+ * posting frame N+1 does not wait for the vblank showing frame N. With
+ * two buffers that wait is needed anyway. Called with module->lock held.
+ */
+void fb_start_pan_thread(struct private_module_t* module)
+{
+    if (module->panAsync || !(module->flags & PAGE_FLIP))
+        return;
+
+    pthread_t thread;
+    module->panCurrent = module->info.yoffset / module->info.yres;
+    if (pthread_create(&thread, NULL, fb_pan_thread, module) == 0) {
+        pthread_detach(thread);
+        module->panAsync = true;
+    } else {
+        LOGW("couldn't start the pan thread, flipping synchronously");
+    }
+}
+
 static int mapFrameBuffer(struct private_module_t* module)
 {
     pthread_mutex_lock(&module->lock);
@@ -302,6 +483,8 @@ static int fb_close(struct hw_device_t *dev)
 {
     fb_context_t* ctx = (fb_context_t*)dev;
     if (ctx) {
+        if (ctx->g2d_fd >= 0)
+            close(ctx->g2d_fd);
         free(ctx);
     }
     return 0;
@@ -329,10 +512,19 @@ int fb_device_open(hw_module_t const* module, const char* name,
         dev->device.setSwapInterval = fb_setSwapInterval;
         dev->device.post            = fb_post;
         dev->device.setUpdateRect = 0;
+        dev->g2d_fd = -1;
 
         private_module_t* m = (private_module_t*)module;
         status = mapFrameBuffer(m);
         if (status >= 0) {
+            if (!(m->flags & PAGE_FLIP)) {
+                // every post is a copy into the single front buffer, so
+                // only the area surfaceflinger redrew needs to be moved
+                dev->device.setUpdateRect = fb_setUpdateRect;
+                dev->g2d_fd = open("/dev/g2d", O_RDWR, 0);
+                LOGW_IF(dev->g2d_fd < 0, "couldn't open /dev/g2d (%s)",
+                        strerror(errno));
+            }
             int stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
             int format = (m->info.bits_per_pixel == 32)
                          ? HAL_PIXEL_FORMAT_RGBX_8888
@@ -41,8 +41,12 @@ inline size_t roundUpToPageSize(size_t x) {
 }
 
 int mapFrameBufferLocked(struct private_module_t* module);
+void fb_wait_released(struct private_module_t* module, private_handle_t const* hnd);
+void fb_start_pan_thread(struct private_module_t* module);
 int terminateBuffer(gralloc_module_t const* module, private_handle_t* hnd);
 int mapBuffer(gralloc_module_t const* module, private_handle_t* hnd);
+int gralloc_pool_lock();
+void gralloc_pool_unlock(int fd);
 
 /*****************************************************************************/
 
@@ -26,6 +26,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 
 #include <cutils/ashmem.h>
 #include <cutils/log.h>
@@ -34,11 +37,26 @@
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
 
+#include <g2d_driver.h>
+
 #include "gralloc_priv.h"
 #include "gr.h"
 
 /*****************************************************************************/
 
+// contiguous memory a process may give to buffers that only ask for
+// HW_COMPOSER; the rest of the g2d pool stays for the decoder, the
+// camera and the framebuffer back buffers
+#ifndef COMPOSER_CONTIGUOUS_MAX
+#define COMPOSER_CONTIGUOUS_MAX (8 << 20)
+#endif
+
+// slot indexes of the g2d pool looked at when reclaiming, the size of
+// g2d_mem[] (MAX_G2D_MEM_INDEX) in the sun4i driver
+#define G2D_MEM_SLOTS 1000
+
+/*****************************************************************************/
+
 struct gralloc_context_t {
     alloc_device_t  device;
     /* our private data here */
@@ -47,6 +65,9 @@ struct gralloc_context_t {
 static int gralloc_alloc_buffer(alloc_device_t* dev,
         size_t size, int usage, buffer_handle_t* pHandle);
 
+static int gralloc_alloc_contiguous(alloc_device_t* dev,
+        size_t size, int usage, buffer_handle_t* pHandle);
+
 /*****************************************************************************/
 
 int fb_device_open(const hw_module_t* module, const char* name,
@@ -122,9 +143,11 @@ static int gralloc_alloc_framebuffer_locked(alloc_device_t* dev,
     const size_t bufferSize = m->finfo.line_length * m->info.yres;
     if (numBuffers == 1) {
         // If we have only one buffer, we never use page-flipping. Instead,
-        // we return a regular buffer which will be memcpy'ed to the main
-        // screen when post is called.
+        // we return a regular buffer which will be copied to the main
+        // screen when post is called, by g2d if it is contiguous.
         int newUsage = (usage & ~GRALLOC_USAGE_HW_FB) | GRALLOC_USAGE_HW_2D;
+        if (gralloc_alloc_contiguous(dev, bufferSize, newUsage, pHandle) == 0)
+            return 0;
         return gralloc_alloc_buffer(dev, bufferSize, newUsage, pHandle);
     }
 
@@ -146,6 +169,10 @@ static int gralloc_alloc_framebuffer_locked(alloc_device_t* dev,
         }
         vaddr += bufferSize;
     }
+
+    // the window really rotates more than two buffers
+    if (__builtin_popcount(m->bufferMask) > 2)
+        fb_start_pan_thread(m);
     
     hnd->base = vaddr;
     hnd->offset = vaddr - intptr_t(m->framebuffer->base);
@@ -194,51 +221,280 @@ static int gralloc_alloc_buffer(alloc_device_t* dev,
     return err;
 }
 
-/*****************************************************************************/
+/*
+ * The g2d driver only frees a pool slot on G2D_CMD_MEM_RELEASE, so the
+ * slots of a process that dies with buffers would be lost until reboot.
+ * The handle's fd of a contiguous buffer is therefore a socket bound to
+ * an abstract name of its slot: it travels with the buffer like any fd,
+ * and the name is only free again once every process holding the buffer
+ * has closed it. Slots in use whose name is free have no owner left.
+ */
+static int gralloc_slot_token(int index)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int n = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+            "gralloc-g2d-%d", index);
+    socklen_t len = offsetof(struct sockaddr_un, sun_path) + 1 + n;
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -errno;
+    if (bind(fd, (struct sockaddr*)&addr, len) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    return fd;
+}
 
-static int gralloc_alloc(alloc_device_t* dev,
-        int w, int h, int format, int usage,
-        buffer_handle_t* pHandle, int* pStride)
+// called with the pool lock held
+static int gralloc_reclaim_slots(int pool)
 {
-    if (!pHandle || !pStride)
-        return -EINVAL;
+    int count = 0;
+    for (int i = 0; i < G2D_MEM_SLOTS; i++) {
+        int phys = ioctl(pool, G2D_CMD_MEM_GETADR, i);
+        if (phys == 0 || phys == -1)
+            continue;
+        int token = gralloc_slot_token(i);
+        if (token < 0)
+            continue;       // still held
+        ioctl(pool, G2D_CMD_MEM_RELEASE, i);
+        close(token);
+        count++;
+    }
+    LOGW_IF(count, "released %d g2d slots without owner", count);
+    return count;
+}
 
-    size_t size, stride;
+static void gralloc_release_slot(private_handle_t const* hnd)
+{
+    // drop the token with the slot, so that nobody sees the slot free
+    // and its name still taken
+    int pool = gralloc_pool_lock();
+    if (pool >= 0)
+        ioctl(pool, G2D_CMD_MEM_RELEASE, hnd->memIndex);
+    close(hnd->fd);
+    if (pool >= 0)
+        gralloc_pool_unlock(pool);
+}
+
+static int gralloc_alloc_contiguous(alloc_device_t* dev,
+        size_t size, int usage, buffer_handle_t* pHandle)
+{
+    size = roundUpToPageSize(size);
+
+    int pool = gralloc_pool_lock();
+    if (pool < 0)
+        return pool;
+
+    int index = ioctl(pool, G2D_CMD_MEM_REQUEST, size);
+    if (index < 0 && gralloc_reclaim_slots(pool) > 0)
+        index = ioctl(pool, G2D_CMD_MEM_REQUEST, size);
+    if (index < 0) {
+        gralloc_pool_unlock(pool);
+        return -ENOMEM;
+    }
+
+    int phys = ioctl(pool, G2D_CMD_MEM_GETADR, index);
+    int token = -1;
+    if (phys != 0 && phys != -1) {
+        token = gralloc_slot_token(index);
+        // a process still holds a buffer of the slot's former owner
+        LOGW_IF(token < 0, "g2d slot %d still in use (%s)",
+                index, strerror(-token));
+    }
+    if (token < 0) {
+        ioctl(pool, G2D_CMD_MEM_RELEASE, index);
+        gralloc_pool_unlock(pool);
+        return -ENOMEM;
+    }
+    gralloc_pool_unlock(pool);
+
+    private_handle_t* hnd = new private_handle_t(token, size,
+            private_handle_t::PRIV_FLAGS_CONTIGUOUS);
+    hnd->memIndex = index;
+    hnd->phys = phys;
+
+    gralloc_module_t* module = reinterpret_cast<gralloc_module_t*>(
+            dev->common.module);
+    int err = mapBuffer(module, hnd);
+    if (err < 0) {
+        gralloc_release_slot(hnd);
+        delete hnd;
+        return err;
+    }
+
+    *pHandle = hnd;
+    return 0;
+}
+
+static bool gralloc_is_yuv(int format)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YV12:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case HAL_PIXEL_FORMAT_AW_NV12:
+        case HAL_PIXEL_FORMAT_AW_MB420:
+        case HAL_PIXEL_FORMAT_AW_MB422:
+            return true;
+    }
+    return false;
+}
+
+static bool gralloc_want_contiguous(int format, int usage)
+{
+    if (usage & (GRALLOC_USAGE_HW_2D | GRALLOC_USAGE_AW_CONTIGUOUS))
+        return true;
+    // yuv buffers go to the display engine or come from the decoder
+    // and the camera, which all need physical addresses
+    return gralloc_is_yuv(format);
+}
+
+// surfaceflinger asks for HW_COMPOSER on every window buffer, but the
+// hwcomposer only puts the rgb formats it can scan out, unscaled, on a
+// display engine layer. only those buffers are worth contiguous memory,
+// and only up to COMPOSER_CONTIGUOUS_MAX; past that they use ashmem.
+static bool gralloc_want_composer(private_module_t* m,
+        int w, int h, int format, int usage)
+{
+    if (!(usage & GRALLOC_USAGE_HW_COMPOSER))
+        return false;
 
-    int align = 4;
-    int bpp = 0;
     switch (format) {
         case HAL_PIXEL_FORMAT_RGBA_8888:
         case HAL_PIXEL_FORMAT_RGBX_8888:
         case HAL_PIXEL_FORMAT_BGRA_8888:
-            bpp = 4;
-            break;
-        case HAL_PIXEL_FORMAT_RGB_888:
-            bpp = 3;
-            break;
         case HAL_PIXEL_FORMAT_RGB_565:
-        case HAL_PIXEL_FORMAT_RGBA_5551:
-        case HAL_PIXEL_FORMAT_RGBA_4444:
-            bpp = 2;
             break;
         default:
-            return -EINVAL;
+            return false;
+    }
+
+    // a layer can't be larger than the screen without scaling
+    if (m->framebuffer &&
+            (uint32_t(w) > m->info.xres || uint32_t(h) > m->info.yres))
+        return false;
+
+    return true;
+}
+
+static bool gralloc_reserve_composer(private_module_t* m, size_t size)
+{
+    bool ok = false;
+    size = roundUpToPageSize(size);
+    pthread_mutex_lock(&m->lock);
+    if (m->composerSize + size <= COMPOSER_CONTIGUOUS_MAX) {
+        m->composerSize += size;
+        ok = true;
     }
-    size_t bpr = (w*bpp + (align-1)) & ~(align-1);
-    size = bpr * h;
-    stride = bpr / bpp;
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+static void gralloc_unreserve_composer(private_module_t* m, size_t size)
+{
+    size = roundUpToPageSize(size);
+    pthread_mutex_lock(&m->lock);
+    m->composerSize -= size;
+    pthread_mutex_unlock(&m->lock);
+}
+
+/*****************************************************************************/
 
+static int gralloc_alloc(alloc_device_t* dev,
+        int w, int h, int format, int usage,
+        buffer_handle_t* pHandle, int* pStride)
+{
+    if (!pHandle || !pStride)
+        return -EINVAL;
+
+    size_t size, stride;
+
+    if (gralloc_is_yuv(format)) {
+        switch (format) {
+            case HAL_PIXEL_FORMAT_YV12:
+                // 16 aligned luma and chroma strides, as yv12 requires
+                stride = (w + 15) & ~15;
+                size = stride * h + ((stride/2 + 15) & ~15) * h;
+                break;
+            case HAL_PIXEL_FORMAT_AW_MB420:
+            case HAL_PIXEL_FORMAT_AW_MB422: {
+                // luma and interleaved chroma in 32x32 tiles
+                int ch = (format == HAL_PIXEL_FORMAT_AW_MB420) ? h/2 : h;
+                stride = (w + 31) & ~31;
+                size = stride * ((h + 31) & ~31) + stride * ((ch + 31) & ~31);
+                break;
+            }
+            default:
+                // nv12 / nv21
+                stride = (w + 15) & ~15;
+                size = stride * ((h + 1) & ~1) * 3 / 2;
+                break;
+        }
+    } else {
+        int align = 4;
+        int bpp = 0;
+        switch (format) {
+            case HAL_PIXEL_FORMAT_RGBA_8888:
+            case HAL_PIXEL_FORMAT_RGBX_8888:
+            case HAL_PIXEL_FORMAT_BGRA_8888:
+                bpp = 4;
+                break;
+            case HAL_PIXEL_FORMAT_RGB_888:
+                bpp = 3;
+                break;
+            case HAL_PIXEL_FORMAT_RGB_565:
+            case HAL_PIXEL_FORMAT_RGBA_5551:
+            case HAL_PIXEL_FORMAT_RGBA_4444:
+                bpp = 2;
+                break;
+            default:
+                return -EINVAL;
+        }
+        size_t bpr = (w*bpp + (align-1)) & ~(align-1);
+        size = bpr * h;
+        stride = bpr / bpp;
+    }
+
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            dev->common.module);
     int err;
     if (usage & GRALLOC_USAGE_HW_FB) {
         err = gralloc_alloc_framebuffer(dev, size, usage, pHandle);
     } else {
-        err = gralloc_alloc_buffer(dev, size, usage, pHandle);
+        err = -ENOMEM;
+        if (gralloc_want_contiguous(format, usage)) {
+            err = gralloc_alloc_contiguous(dev, size, usage, pHandle);
+            LOGW_IF(err, "no contiguous memory for %dx%d (format %x), "
+                    "falling back to ashmem", w, h, format);
+        } else if (gralloc_want_composer(m, w, h, format, usage) &&
+                gralloc_reserve_composer(m, size)) {
+            err = gralloc_alloc_contiguous(dev, size, usage, pHandle);
+            if (err < 0) {
+                gralloc_unreserve_composer(m, size);
+            } else {
+                private_handle_t* hnd = (private_handle_t*)*pHandle;
+                hnd->flags |= private_handle_t::PRIV_FLAGS_COMPOSER;
+            }
+        }
+        if (err < 0) {
+            err = gralloc_alloc_buffer(dev, size, usage, pHandle);
+        }
     }
 
     if (err < 0) {
         return err;
     }
 
+    private_handle_t* hnd = (private_handle_t*)*pHandle;
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) {
+        hnd->format = format;
+        hnd->stride = stride;
+        hnd->height = h;
+    }
+
     *pStride = stride;
     return 0;
 }
@@ -261,9 +517,17 @@ static int gralloc_free(alloc_device_t* dev,
         gralloc_module_t* module = reinterpret_cast<gralloc_module_t*>(
                 dev->common.module);
         terminateBuffer(module, const_cast<private_handle_t*>(hnd));
+        if (hnd->flags & private_handle_t::PRIV_FLAGS_COMPOSER) {
+            gralloc_unreserve_composer(
+                    reinterpret_cast<private_module_t*>(module), hnd->size);
+        }
     }
 
-    close(hnd->fd);
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) {
+        gralloc_release_slot(hnd);
+    } else {
+        close(hnd->fd);
+    }
     delete hnd;
     return 0;
 }
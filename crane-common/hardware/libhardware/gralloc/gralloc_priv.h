@@ -31,6 +31,19 @@
 
 /*****************************************************************************/
 
+/* yuv layouts of the video decoder and the camera, not in graphics.h.
+ * the MB ones match HWC_FORMAT_MBYUV420/422 of hardware/hwcomposer.h */
+enum {
+    HAL_PIXEL_FORMAT_AW_MB420   = 0x56, // 32x32 tiled luma + tiled uv plane
+    HAL_PIXEL_FORMAT_AW_MB422   = 0x57,
+    HAL_PIXEL_FORMAT_AW_NV12    = 0x101,
+};
+
+/* ask for a physically contiguous buffer regardless of the format */
+#define GRALLOC_USAGE_AW_CONTIGUOUS GRALLOC_USAGE_PRIVATE_0
+
+/*****************************************************************************/
+
 struct private_module_t;
 struct private_handle_t;
 
@@ -51,6 +64,17 @@ struct private_module_t {
     float xdpi;
     float ydpi;
     float fps;
+
+    // asynchronous page flipping, see fb_pan_thread()
+    pthread_cond_t panCond;
+    int panQueued;      // buffer waiting for the pan thread, -1 if none
+    int panCurrent;     // buffer on screen, -1 before the first pan
+    uint32_t busyMask;  // buffers posted and not yet replaced on screen
+    bool panAsync;
+
+    // contiguous bytes held by buffers that only asked for HW_COMPOSER,
+    // see gralloc_want_composer()
+    size_t composerSize;
 };
 
 /*****************************************************************************/
@@ -63,7 +87,9 @@ struct private_handle_t {
 #endif
     
     enum {
-        PRIV_FLAGS_FRAMEBUFFER = 0x00000001
+        PRIV_FLAGS_FRAMEBUFFER = 0x00000001,
+        PRIV_FLAGS_CONTIGUOUS  = 0x00000002,
+        PRIV_FLAGS_COMPOSER    = 0x00000004
     };
 
     // file-descriptors
@@ -78,28 +104,46 @@ struct private_handle_t {
     int     base;
     int     pid;
 
+    // contiguous buffers only. their handles carry sNumIntsContiguous
+    // ints, all others keep the sNumInts layout prebuilt modules know.
+    // fd is then the owner token of the pool slot, see gralloc.cpp.
+    int     phys;       // physical address for the display engine / g2d
+    int     memIndex;   // slot in the g2d reserved memory pool
+    int     format;
+    int     stride;     // of the first plane, in pixels
+    int     height;
+    int     lockUsage;
+
 #ifdef __cplusplus
     static const int sNumInts = 6;
+    static const int sNumIntsContiguous = 12;
     static const int sNumFds = 1;
     static const int sMagic = 0x3141592;
 
     private_handle_t(int fd, int size, int flags) :
         fd(fd), magic(sMagic), flags(flags), size(size), offset(0),
-        base(0), pid(getpid())
+        base(0), pid(getpid()),
+        phys(0), memIndex(-1), format(0), stride(0), height(0),
+        lockUsage(0)
     {
         version = sizeof(native_handle);
-        numInts = sNumInts;
+        numInts = numIntsFor(flags);
         numFds = sNumFds;
     }
     ~private_handle_t() {
         magic = 0;
     }
 
+    static int numIntsFor(int flags) {
+        return (flags & PRIV_FLAGS_CONTIGUOUS) ? sNumIntsContiguous : sNumInts;
+    }
+
     static int validate(const native_handle* h) {
         const private_handle_t* hnd = (const private_handle_t*)h;
         if (!h || h->version != sizeof(native_handle) ||
-                h->numInts != sNumInts || h->numFds != sNumFds ||
-                hnd->magic != sMagic) 
+                h->numInts < sNumInts || h->numFds != sNumFds ||
+                hnd->magic != sMagic ||
+                h->numInts != numIntsFor(hnd->flags)) 
         {
             LOGE("invalid gralloc handle (at %p)", h);
             return -EINVAL;
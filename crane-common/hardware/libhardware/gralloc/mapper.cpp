@@ -16,6 +16,7 @@
 
 #include <limits.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
@@ -23,6 +24,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
@@ -30,7 +33,10 @@
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
 
+#include <g2d_driver.h>
+
 #include "gralloc_priv.h"
+#include "gr.h"
 
 
 /* desktop Linux needs a little help with gettid() */
@@ -43,6 +49,28 @@ pid_t gettid() { return syscall(__NR_gettid);}
 
 /*****************************************************************************/
 
+/*
+ * The g2d pool is global driver state: slot requests and releases, and
+ * the slot selection mmap of /dev/g2d depends on, run under this lock,
+ * across processes. Returns the locked /dev/g2d fd, or -errno.
+ */
+int gralloc_pool_lock()
+{
+    int fd = open("/dev/g2d", O_RDWR, 0);
+    if (fd < 0) {
+        LOGE("couldn't open /dev/g2d (%s)", strerror(errno));
+        return -errno;
+    }
+    flock(fd, LOCK_EX);
+    return fd;
+}
+
+void gralloc_pool_unlock(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
 static int gralloc_map(gralloc_module_t const* module,
         buffer_handle_t handle,
         void** vaddr)
@@ -50,8 +78,22 @@ static int gralloc_map(gralloc_module_t const* module,
     private_handle_t* hnd = (private_handle_t*)handle;
     if (!(hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)) {
         size_t size = hnd->size;
-        void* mappedAddress = mmap(0, size,
-                PROT_READ|PROT_WRITE, MAP_SHARED, hnd->fd, 0);
+        void* mappedAddress;
+        if (hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) {
+            // the g2d driver maps the pool slot selected last
+            int pool = gralloc_pool_lock();
+            if (pool < 0)
+                return pool;
+            ioctl(pool, G2D_CMD_MEM_SELIDX, hnd->memIndex);
+            mappedAddress = mmap(0, size,
+                    PROT_READ|PROT_WRITE, MAP_SHARED, pool, 0);
+            int err = errno;
+            gralloc_pool_unlock(pool);
+            errno = err;
+        } else {
+            mappedAddress = mmap(0, size,
+                    PROT_READ|PROT_WRITE, MAP_SHARED, hnd->fd, 0);
+        }
         if (mappedAddress == MAP_FAILED) {
             LOGE("Could not mmap %s", strerror(errno));
             return -errno;
@@ -84,6 +126,16 @@ static int gralloc_unmap(gralloc_module_t const* module,
 
 static pthread_mutex_t sMapLock = PTHREAD_MUTEX_INITIALIZER; 
 
+static void gralloc_sync_cache(private_handle_t* hnd)
+{
+#ifdef __arm__
+    // neither the g2d nor the display driver has a cache operation;
+    // the ARM cacheflush syscall is the one the kernel gives user
+    // space, it writes the dirty lines of the range back
+    cacheflush(hnd->base, hnd->base + hnd->size, 0);
+#endif
+}
+
 /*****************************************************************************/
 
 int gralloc_register_buffer(gralloc_module_t const* module,
@@ -142,17 +194,26 @@ int gralloc_lock(gralloc_module_t const* module,
         void** vaddr)
 {
     // this is called when a buffer is being locked for software
-    // access. in thin implementation we have nothing to do since
-    // not synchronization with the h/w is needed.
-    // typically this is used to wait for the h/w to finish with
-    // this buffer if relevant. the data cache may need to be
-    // flushed or invalidated depending on the usage bits and the
-    // hardware.
+    // access. ashmem buffers are only touched by the cpu, but
+    // contiguous ones are written by the g2d, the decoder or the
+    // camera behind the cache's back: drop stale lines before the
+    // cpu reads them.
 
     if (private_handle_t::validate(handle) < 0)
         return -EINVAL;
 
     private_handle_t* hnd = (private_handle_t*)handle;
+    if ((hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) &&
+            (usage & GRALLOC_USAGE_SW_WRITE_MASK)) {
+        // posts return before the flip, don't draw into a buffer
+        // that is still waiting for or in scan-out
+        fb_wait_released((private_module_t*)module, hnd);
+    }
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) {
+        if (usage & GRALLOC_USAGE_SW_READ_MASK)
+            gralloc_sync_cache(hnd);
+        hnd->lockUsage = usage;
+    }
     *vaddr = (void*)hnd->base;
     return 0;
 }
@@ -160,10 +221,18 @@ int gralloc_lock(gralloc_module_t const* module,
 int gralloc_unlock(gralloc_module_t const* module, 
         buffer_handle_t handle)
 {
-    // we're done with a software buffer. nothing to do in this
-    // implementation. typically this is used to flush the data cache.
+    // we're done with a software buffer. if the cpu wrote into a
+    // contiguous one, push the data out of the cache so the hardware
+    // reading it sees it.
 
     if (private_handle_t::validate(handle) < 0)
         return -EINVAL;
+
+    private_handle_t* hnd = (private_handle_t*)handle;
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_CONTIGUOUS) {
+        if (hnd->lockUsage & GRALLOC_USAGE_SW_WRITE_MASK)
+            gralloc_sync_cache(hnd);
+        hnd->lockUsage = 0;
+    }
     return 0;
 }